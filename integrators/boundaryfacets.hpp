@@ -0,0 +1,95 @@
+#ifndef FILE_BOUNDARYFACETS_HPP
+#define FILE_BOUNDARYFACETS_HPP
+
+
+/* Which facets of a volume element lie on the global boundary.
+
+   RobinVolume and NeumannVolume are volume integrators that only
+   integrate over the element facets on the global boundary, i.e. over
+   facets with a surface element. They are called for every volume
+   element, and most elements have no such facet. Instead of querying
+   the facets and their surface elements of each element, they look up
+   a bit mask (bit k set: facet k is on the boundary) in a table built
+   once per mesh, and return at once for interior elements.
+
+   There is one table per mesh (keyed by its MeshAccess), so that
+   assembling on several meshes in turn (e.g. the levels of mlschwarz)
+   does not rebuild them. A table is rebuilt when the time stamp of its
+   mesh changes (refinement; a new mesh at the address of a deleted
+   one has a new time stamp, too). Each thread keeps the table it used
+   last and looks it up without locking.
+ */
+
+
+#include <solve.hpp>
+#include <mutex>
+#include <map>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class BoundaryFacets {
+
+    struct Table {
+      const MeshAccess * ma;
+      size_t timestamp;
+      Array<unsigned> masks;     // per volume element
+    };
+
+    std::map<const MeshAccess*, shared_ptr<Table>> tables;
+    std::mutex mtx;
+
+    static bool Valid (const shared_ptr<Table> & table, const MeshAccess & ma) {
+      return table && table->ma == &ma &&
+	table->timestamp == ma.GetTimeStamp() &&
+	table->masks.Size() == ma.GetNE(VOL);
+    }
+
+    BoundaryFacets() { ; }
+
+    shared_ptr<Table> Build (const MeshAccess & ma) {
+
+      auto table = make_shared<Table>();
+      table->ma = &ma;
+      table->timestamp = ma.GetTimeStamp();
+      table->masks.SetSize(ma.GetNE(VOL));
+
+      Array<int> fnums, sels;
+      for (int i = 0; i < ma.GetNE(VOL); i++) {
+	ElementId ei(VOL, i);
+	fnums = ma.GetElFacets(ei);
+	unsigned mask = 0;
+	for (int k = 0; k < fnums.Size(); k++) {
+	  ma.GetFacetSurfaceElements (fnums[k], sels);
+	  if (sels.Size() > 0) mask |= 1u << k;
+	}
+	table->masks[i] = mask;
+      }
+      return table;
+    }
+
+  public:
+
+    static BoundaryFacets & Instance() {
+      static BoundaryFacets bf;
+      return bf;
+    }
+
+    // facets of volume element ei on the global boundary
+    unsigned Get (const MeshAccess & ma, ElementId ei) {
+
+      thread_local shared_ptr<Table> last;
+      if (!Valid(last, ma)) {
+	std::lock_guard<std::mutex> guard(mtx);
+	shared_ptr<Table> & table = tables[&ma];
+	if (!Valid(table, ma)) table = Build(ma);
+	last = table;
+      }
+      return last->masks[ei.Nr()];
+    }
+  };
+
+}
+
+#endif
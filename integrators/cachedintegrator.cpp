@@ -0,0 +1,257 @@
+#include <solve.hpp>
+#include "cachedintegrator.hpp"
+
+// See cachedintegrator.hpp for what is cached and when.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  // the integrand of a SymbolicBFI (a protected member there)
+  struct SymbolicIntegrand : public SymbolicBilinearFormIntegrator {
+    static shared_ptr<CoefficientFunction>
+    Get (const SymbolicBilinearFormIntegrator & bfi) {
+      return bfi.*(&SymbolicIntegrand::cf);
+    }
+  };
+
+
+  CachedIntegrator :: CachedIntegrator (shared_ptr<BilinearFormIntegrator> abfi,
+					bool atranslations)
+    : bfi(abfi), translations(atranslations), ecoefs(nullptr),
+      cacheable(true) {
+
+    if (bfi->SkeletonForm())
+      throw Exception ("CachedIntegrator: skeleton integrators are not "
+		       "supported");
+    if (bfi->GetDefinedOn().Size())
+      SetDefinedOn (bfi->GetDefinedOn());
+
+    if (translations)
+      ecoefs = dynamic_cast<const ElementCoefficients*> (bfi.get());
+
+    // the coefficients: parameters go into the key, GridFunctions
+    // prevent caching
+    Array<shared_ptr<CoefficientFunction>> cfs;
+    if (auto ec = dynamic_cast<const ElementCoefficients*> (bfi.get()))
+      ec->GetCoefficientFunctions(cfs);
+    else if (auto sbfi =
+	     dynamic_cast<const SymbolicBilinearFormIntegrator*> (bfi.get()))
+      cfs.Append (SymbolicIntegrand::Get(*sbfi));
+
+    for (auto & cf : cfs) {
+      if (!cf) continue;
+      cf->TraverseTree ([&] (CoefficientFunction & node) {
+	  if (auto par = dynamic_cast<ParameterCoefficientFunction*> (&node))
+	    if (!parameters.Contains(par)) parameters.Append(par);
+	  if (dynamic_cast<GridFunctionCoefficientFunction*> (&node))
+	    cacheable = false;
+	});
+    }
+
+    if (!cacheable)
+      cout << "Not caching element matrices of " << bfi->Name()
+	   << ": its coefficients contain a GridFunction" << endl;
+    else
+      cout << "Caching element matrices of " << bfi->Name()
+	   << (translations ? " (shared by translated elements)" : "") << endl;
+  }
+
+
+  void CachedIntegrator :: Clear () {
+
+    std::lock_guard<std::mutex> guard(mtx);
+    cache.clear();
+    hits = 0;
+    misses = 0;
+  }
+
+
+  // x up to about 10 digits relative to h (translated copies of an
+  // element differ by rounding errors in the relative coordinates)
+  static double Truncate (double x, double h) {
+    if (fabs(x) < 1e-10 * h) return 0;
+    int ex;
+    double m = frexp(x, &ex);
+    return ldexp(round(m * 4294967296.0) / 4294967296.0, ex);
+  }
+
+
+  const BitArray & CachedIntegrator ::
+  PeriodicVertices (const MeshAccess & ma) const {
+
+    std::lock_guard<std::mutex> guard(mtx);
+    if (!periodicverts || periodicstamp != ma.GetTimeStamp()) {
+      auto pv = make_shared<BitArray> (ma.GetNV());
+      pv->Clear();
+      for (int id = 0; id < ma.GetNPeriodicIdentifications(); id++)
+	for (auto pair : ma.GetPeriodicNodes(NT_VERTEX, id)) {
+	  pv->Set(pair[0]);
+	  pv->Set(pair[1]);
+	}
+      periodicverts = pv;
+      periodicstamp = ma.GetTimeStamp();
+    }
+    return *periodicverts;
+  }
+
+
+  FlatArray<double> CachedIntegrator ::
+  MakeKey (const FiniteElement & fel, const ElementTransformation & eltrans,
+	   LocalHeap & lh) const {
+
+    ELEMENT_TYPE et = fel.ElementType();
+    int nv = ElementTopology::GetNVertices(et);
+    const POINT3D * refverts = ElementTopology::GetVertices(et);
+    int dims = eltrans.SpaceDim();
+
+    const CompoundFiniteElement * cfel =
+      dynamic_cast<const CompoundFiniteElement*> (&fel);
+    int ncomp = cfel ? cfel->GetNComponents() : 0;
+
+    // coefficient values on the element, for translations
+    Array<Complex> cvals;
+    bool relative = translations;
+
+    // periodic spaces orient the elements by the numbers of the master
+    // vertices, not by the ones below: no sharing across identified
+    // vertices (the exact key stays consistent with the element)
+    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
+    if (relative && ma.GetNPeriodicIdentifications()) {
+      const BitArray & pv = PeriodicVertices(ma);
+      for (int v : ma.GetElVertices(eltrans.GetElementId()))
+	if (pv.Test(v)) relative = false;
+    }
+
+    bool byvalues = relative && ecoefs &&
+      ecoefs->GetElementCoefficients(eltrans, cvals, lh);
+    if (ecoefs && !byvalues) {
+      relative = false;
+      cvals.SetSize(0);
+    }
+
+    FlatArray<double> key(6 + ncomp + 2*cvals.Size() + parameters.Size()
+			  + (nv+1)*dims + nv, lh);
+    int k = 0;
+    key[k++] = relative;
+    key[k++] = et;
+    key[k++] = eltrans.VB();
+    key[k++] = byvalues ? -1 : eltrans.GetElementIndex();
+    key[k++] = fel.GetNDof();
+    key[k++] = fel.Order();
+    for (int i = 0; i < ncomp; i++)
+      key[k++] = (*cfel)[i].GetNDof();
+    for (Complex c : cvals) {
+      key[k++] = c.real();
+      key[k++] = c.imag();
+    }
+    for (auto & par : parameters)
+      key[k++] = par->GetValue();
+
+    // vertices and center in physical coordinates
+    FlatMatrix<> pts(nv+1, dims, lh);
+    double center[3] = { 0, 0, 0 };
+    for (int i = 0; i <= nv; i++) {
+      IntegrationPoint ip;
+      if (i < nv) {
+	ip = IntegrationPoint(refverts[i][0], refverts[i][1], refverts[i][2]);
+	for (int j = 0; j < 3; j++) center[j] += refverts[i][j] / nv;
+      }
+      else
+	ip = IntegrationPoint(center[0], center[1], center[2]);
+      FlatVector<> pt = pts.Row(i);
+      eltrans.CalcPoint(ip, pt);
+    }
+    if (relative) {
+      for (int i = nv; i >= 0; i--)
+	pts.Row(i) -= pts.Row(0);
+      double h = 0;
+      for (int i = 0; i <= nv; i++)
+	for (int j = 0; j < dims; j++) h = max2(h, fabs(pts(i,j)));
+      for (int i = 0; i <= nv; i++)
+	for (int j = 0; j < dims; j++) pts(i,j) = Truncate(pts(i,j), h);
+    }
+    for (int i = 0; i <= nv; i++)
+      for (int j = 0; j < dims; j++) key[k++] = pts(i,j);
+
+    // rank of each element vertex among the global vertex numbers
+    auto vnums = ma.GetElVertices(eltrans.GetElementId());
+    for (int i = 0; i < nv; i++) {
+      int rank = 0;
+      for (int j = 0; j < nv; j++)
+	if (vnums[j] < vnums[i]) rank++;
+      key[k++] = rank;
+    }
+
+    return key;
+  }
+
+
+  template <class SCAL>
+  void CachedIntegrator ::
+  T_CalcElementMatrix (const FiniteElement & fel,
+		       const ElementTransformation & eltrans,
+		       FlatMatrix<SCAL> elmat, LocalHeap & lh) const {
+
+    if (!cacheable) {
+      bfi->CalcElementMatrix(fel, eltrans, elmat, lh);
+      misses++;
+      return;
+    }
+
+    HeapReset hr(lh);
+    FlatArray<double> key = MakeKey(fel, eltrans, lh);
+
+    size_t hash = 0;
+    for (double v : key)
+      hash ^= std::hash<double>()(v) + 0x9e3779b97f4a7c15 + (hash<<6) + (hash>>2);
+
+    int nd = sizeof(SCAL)/sizeof(double);
+    size_t size = nd * elmat.Height() * elmat.Width();
+    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
+
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+
+      // new mesh: drop what the last assembly did not use
+      if (ma.GetTimeStamp() != timestamp) {
+	for (auto it = cache.begin(); it != cache.end(); )
+	  if (it->second.generation != generation)
+	    it = cache.erase(it);
+	  else
+	    ++it;
+	timestamp = ma.GetTimeStamp();
+	generation++;
+      }
+
+      auto it = cache.find(hash);
+      if (it != cache.end()) {
+	Entry & entry = it->second;
+	bool same = entry.key.Size() == key.Size() && entry.data.Size() == size;
+	for (int i = 0; same && i < key.Size(); i++)
+	  same = entry.key[i] == key[i];
+	if (same) {
+	  elmat = FlatMatrix<SCAL> (elmat.Height(), elmat.Width(),
+				    reinterpret_cast<SCAL*>(&entry.data[0]));
+	  entry.generation = generation;
+	  hits++;
+	  return;
+	}
+      }
+    }
+
+    bfi->CalcElementMatrix(fel, eltrans, elmat, lh);
+    misses++;
+
+    std::lock_guard<std::mutex> guard(mtx);
+    Entry & entry = cache[hash];
+    entry.key.SetSize(key.Size());
+    for (int i = 0; i < key.Size(); i++) entry.key[i] = key[i];
+    entry.data.SetSize(size);
+    FlatMatrix<SCAL> (elmat.Height(), elmat.Width(),
+		      reinterpret_cast<SCAL*>(&entry.data[0])) = elmat;
+    entry.generation = generation;
+  }
+
+}
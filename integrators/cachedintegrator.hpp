@@ -0,0 +1,137 @@
+#ifndef FILE_CACHEDINTEGRATOR_HPP
+#define FILE_CACHEDINTEGRATOR_HPP
+
+
+/* Element matrices kept across the steps of an adaptive loop.
+
+   Between two assemblies of an adaptive loop only the refined elements
+   change, but all element matrices are recomputed. CachedIntegrator
+   wraps a bilinear form integrator and keeps its element matrices,
+   keyed on what they depend on:
+
+     - element type, VorB and element index (material),
+     - number of dofs and order of the element (and of its components),
+     - the physical coordinates of the element vertices (in element
+       order) and of its center (which catches curved elements),
+     - the order of the global vertex numbers (dof orientation).
+
+   An element matrix is only recomputed if no element with the same key
+   was seen in the last assembly. Entries not used during one assembly
+   are dropped when the mesh changes (the mesh time stamp).
+
+   With translations = true, elements that are translated copies of each
+   other share their matrix: the vertex coordinates enter the key
+   relative to the first vertex (to about 10 digits), and the element
+   index is replaced by the values of the (element-wise constant)
+   coefficients on the element, for integrators of this library (see
+   ElementCoefficients in dpgcoefficient.hpp); elements on which one of
+   them is not constant get the exact key. Other integrators (e.g.
+   SymbolicBFI) keep the element index, and their coefficients must be
+   constant on each material. Elements at vertices of periodic
+   identifications get the exact key, since periodic spaces orient
+   them by the master vertices, which the key does not see. On structured
+   meshes (GenerateCubeMesh, layered periodic meshes) only a few
+   element matrices are computed.
+
+   The coefficients of the wrapped integrator enter the key by identity:
+   the values of the Parameter coefficients in them are part of the key,
+   so that changing a parameter does not return stale matrices.
+   Integrators whose coefficients contain a GridFunction (which has no
+   version to key on) are not cached at all; their matrices are always
+   recomputed. This needs the coefficients of the integrator, which are
+   known for SymbolicBFI and the integrators of this library; for other
+   integrators the coefficients must depend only on the position and
+   the material, or Clear() must be called when they change.
+
+   Python (import libDPG):
+
+      a += libDPG.Cached(SymbolicBFI(grad(u) * grad(v)))
+      a += libDPG.Cached(BFI("gradgrad", coef=[2,1,1.0]), translations=True)
+ */
+
+
+#include <solve.hpp>
+#include <mutex>
+#include <unordered_map>
+#include "dpgcoefficient.hpp"
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class CachedIntegrator : public BilinearFormIntegrator {
+
+    shared_ptr<BilinearFormIntegrator> bfi;
+    bool translations;
+    const ElementCoefficients * ecoefs;   // of a libDPG integrator
+    Array<ParameterCoefficientFunction*> parameters;   // owned by bfi
+    bool cacheable;                       // no GridFunction coefficient
+
+    struct Entry {
+      Array<double> key;       // the full key (hash collisions)
+      Array<double> data;      // the matrix (two doubles per Complex)
+      size_t generation;       // last assembly using it
+    };
+
+    mutable std::unordered_map<size_t, Entry> cache;
+    mutable std::mutex mtx;
+    mutable size_t timestamp = size_t(-1);
+    mutable size_t generation = 0;
+    mutable atomic<size_t> hits{0}, misses{0};
+
+    // vertices in periodic identifications of the mesh
+    mutable shared_ptr<BitArray> periodicverts;
+    mutable size_t periodicstamp = size_t(-1);
+
+  public:
+
+    CachedIntegrator (shared_ptr<BilinearFormIntegrator> abfi,
+		      bool translations = false);
+
+    virtual string Name () const { return "Cached(" + bfi->Name() + ")"; }
+
+    virtual xbool IsSymmetric () const { return bfi->IsSymmetric(); }
+    virtual int DimElement () const { return bfi->DimElement(); }
+    virtual int DimSpace () const { return bfi->DimSpace(); }
+    virtual bool BoundaryForm () const { return bfi->BoundaryForm(); }
+    virtual VorB VB () const { return bfi->VB(); }
+
+    virtual void CalcElementMatrix (const FiniteElement & fel,
+				    const ElementTransformation & eltrans,
+				    FlatMatrix<double> elmat,
+				    LocalHeap & lh) const {
+      T_CalcElementMatrix<double> (fel, eltrans, elmat, lh);
+    }
+
+    virtual void CalcElementMatrix (const FiniteElement & fel,
+				    const ElementTransformation & eltrans,
+				    FlatMatrix<Complex> elmat,
+				    LocalHeap & lh) const {
+      T_CalcElementMatrix<Complex> (fel, eltrans, elmat, lh);
+    }
+
+    // forget all element matrices
+    void Clear ();
+
+    size_t Hits () const { return hits; }
+    size_t Misses () const { return misses; }
+    size_t Size () const { return cache.size(); }
+    bool Cacheable () const { return cacheable; }
+
+  private:
+
+    template <class SCAL>
+    void T_CalcElementMatrix (const FiniteElement & fel,
+			      const ElementTransformation & eltrans,
+			      FlatMatrix<SCAL> elmat, LocalHeap & lh) const;
+
+    const BitArray & PeriodicVertices (const MeshAccess & ma) const;
+
+    FlatArray<double> MakeKey (const FiniteElement & fel,
+			       const ElementTransformation & eltrans,
+			       LocalHeap & lh) const;
+  };
+
+}
+
+#endif
@@ -0,0 +1,368 @@
+#include <solve.hpp>
+#include "dpgbundle.hpp"
+#include "facetshapecache.hpp"
+#include "sumfactorization.hpp"
+
+// DPG volume integrators computed in one pass (see dpgbundle.hpp)
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  static const int nkernels = 7;
+  static const char * kernelnames[nkernels] =
+    { "gradgrad", "eyeeye", "curlcurlpg", "eyeeyeedge",
+      "flxtrc", "trctrc", "trctrcxn" };
+
+
+  DPGTerm::DPGTerm (string name, int aind1, int aind2,
+		    shared_ptr<CoefficientFunction> acoef, int dim)
+    : ind1(aind1-1), ind2(aind2-1), coef(acoef) {
+
+    int k = 0;
+    while (k < nkernels && name != kernelnames[k]) k++;
+    if (k == nkernels)
+      throw Exception ("DPGBundle: unknown kernel " + name);
+    kernel = DPG_KERNEL(k);
+
+    if (dim != 3 && (kernel == KERNEL_CURLCURL ||
+		     kernel == KERNEL_TRACETRACEXN))
+      throw Exception ("DPGBundle: " + name + " is available in 3D only");
+  }
+
+  string DPGTerm::Name () const { return kernelnames[kernel]; }
+
+
+  //////////////////////////////////////////////////////////////
+  // Tables of mapped shapes of one component at all points of the
+  // volume or the facet rule: [ndof x width*npts], point k in the
+  // columns [width*k, width*k+width).
+
+  enum { TABLE_VALUE, TABLE_GRAD, TABLE_HCURL, TABLE_CURL,  // volume
+	 TABLE_FVALUE, TABLE_FNORMAL,                        // facets
+	 TABLE_FHCURL, TABLE_FHCURLXN };
+
+  // trial (ind1) and test (ind2) tables of each kernel
+  static const int trialtable[nkernels] =
+    { TABLE_GRAD, TABLE_VALUE, TABLE_CURL, TABLE_HCURL,
+      TABLE_FNORMAL, TABLE_FVALUE, TABLE_FHCURL };
+  static const int testtable[nkernels] =
+    { TABLE_GRAD, TABLE_VALUE, TABLE_CURL, TABLE_HCURL,
+      TABLE_FVALUE, TABLE_FVALUE, TABLE_FHCURLXN };
+
+  template <int D>
+  inline int TableWidth (int kind) {
+    switch (kind) {
+    case TABLE_GRAD: case TABLE_HCURL:
+    case TABLE_FHCURL: case TABLE_FHCURLXN:
+      return D;
+    case TABLE_CURL:
+      return (D == 3) ? 3 : 1;
+    default:
+      return 1;
+    }
+  }
+
+  // the tables computed for the current element
+  class ShapeTables {
+
+    struct Entry { int comp; int kind; size_t h; size_t w; double * data; };
+    ArrayMem<Entry,16> entries;
+
+  public:
+
+    template <class FUNC>
+    FlatMatrix<double> Get (int comp, int kind, FUNC && compute) {
+      for (auto & e : entries)
+	if (e.comp == comp && e.kind == kind)
+	  return FlatMatrix<double> (e.h, e.w, e.data);
+      FlatMatrix<double> mat = compute();
+      entries.Append (Entry{comp, kind, mat.Height(), mat.Width(), mat.Data()});
+      return mat;
+    }
+  };
+
+  template <int D>
+  void CalcVolumeTable (const FiniteElement & fel, int kind,
+			const IntegrationRule & ir,
+			const MappedIntegrationRule<D,D> & mir,
+			FlatMatrix<double> mat) {
+
+    int nip = ir.GetNIP();
+    int w = TableWidth<D>(kind);
+
+    switch (kind) {
+
+    case TABLE_VALUE:
+      FECast<ScalarFiniteElement<D>> (fel).CalcShape (ir, mat);
+      break;
+
+    case TABLE_GRAD:
+      SwitchFE<D>::Scalar (FECast<ScalarFiniteElement<D>> (fel),
+			   [&] (const auto & sfel) {
+	for (int k = 0; k < nip; k++)
+	  fe::CalcMappedDShape (sfel, mir[k], mat.Cols(IntRange(w*k, w*k+w)));
+      });
+      break;
+
+    case TABLE_HCURL:
+      SwitchFE<D>::HCurl (FECast<HCurlFiniteElement<D>> (fel),
+			  [&] (const auto & hfel) {
+	for (int k = 0; k < nip; k++)
+	  fe::CalcMappedShape (hfel, mir[k], mat.Cols(IntRange(w*k, w*k+w)));
+      });
+      break;
+
+    case TABLE_CURL:
+      SwitchFE<D>::HCurl (FECast<HCurlFiniteElement<D>> (fel),
+			  [&] (const auto & hfel) {
+	for (int k = 0; k < nip; k++)
+	  fe::CalcMappedCurlShape (hfel, mir[k], mat.Cols(IntRange(w*k, w*k+w)));
+      });
+      break;
+    }
+  }
+
+
+  //////////////////////////////////////////////////////////////
+
+  inline int TermOrder (const DPGTerm & t, const CompoundFiniteElement & cfel) {
+    int order = cfel[t.ind1].Order() + cfel[t.ind2].Order();
+    if (t.kernel == KERNEL_GRADGRAD || t.kernel == KERNEL_CURLCURL)
+      order -= 2;
+    return max2(order, 0);
+  }
+
+  template <class SCAL>
+  inline void AddBlock (const CompoundFiniteElement & cfel, const DPGTerm & t,
+			FlatMatrix<SCAL> submat, FlatMatrix<SCAL> elmat) {
+    IntRange r1 = cfel.GetRange(t.ind1);
+    IntRange r2 = cfel.GetRange(t.ind2);
+    elmat.Rows(r2).Cols(r1) += submat;
+    if (t.ind1 != t.ind2)
+      elmat.Rows(r1).Cols(r2) += Conj(Trans(submat));
+  }
+
+  // sum factorization of the scalar kernels (quads and hexes)
+  template <int D, class SCAL>
+  bool TensorTerm (const DPGTerm & t, const CompoundFiniteElement & cfel,
+		   const ElementTransformation & eltrans,
+		   FlatMatrix<SCAL> submat, LocalHeap & lh) {
+
+    int order = TermOrder(t, cfel);
+    switch (t.kernel) {
+    case KERNEL_GRADGRAD:
+      return TensorGradGrad<D,SCAL>
+	(FECast<ScalarFiniteElement<D>> (cfel[t.ind1]),
+	 FECast<ScalarFiniteElement<D>> (cfel[t.ind2]),
+	 eltrans, t.coef, order, submat, lh);
+    case KERNEL_EYEEYE:
+      return TensorEyeEye<D,SCAL>
+	(FECast<ScalarFiniteElement<D>> (cfel[t.ind1]),
+	 FECast<ScalarFiniteElement<D>> (cfel[t.ind2]),
+	 eltrans, t.coef, order, submat, lh);
+    case KERNEL_TRACETRACE:
+      return TensorTraceTrace<D,SCAL>
+	(FECast<ScalarFiniteElement<D>> (cfel[t.ind1]),
+	 FECast<ScalarFiniteElement<D>> (cfel[t.ind2]),
+	 eltrans, t.coef, order, submat, lh);
+    case KERNEL_FLUXTRACE:
+      return TensorFluxTrace<D,SCAL>
+	(FECast<HDivFiniteElement<D>> (cfel[t.ind1]),
+	 FECast<ScalarFiniteElement<D>> (cfel[t.ind2]),
+	 eltrans, t.coef, order, submat, lh);
+    default:
+      return false;
+    }
+  }
+
+
+  //////////////////////////////////////////////////////////////
+
+  template <int D>
+  DPGBundle<D>::DPGBundle (const Array<shared_ptr<DPGTerm>> & aterms)
+    : terms(aterms) {
+
+    cout << "Using DPG integrator " << Name() << " with terms";
+    for (auto & t : terms)
+      cout << " " << t->Name() << " (" << t->ind1+1 << "," << t->ind2+1 << ")";
+    cout << endl;
+  }
+
+
+  template<int D> template <class SCAL>
+  void DPGBundle<D>::T_CalcElementMatrix (const FiniteElement & base_fel,
+			    const ElementTransformation & eltrans,
+			    FlatMatrix<SCAL> elmat,
+			    LocalHeap & lh) const {
+
+    const CompoundFiniteElement &  cfel  // product space
+      =  FECast<CompoundFiniteElement> (base_fel);
+
+    ELEMENT_TYPE eltype = base_fel.ElementType();
+    int nterms = terms.Size();
+
+    elmat = SCAL(0.0);
+
+    // quadrilaterals and hexahedra: sum factorization, where available
+    FlatArray<bool> done(nterms, lh);
+    done = false;
+    if (eltype == ET_QUAD || eltype == ET_HEX)
+      for (int l = 0; l < nterms; l++) {
+	HeapReset hr(lh);
+	const DPGTerm & t = *terms[l];
+	FlatMatrix<SCAL> submat(cfel[t.ind2].GetNDof(),
+				cfel[t.ind1].GetNDof(), lh);
+	if (TensorTerm<D,SCAL> (t, cfel, eltrans, submat, lh)) {
+	  AddBlock (cfel, t, submat, elmat);
+	  done[l] = true;
+	}
+      }
+
+    // one rule for all volume terms and one for all facet terms,
+    // exact for each of them
+    int volorder = -1, facetorder = -1;
+    for (int l = 0; l < nterms; l++) {
+      if (done[l]) continue;
+      int order = TermOrder(*terms[l], cfel);
+      if (terms[l]->OnFacets())
+	facetorder = max2(facetorder, order);
+      else
+	volorder = max2(volorder, order);
+    }
+
+    // volume terms
+    if (volorder >= 0) {
+
+      HeapReset hr(lh);
+      const IntegrationRule & ir = SelectIntegrationRule(eltype, volorder);
+      int nip = ir.GetNIP();
+      MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
+
+      FlatVector<double> weights(nip, lh);
+      for (int k = 0; k < nip; k++)
+	weights(k) = mir[k].GetWeight();
+
+      ShapeTables tables;
+      auto table = [&] (int comp, int kind) {
+	return tables.Get (comp, kind, [&] () {
+	    FlatMatrix<double> mat(cfel[comp].GetNDof(),
+				   TableWidth<D>(kind)*nip, lh);
+	    CalcVolumeTable<D> (cfel[comp], kind, ir, mir, mat);
+	    return mat;
+	  });
+      };
+
+      // all tables first: the heap is reset after each block
+      for (int l = 0; l < nterms; l++) {
+	const DPGTerm & t = *terms[l];
+	if (done[l] || t.OnFacets()) continue;
+	table(t.ind1, trialtable[t.kernel]);
+	table(t.ind2, testtable[t.kernel]);
+      }
+
+      for (int l = 0; l < nterms; l++) {
+	const DPGTerm & t = *terms[l];
+	if (done[l] || t.OnFacets()) continue;
+	HeapReset hr(lh);
+	FlatMatrix<SCAL> submat(cfel[t.ind2].GetNDof(),
+				cfel[t.ind1].GetNDof(), lh);
+	CalcADBt (t.coef, mir, weights, TableWidth<D>(testtable[t.kernel]),
+		  table(t.ind2, testtable[t.kernel]),
+		  table(t.ind1, trialtable[t.kernel]), submat, lh);
+	AddBlock (cfel, t, submat, elmat);
+      }
+    }
+
+    // element boundary terms
+    if (facetorder >= 0) {
+
+      HeapReset hr(lh);
+      FacetShapeCache<D> & cache = FacetShapeCache<D>::Instance();
+      const FacetRule & fr = cache.GetRule(eltype, facetorder);
+      unsigned orient = VertexOrientation(eltrans);
+      int npts = fr.ir.GetNIP();
+      MappedIntegrationRule<D,D> mir(fr.ir, eltrans, lh);
+      FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
+
+      // facet geometry, once for all terms
+      FlatVector<double> wds(npts, lh);     // weight * surface measure
+      FlatVector<double> wpiola(npts, lh);  // sign(det) * reference weight
+      FlatMatrixFixWidth<D> unormal(npts, lh);
+      for (int i = 0; i < npts; i++) {
+	Mat<D> inv_jac = mir[i].GetJacobianInverse();
+	double det = mir[i].GetJacobiDet();
+	Vec<D> normal = fabs(det) * Trans(inv_jac) * normals[fr.facetnr[i]];
+	double len = L2Norm(normal);
+	unormal.Row(i) = (1.0/len) * normal;
+	wds(i) = fr.ir[i].Weight() * len;
+	wpiola(i) = (det < 0) ? -fr.ir[i].Weight() : fr.ir[i].Weight();
+      }
+
+      ShapeTables tables;
+      std::function<FlatMatrix<double>(int,int)> table;
+      table = [&] (int comp, int kind) {
+	return tables.Get (comp, kind, [&] () -> FlatMatrix<double> {
+	    const FiniteElement & fel = cfel[comp];
+	    switch (kind) {
+	    case TABLE_FVALUE:
+	      return cache.GetShapes(fel, FACET_SCALAR, fr, facetorder, orient, lh);
+	    case TABLE_FNORMAL:
+	      return cache.GetShapes(fel, FACET_HDIV_NORMAL, fr, facetorder, orient, lh);
+	    case TABLE_FHCURL: {
+	      // covariant map of the reference H(curl) values
+	      FlatMatrix<> ref =
+		cache.GetShapes(fel, FACET_HCURL, fr, facetorder, orient, lh);
+	      FlatMatrix<double> mat(fel.GetNDof(), D*npts, lh);
+	      for (int i = 0; i < npts; i++) {
+		IntRange cols(D*i, D*i+D);
+		Mat<D> inv_jac = mir[i].GetJacobianInverse();
+		mat.Cols(cols) = ref.Cols(cols) * inv_jac;
+	      }
+	      return mat;
+	    }
+	    default: {         // TABLE_FHCURLXN:  F x n  (3D)
+	      FlatMatrix<double> shape = table(comp, TABLE_FHCURL);
+	      FlatMatrix<double> mat(fel.GetNDof(), D*npts, lh);
+	      for (int i = 0; i < npts && D == 3; i++) {
+		Vec<D> n = unormal.Row(i);
+		int c = D*i;
+		mat.Col(c  ) = n(2)*shape.Col(c+1) - n(1)*shape.Col(c+2);
+		mat.Col(c+1) = n(0)*shape.Col(c+2) - n(2)*shape.Col(c  );
+		mat.Col(c+2) = n(1)*shape.Col(c  ) - n(0)*shape.Col(c+1);
+	      }
+	      return mat;
+	    }
+	    }
+	  });
+      };
+
+      for (int l = 0; l < nterms; l++) {
+	const DPGTerm & t = *terms[l];
+	if (done[l] || !t.OnFacets()) continue;
+	table(t.ind1, trialtable[t.kernel]);
+	table(t.ind2, testtable[t.kernel]);
+      }
+
+      for (int l = 0; l < nterms; l++) {
+	const DPGTerm & t = *terms[l];
+	if (done[l] || !t.OnFacets()) continue;
+	HeapReset hr(lh);
+	FlatMatrix<SCAL> submat(cfel[t.ind2].GetNDof(),
+				cfel[t.ind1].GetNDof(), lh);
+	// With the Piola map, (mapped q).n * ds = sign(det) * q.n_ref *
+	// (reference facet weight), see FluxTrace.
+	FlatVector<double> weights =
+	  (t.kernel == KERNEL_FLUXTRACE) ? wpiola : wds;
+	CalcADBt (t.coef, mir, weights, TableWidth<D>(testtable[t.kernel]),
+		  table(t.ind2, testtable[t.kernel]),
+		  table(t.ind1, trialtable[t.kernel]), submat, lh);
+	AddBlock (cfel, t, submat, elmat);
+      }
+    }
+  }
+
+
+  template class DPGBundle<2>;
+  template class DPGBundle<3>;
+}
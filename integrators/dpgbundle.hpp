@@ -0,0 +1,119 @@
+#ifndef FILE_DPGBUNDLE_HPP
+#define FILE_DPGBUNDLE_HPP
+
+
+/* A bundle of DPG volume integrators computed in one pass.
+
+   A DPG form usually consists of several of the integrators of
+   dpgintegrators.hpp and hcurlintegrators.cpp on the same compound
+   space, e.g. for Maxwell
+
+      curlcurlpg (2) (1),  eyeeyeedge (2) (1),  trctrcxn (3) (1).
+
+   Added separately, each of them casts the elements, maps the
+   integration points, computes the mapped shapes (of the same
+   components) and zero-fills its own element matrix. DPGBundle takes
+   the list of terms
+
+      (kernel, ind1, ind2, coefficient)
+
+   with the kernel given by the name of the integrator and the
+   (1-based) components as in the coefficient list of that integrator.
+   Per element it maps one volume rule and one facet rule (of the
+   highest order needed by the terms), computes each needed table of
+   mapped shapes once per component, and adds all blocks to one
+   element matrix.
+
+   Kernels:  gradgrad, eyeeye, curlcurlpg, eyeeyeedge  (volume)
+             flxtrc, trctrc, trctrcxn                    (element boundary)
+
+   Boundary integrators (like xnbdry) work on other elements and are
+   added separately.
+ */
+
+
+#include <solve.hpp>
+#include "dpgintegrators.hpp"
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  enum DPG_KERNEL { KERNEL_GRADGRAD, KERNEL_EYEEYE, KERNEL_CURLCURL,
+		    KERNEL_EYEEYEEDGE, KERNEL_FLUXTRACE, KERNEL_TRACETRACE,
+		    KERNEL_TRACETRACEXN };
+
+  class DPGTerm {
+
+  public:
+
+    DPG_KERNEL kernel;
+    int ind1;              // trial component (0-based)
+    int ind2;              // test component
+    DPGCoefficient coef;
+
+    DPGTerm (string name, int aind1, int aind2,
+	     shared_ptr<CoefficientFunction> acoef, int dim);
+
+    bool OnFacets() const { return kernel >= KERNEL_FLUXTRACE; }
+    string Name() const;
+  };
+
+
+  template <int D>
+  class DPGBundle : public BilinearFormIntegrator,
+		    public ElementCoefficients {
+
+    Array<shared_ptr<DPGTerm>> terms;
+
+    template<class SCAL>
+    void T_CalcElementMatrix (const FiniteElement & base_fel,
+			      const ElementTransformation & eltrans,
+			      FlatMatrix<SCAL> elmat,
+			      LocalHeap & lh)  const ;
+  public:
+
+    DPGBundle (const Array<shared_ptr<DPGTerm>> & aterms);
+
+    virtual xbool IsSymmetric() const {
+      for (auto & t : terms)
+	if (t->coef->IsComplex()) return false;
+      return true;
+    }
+
+    virtual string Name () const { return "DPGBundle"; }
+    virtual int DimSpace () const { return D; }
+    virtual bool BoundaryForm () const { return false; }
+    virtual VorB VB() const { return VOL; }
+
+    virtual bool GetElementCoefficients (const ElementTransformation & eltrans,
+					 Array<Complex> & vals,
+					 LocalHeap & lh) const {
+      HeapReset hr(lh);
+      const BaseMappedIntegrationPoint & mip = ElementCenter(eltrans, lh);
+      for (auto & t : terms)
+	if (!AppendValue(t->coef, mip, vals)) return false;
+      return true;
+    }
+
+    virtual void GetCoefficientFunctions
+    (Array<shared_ptr<CoefficientFunction>> & cfs) const {
+      for (auto & t : terms) cfs.Append (t->coef.Get());
+    }
+
+    void CalcElementMatrix (const FiniteElement & base_fel,
+			    const ElementTransformation & eltrans,
+			    FlatMatrix<double> elmat,
+			    LocalHeap & lh) const {
+      T_CalcElementMatrix<double>(base_fel,eltrans,elmat,lh);
+    }
+    void CalcElementMatrix (const FiniteElement & base_fel,
+			    const ElementTransformation & eltrans,
+			    FlatMatrix<Complex> elmat,
+			    LocalHeap & lh) const {
+      T_CalcElementMatrix<Complex>(base_fel,eltrans,elmat, lh);
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef FILE_DPGCOEFFICIENT_HPP
+#define FILE_DPGCOEFFICIENT_HPP
+
+
+/* Coefficients of the DPG integrators.
+
+   The coefficients passed to the integrators are mostly constants
+   (1.0, 1j) or tables of per-material values (CoefficientFunction of
+   a list). DPGCoefficient classifies a CoefficientFunction when the
+   integrator is constructed:
+
+     constant          value stored, never evaluated again
+     element constant  (ElementwiseConstant(), e.g. domain-wise
+                       constants) evaluated once per element
+     varying           evaluated on the whole integration rule at once
+
+   In the first two cases integrators form the coefficient-free (real)
+   element matrix and scale it once, see CalcADBt in dpgintegrators.hpp.
+
+   Use it like the shared_ptr it replaces: coeff->IsComplex(), *coeff.
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class DPGCoefficient {
+
+    shared_ptr<CoefficientFunction> cf;
+    bool constant;
+    bool elconstant;
+    Complex val;
+
+  public:
+
+    DPGCoefficient (shared_ptr<CoefficientFunction> acf)
+      : cf(acf), constant(false), elconstant(false), val(0.0) {
+
+      if (dynamic_pointer_cast<ConstantCoefficientFunction> (cf)) {
+	constant = true;
+	val = cf -> EvaluateConst();
+      }
+      else if (dynamic_pointer_cast<ConstantCoefficientFunctionC> (cf)) {
+	constant = true;
+	BaseMappedIntegrationPoint ip;
+	val = cf -> EvaluateComplex(ip);
+      }
+      elconstant = constant || (cf && cf -> ElementwiseConstant());
+    }
+
+    const CoefficientFunction * operator-> () const { return cf.get(); }
+    const CoefficientFunction & operator* () const { return *cf; }
+    shared_ptr<CoefficientFunction> Get () const { return cf; }
+
+    bool IsConstant () const { return constant; }
+    bool ElementConstant () const { return elconstant; }
+
+    // value at one point
+    template <class SCAL>
+    SCAL T_Evaluate (const BaseMappedIntegrationPoint & mip) const {
+      if (constant) return Value<SCAL>();
+      return cf -> T_Evaluate<SCAL> (mip);
+    }
+
+    // value on the element, if ElementConstant()
+    template <class SCAL>
+    SCAL ElementValue (const BaseMappedIntegrationRule & mir) const {
+      if (constant) return Value<SCAL>();
+      return cf -> T_Evaluate<SCAL> (mir[0]);
+    }
+
+    // values at all points of mir
+    template <class SCAL>
+    void Evaluate (const BaseMappedIntegrationRule & mir,
+		   FlatVector<SCAL> vals) const {
+      if (elconstant)
+	vals = ElementValue<SCAL> (mir);
+      else
+	cf -> Evaluate (mir, FlatMatrix<SCAL> (vals.Size(), 1, vals.Data()));
+    }
+
+  private:
+
+    template <class SCAL> SCAL Value () const;
+  };
+
+  template <> inline double DPGCoefficient::Value<double> () const
+  { return val.real(); }
+
+  template <> inline Complex DPGCoefficient::Value<Complex> () const
+  { return val; }
+
+
+
+  /////////////////////////////////////////////////////////////////
+  // Integrators whose element matrix depends only on the shape of the
+  // element (not its position) and on the values of their
+  // coefficients on it. CachedIntegrator uses these values to reuse
+  // the matrices of translated copies of an element.
+
+  class ElementCoefficients {
+
+  public:
+
+    virtual ~ElementCoefficients () { ; }
+
+    // append the coefficient values on the element to vals; false if
+    // a coefficient is not constant on the element (or the matrix
+    // depends on more than the coefficients and the shape)
+    virtual bool GetElementCoefficients (const ElementTransformation & eltrans,
+					 Array<Complex> & vals,
+					 LocalHeap & lh) const = 0;
+
+    // append the coefficient functions the matrix depends on
+    virtual void GetCoefficientFunctions
+    (Array<shared_ptr<CoefficientFunction>> & cfs) const = 0;
+
+  protected:
+
+    static const BaseMappedIntegrationPoint &
+    ElementCenter (const ElementTransformation & eltrans, LocalHeap & lh) {
+
+      ELEMENT_TYPE et = eltrans.GetElementType();
+      int nv = ElementTopology::GetNVertices(et);
+      const POINT3D * verts = ElementTopology::GetVertices(et);
+      double c[3] = { 0, 0, 0 };
+      for (int i = 0; i < nv; i++)
+	for (int j = 0; j < 3; j++) c[j] += verts[i][j] / nv;
+      return eltrans(IntegrationPoint(c[0], c[1], c[2]), lh);
+    }
+
+    static bool AppendValue (const DPGCoefficient & coef,
+			     const BaseMappedIntegrationPoint & mip,
+			     Array<Complex> & vals) {
+      if (!coef.ElementConstant()) return false;
+      vals.Append (coef.T_Evaluate<Complex> (mip));
+      return true;
+    }
+  };
+
+}
+
+#endif
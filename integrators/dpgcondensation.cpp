@@ -0,0 +1,338 @@
+#include <solve.hpp>
+#include "dpgcondensation.hpp"
+#include "../misc/densefactor.hpp"
+
+// See dpgcondensation.hpp for what is computed here.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  DPGCondensation :: DPGCondensation (shared_ptr<BilinearForm> abfa,
+				      shared_ptr<LinearForm> alff,
+				      int atestcomp, bool acache)
+    : bfa(abfa), lff(alff), testcomp(atestcomp), cache(acache) {
+
+    auto fes = dynamic_pointer_cast<CompoundFESpace> (bfa->GetFESpace());
+    if (!fes)
+      throw Exception ("DPGCondensation: form must be on a compound space");
+    if (testcomp < 0 || testcomp >= fes->GetNSpaces())
+      throw Exception ("DPGCondensation: no such test component");
+    if (lff && lff->GetFESpace() != fes)
+      throw Exception ("DPGCondensation: forms must be on the same space");
+
+    for (int i = 0; i < fes->GetNSpaces(); i++)
+      if (i != testcomp) trialcomps.Append(i);
+
+    for (int i = 0; i < bfa->NumIntegrators(); i++)
+      if (bfa->GetIntegrator(i)->SkeletonForm())
+	throw Exception ("DPGCondensation: skeleton integrators cannot be "
+			 "condensed element by element");
+
+    cout << "DPG condensation of component " << testcomp
+	 << " using " << bfa->NumIntegrators() << " integrators" << endl;
+  }
+
+
+  xbool DPGCondensation :: IsSymmetric() const {
+
+    for (int i = 0; i < bfa->NumIntegrators(); i++)
+      if (!bfa->GetIntegrator(i)->IsSymmetric().IsTrue())
+	return false;
+    return true;
+  }
+
+
+  FlatArray<int> DPGCondensation ::
+  TrialDofs (const CompoundFiniteElement & sfel,
+	     const FiniteElement & fel, LocalHeap & lh) const {
+
+    const CompoundFiniteElement & xfel =
+      dynamic_cast<const CompoundFiniteElement&> (fel);
+    if (xfel.GetNComponents() != trialcomps.Size())
+      throw Exception ("DPGCondensation: trial space must consist of the "
+		       "components of the full space except the test one");
+
+    FlatArray<int> xdofs(xfel.GetNDof(), lh);
+    for (int j = 0; j < trialcomps.Size(); j++) {
+      IntRange rs = sfel.GetRange(trialcomps[j]);
+      IntRange rx = xfel.GetRange(j);
+      if (rs.Size() != rx.Size())
+	throw Exception ("DPGCondensation: trial component mismatch");
+      for (int d = 0; d < rx.Size(); d++)
+	xdofs[rx.First()+d] = rs.First()+d;
+    }
+    return xdofs;
+  }
+
+
+  template <class SCAL>
+  void DPGCondensation ::
+  CalcFullMatrix (const FiniteElement & sfel,
+		  const ElementTransformation & eltrans, VorB vb,
+		  FlatMatrix<SCAL> full, LocalHeap & lh) const {
+
+    full = SCAL(0.0);
+    FlatMatrix<SCAL> part(full.Height(), full.Width(), lh);
+
+    for (int i = 0; i < bfa->NumIntegrators(); i++) {
+      const BilinearFormIntegrator & bfi = *bfa->GetIntegrator(i);
+      if (bfi.VB() != vb || !bfi.DefinedOn(eltrans.GetElementIndex()))
+	continue;
+      bfi.CalcElementMatrix(sfel, eltrans, part, lh);
+      full += part;
+    }
+  }
+
+  template <class SCAL>
+  void DPGCondensation ::
+  CalcFullVector (const FiniteElement & sfel,
+		  const ElementTransformation & eltrans, VorB vb,
+		  FlatVector<SCAL> full, LocalHeap & lh) const {
+
+    full = SCAL(0.0);
+    if (!lff) return;
+    FlatVector<SCAL> part(full.Size(), lh);
+
+    for (int i = 0; i < lff->NumIntegrators(); i++) {
+      const LinearFormIntegrator & lfi = *lff->GetIntegrator(i);
+      if (lfi.VB() != vb || !lfi.DefinedOn(eltrans.GetElementIndex()))
+	continue;
+      lfi.CalcElementVector(sfel, eltrans, part, lh);
+      full += part;
+    }
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  L, B, Bt of an element, kept from the matrix assembly
+
+  template <class SCAL>
+  void DPGCondensation ::
+  SetFactors (FlatMatrix<SCAL> full, FlatArray<int> xd, IntRange ry,
+	      int elnr, FlatMatrix<SCAL> & l, FlatMatrix<SCAL> & b,
+	      FlatMatrix<SCAL> & bt, LocalHeap & lh) const {
+
+    int nx = xd.Size(), ny = ry.Size();
+    l.AssignMemory (ny, ny, lh);
+    b.AssignMemory (ny, nx, lh);
+    bt.AssignMemory (nx, ny, lh);
+    l = full.Rows(ry).Cols(ry);
+    for (int i = 0; i < ny; i++)
+      for (int j = 0; j < nx; j++) {
+	b(i,j)  = full(ry.First()+i, xd[j]);
+	bt(j,i) = full(xd[j], ry.First()+i);
+      }
+    if (!FactorCholesky (l))
+      throw Exception ("DPGCondensation: Gram matrix is not positive definite");
+
+    if (!cache) return;
+    auto ma = GetFullSpace()->GetMeshAccess();
+    auto & factors = Cache (SCAL(0.0));
+    {
+      std::lock_guard<std::mutex> guard(cachemutex);
+      if (cachestamp != ma->GetTimeStamp()) {
+	rfactors = Array<Array<double>>();
+	cfactors = Array<Array<Complex>>();
+	cachestamp = ma->GetTimeStamp();
+      }
+      if (factors.Size() != ma->GetNE(VOL))
+	factors.SetSize (ma->GetNE(VOL));
+    }
+    // each element is worked on by one thread at a time
+    Array<SCAL> & entry = factors[elnr];
+    entry.SetSize (size_t(ny)*ny + 2*size_t(nx)*ny);
+    FlatMatrix<SCAL> (ny, ny, &entry[0]) = l;
+    FlatMatrix<SCAL> (ny, nx, &entry[ny*ny]) = b;
+    FlatMatrix<SCAL> (nx, ny, &entry[ny*ny+ny*nx]) = bt;
+  }
+
+
+  template <class SCAL>
+  void DPGCondensation ::
+  Factors (const CompoundFiniteElement & sfel,
+	   const ElementTransformation & eltrans,
+	   FlatArray<int> xd, IntRange ry,
+	   FlatMatrix<SCAL> & l, FlatMatrix<SCAL> & b,
+	   FlatMatrix<SCAL> & bt, LocalHeap & lh) const {
+
+    int nx = xd.Size(), ny = ry.Size();
+    int elnr = eltrans.GetElementNr();
+
+    if (cache) {
+      SCAL * entry = nullptr;
+      {
+	std::lock_guard<std::mutex> guard(cachemutex);
+	auto & factors = Cache (SCAL(0.0));
+	if (cachestamp == GetFullSpace()->GetMeshAccess()->GetTimeStamp() &&
+	    elnr < factors.Size() &&
+	    factors[elnr].Size() == size_t(ny)*ny + 2*size_t(nx)*ny)
+	  entry = &factors[elnr][0];
+      }
+      if (entry) {
+	l.AssignMemory (ny, ny, entry);
+	b.AssignMemory (ny, nx, entry + ny*ny);
+	bt.AssignMemory (nx, ny, entry + ny*ny + ny*nx);
+	return;
+      }
+    }
+
+    FlatMatrix<SCAL> full(sfel.GetNDof(), sfel.GetNDof(), lh);
+    CalcFullMatrix(sfel, eltrans, VOL, full, lh);
+    SetFactors(full, xd, ry, elnr, l, b, bt, lh);
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  elmat = C - Bt G^{-1} B
+
+  template <class SCAL>
+  void DPGCondensation ::
+  CalcElementMatrix (const FiniteElement & fel,
+		     const ElementTransformation & eltrans, VorB vb,
+		     FlatMatrix<SCAL> elmat, LocalHeap & lh) const {
+
+    const CompoundFiniteElement & sfel =
+      dynamic_cast<const CompoundFiniteElement&>
+      (GetFullSpace()->GetFE(eltrans.GetElementId(), lh));
+
+    FlatArray<int> xd = TrialDofs(sfel, fel, lh);
+    IntRange ry = sfel.GetRange(testcomp);
+    int nx = xd.Size();
+    int ny = ry.Size();
+
+    FlatMatrix<SCAL> full(sfel.GetNDof(), sfel.GetNDof(), lh);
+    CalcFullMatrix(sfel, eltrans, vb, full, lh);
+
+    for (int i = 0; i < nx; i++)
+      for (int j = 0; j < nx; j++)
+	elmat(i,j) = full(xd[i],xd[j]);
+
+    if (ny == 0) return;
+    if (vb != VOL)
+      throw Exception ("DPGCondensation: test component has boundary dofs");
+
+    FlatMatrix<SCAL> l, b, bt;
+    SetFactors(full, xd, ry, eltrans.GetElementNr(), l, b, bt, lh);
+
+    FlatMatrix<SCAL> w(ny, nx, lh);
+    w = b;
+    SolveLower(l, w);
+    SolveLowerH(l, w);              // w = G^{-1} B
+    elmat -= bt * w;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  elvec = f_x - Bt G^{-1} f_y
+
+  template <class SCAL>
+  void DPGCondensation ::
+  CalcElementVector (const FiniteElement & fel,
+		     const ElementTransformation & eltrans, VorB vb,
+		     FlatVector<SCAL> elvec, LocalHeap & lh) const {
+
+    const CompoundFiniteElement & sfel =
+      dynamic_cast<const CompoundFiniteElement&>
+      (GetFullSpace()->GetFE(eltrans.GetElementId(), lh));
+
+    FlatArray<int> xd = TrialDofs(sfel, fel, lh);
+    IntRange ry = sfel.GetRange(testcomp);
+    int nx = xd.Size();
+    int ny = ry.Size();
+    int ns = sfel.GetNDof();
+
+    FlatVector<SCAL> fullvec(ns, lh);
+    CalcFullVector(sfel, eltrans, vb, fullvec, lh);
+
+    for (int i = 0; i < nx; i++)
+      elvec(i) = fullvec(xd[i]);
+
+    if (ny == 0) return;
+    if (vb != VOL)
+      throw Exception ("DPGCondensation: test component has boundary dofs");
+
+    FlatMatrix<SCAL> l, b, bt;
+    Factors(sfel, eltrans, xd, ry, l, b, bt, lh);
+
+    FlatVector<SCAL> z(ny, lh);
+    z = fullvec.Range(ry);
+    SolveLower(l, AsMatrix(z));
+    SolveLowerH(l, AsMatrix(z));    // z = G^{-1} f_y
+    elvec -= bt * z;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  With r = f_y - B x  and  G = L L^*, the Y-norm of the error
+  //  representation is  e^* G e = r^* G^{-1} r = |L^{-1} r|^2.
+
+  template <class SCAL>
+  void DPGCondensation ::
+  T_Estimate (shared_ptr<GridFunction> gfx,
+	      FlatVector<> est, LocalHeap & lh) const {
+
+    const BaseVector & xvec = gfx->GetVector();
+    est = 0.0;
+
+    IterateElements
+      (*gfx->GetFESpace(), VOL, lh,
+       [&] (FESpace::Element el, LocalHeap & lh) {
+
+	const ElementTransformation & eltrans = el.GetTrafo();
+	const CompoundFiniteElement & sfel =
+	  dynamic_cast<const CompoundFiniteElement&>
+	  (GetFullSpace()->GetFE(el, lh));
+
+	FlatArray<int> xd = TrialDofs(sfel, el.GetFE(), lh);
+	IntRange ry = sfel.GetRange(testcomp);
+	int nx = xd.Size();
+	int ny = ry.Size();
+	int ns = sfel.GetNDof();
+	if (ny == 0) return;
+
+	FlatVector<SCAL> x(nx, lh);
+	xvec.GetIndirect(el.GetDofs(), x);
+
+	FlatVector<SCAL> fullvec(ns, lh);
+	CalcFullVector(sfel, eltrans, VOL, fullvec, lh);
+	FlatMatrix<SCAL> l, b, bt;
+	Factors(sfel, eltrans, xd, ry, l, b, bt, lh);
+
+	FlatVector<SCAL> r(ny, lh);
+	r = fullvec.Range(ry) - b * x;
+	SolveLower(l, AsMatrix(r));
+
+	double eta2 = 0;
+	for (int i = 0; i < ny; i++) eta2 += sqr(abs(r(i)));
+	est(el.Nr()) = eta2;
+      });
+  }
+
+
+  Vector<> DPGCondensation ::
+  Estimate (shared_ptr<GridFunction> gfx, LocalHeap & lh) const {
+
+    Vector<> est(gfx->GetMeshAccess()->GetNE(VOL));
+    if (gfx->GetFESpace()->IsComplex())
+      T_Estimate<Complex> (gfx, est, lh);
+    else
+      T_Estimate<double> (gfx, est, lh);
+    return est;
+  }
+
+
+  template void DPGCondensation::CalcElementMatrix<double>
+  (const FiniteElement &, const ElementTransformation &, VorB,
+   FlatMatrix<double>, LocalHeap &) const;
+  template void DPGCondensation::CalcElementMatrix<Complex>
+  (const FiniteElement &, const ElementTransformation &, VorB,
+   FlatMatrix<Complex>, LocalHeap &) const;
+  template void DPGCondensation::CalcElementVector<double>
+  (const FiniteElement &, const ElementTransformation &, VorB,
+   FlatVector<double>, LocalHeap &) const;
+  template void DPGCondensation::CalcElementVector<Complex>
+  (const FiniteElement &, const ElementTransformation &, VorB,
+   FlatVector<Complex>, LocalHeap &) const;
+}
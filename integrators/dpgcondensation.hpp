@@ -0,0 +1,199 @@
+#ifndef DPG_CONDENSATION_HPP
+#define DPG_CONDENSATION_HPP
+
+
+/* Element-level elimination of the error representation.
+
+   A DPG form on a compound space  S = X[0] x ... x Y x ... x X[m]
+   with one test component Y (the error representation e) has element
+   matrices of the form
+
+          [  C     Bt ]   x
+          [  B     G  ]   e
+
+   where G is the Gram matrix of the test inner product, B the
+   element matrix of the DPG form b(x, y), and C collects whatever
+   couples trial components only (e.g. boundary terms). Instead of
+   putting e into the global system and removing it by static
+   condensation (which factors the whole indefinite element matrix),
+   DPGCondensation gives integrators on the trial space
+
+          Sx = X[0] x ... x X[m]     (same components, same order)
+
+   which compute per element, with a Cholesky factorization of G only,
+
+          C - Bt G^{-1} B      and      f_x - Bt G^{-1} f_y.
+
+   After solving for x on Sx, the element error estimator
+
+          e^* G e,     e = G^{-1} (f_y - B x),
+
+   is obtained with Estimate(..).
+
+   The factor of G and the blocks B and Bt of each element are kept
+   from CalcElementMatrix (matrix assembly) for CalcElementVector and
+   Estimate, which otherwise compute the full element matrix again
+   (cache = true, the default; the memory of about the blocks of the
+   full element matrices). They are dropped when the mesh changes, and
+   computed afresh if missing.
+
+   The element matrices are taken from the integrators of an (unassembled)
+   bilinear form "bfa" and linear form "lff" on S. Boundary integrators
+   of bfa and lff are passed on to Sx restricted to the trial
+   components (the test component must not have boundary dofs).
+ */
+
+
+#include <solve.hpp>
+#include <mutex>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class DPGCondensation {
+
+    shared_ptr<BilinearForm> bfa;  // the DPG form on the full space S
+    shared_ptr<LinearForm> lff;    // its right hand side (may be null)
+    int testcomp;                  // the component of e in S
+    Array<int> trialcomps;         // components of S making up Sx
+
+    // per element: L (G = L L^*), B, Bt, one after the other
+    bool cache;
+    mutable std::mutex cachemutex;
+    mutable size_t cachestamp = size_t(-1);
+    mutable Array<Array<double>> rfactors;
+    mutable Array<Array<Complex>> cfactors;
+
+  public:
+
+    DPGCondensation (shared_ptr<BilinearForm> abfa,
+		     shared_ptr<LinearForm> alff, int atestcomp,
+		     bool acache = true);
+
+    shared_ptr<FESpace> GetFullSpace() const { return bfa->GetFESpace(); }
+    xbool IsSymmetric() const;
+
+    // condensed element matrix / vector on the trial space element fel
+    template <class SCAL>
+    void CalcElementMatrix (const FiniteElement & fel,
+			    const ElementTransformation & eltrans, VorB vb,
+			    FlatMatrix<SCAL> elmat, LocalHeap & lh) const;
+
+    template <class SCAL>
+    void CalcElementVector (const FiniteElement & fel,
+			    const ElementTransformation & eltrans, VorB vb,
+			    FlatVector<SCAL> elvec, LocalHeap & lh) const;
+
+    // element-wise squared Y-norms of the error representation
+    // computed from the trial solution gfx on Sx
+    Vector<> Estimate (shared_ptr<GridFunction> gfx, LocalHeap & lh) const;
+
+  private:
+
+    // S element dofs of the trial components in the order of the Sx element
+    FlatArray<int> TrialDofs (const CompoundFiniteElement & sfel,
+			      const FiniteElement & fel, LocalHeap & lh) const;
+
+    template <class SCAL>
+    void CalcFullMatrix (const FiniteElement & sfel,
+			 const ElementTransformation & eltrans, VorB vb,
+			 FlatMatrix<SCAL> full, LocalHeap & lh) const;
+
+    template <class SCAL>
+    void CalcFullVector (const FiniteElement & sfel,
+			 const ElementTransformation & eltrans, VorB vb,
+			 FlatVector<SCAL> full, LocalHeap & lh) const;
+
+    // the factor L of G = L L^*, B and Bt of the element: from the
+    // cache, or computed from the full element matrix
+    template <class SCAL>
+    void Factors (const CompoundFiniteElement & sfel,
+		  const ElementTransformation & eltrans,
+		  FlatArray<int> xd, IntRange ry,
+		  FlatMatrix<SCAL> & l, FlatMatrix<SCAL> & b,
+		  FlatMatrix<SCAL> & bt, LocalHeap & lh) const;
+
+    // ... from the full element matrix (on lh), and cached
+    template <class SCAL>
+    void SetFactors (FlatMatrix<SCAL> full, FlatArray<int> xd, IntRange ry,
+		     int elnr, FlatMatrix<SCAL> & l, FlatMatrix<SCAL> & b,
+		     FlatMatrix<SCAL> & bt, LocalHeap & lh) const;
+
+    Array<Array<double>> & Cache (double) const { return rfactors; }
+    Array<Array<Complex>> & Cache (Complex) const { return cfactors; }
+
+    template <class SCAL>
+    void T_Estimate (shared_ptr<GridFunction> gfx,
+		     FlatVector<> est, LocalHeap & lh) const;
+  };
+
+
+
+  /////////////////////////////////////////////////////////////////
+  // The integrators on the trial space Sx
+
+  class DPGCondensedIntegrator : public BilinearFormIntegrator {
+
+    shared_ptr<DPGCondensation> cond;
+    VorB vb;
+
+  public:
+
+    DPGCondensedIntegrator (shared_ptr<DPGCondensation> acond, VorB avb)
+      : cond(acond), vb(avb) { ; }
+
+    virtual xbool IsSymmetric() const { return cond->IsSymmetric(); }
+
+    virtual string Name () const { return "DPGCondensed"; }
+
+    virtual bool BoundaryForm () const { return vb == BND; }
+    virtual VorB VB() const { return vb; }
+
+    void CalcElementMatrix (const FiniteElement & fel,
+			    const ElementTransformation & eltrans,
+			    FlatMatrix<double> elmat,
+			    LocalHeap & lh) const {
+      cond->CalcElementMatrix<double>(fel,eltrans,vb,elmat,lh);
+    }
+    void CalcElementMatrix (const FiniteElement & fel,
+			    const ElementTransformation & eltrans,
+			    FlatMatrix<Complex> elmat,
+			    LocalHeap & lh) const {
+      cond->CalcElementMatrix<Complex>(fel,eltrans,vb,elmat,lh);
+    }
+  };
+
+
+  class DPGCondensedSource : public LinearFormIntegrator {
+
+    shared_ptr<DPGCondensation> cond;
+    VorB vb;
+
+  public:
+
+    DPGCondensedSource (shared_ptr<DPGCondensation> acond, VorB avb)
+      : cond(acond), vb(avb) { ; }
+
+    virtual string Name () const { return "DPGCondensedSource"; }
+
+    virtual bool BoundaryForm () const { return vb == BND; }
+    virtual VorB VB() const { return vb; }
+
+    void CalcElementVector (const FiniteElement & fel,
+			    const ElementTransformation & eltrans,
+			    FlatVector<double> elvec,
+			    LocalHeap & lh) const {
+      cond->CalcElementVector<double>(fel,eltrans,vb,elvec,lh);
+    }
+    void CalcElementVector (const FiniteElement & fel,
+			    const ElementTransformation & eltrans,
+			    FlatVector<Complex> elvec,
+			    LocalHeap & lh) const {
+      cond->CalcElementVector<Complex>(fel,eltrans,vb,elvec,lh);
+    }
+  };
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include <fem.hpp>
 #include "dpgintegrators.hpp"
+#include "facetshapecache.hpp"
+#include "boundaryfacets.hpp"
+#include "sumfactorization.hpp"
 
 // See end of file for all integrators provided
 
@@ -18,12 +21,12 @@ namespace dpg {
 			    LocalHeap & lh) const {
     
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const ScalarFiniteElement<D> & fel_u =  // u space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -33,32 +36,50 @@ namespace dpg {
     int ndofe = re.Size();
     int ndofu = ru.Size();
 
-    FlatMatrixFixWidth<D> dum(ndofu,lh); // to store grad(u-basis)  
-    FlatMatrixFixWidth<D> dem(ndofe,lh); // to store grad(e-basis)
+    // quadrilaterals and hexahedra: sum factorization
+    FlatMatrix<SCAL> tensormat(ndofe,ndofu,lh);
+    if (TensorGradGrad<D,SCAL> (fel_u, fel_e, eltrans, coeff_a,
+				fel_u.Order()+fel_e.Order()-2, tensormat, lh)) {
+      elmat.Rows(re).Cols(ru) += tensormat;
+      if (GetInd1() != GetInd2())
+	elmat.Rows(ru).Cols(re) += Conj(Trans(tensormat));
+      return;
+    }
 
     ELEMENT_TYPE eltype                  // get the type of element: 
       = fel_u.ElementType();             // ET_TRIG in 2d, ET_TET in 3d.
 
     const IntegrationRule &              // Note: p = fel_u.Order()-1
       ir = SelectIntegrationRule(eltype, fel_u.Order()+fel_e.Order()-2);
+    int nip = ir.GetNIP();
+
+    // map all integration points at once
+    MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
+
+    // grad(u-basis) and grad(e-basis) at all mapped points,
+    // point k occupying columns [D*k, D*k+D)
+    FlatMatrix<double> bdum(ndofu,D*nip,lh);
+    FlatMatrix<double> bdem(ndofe,D*nip,lh);
+    FlatVector<double> weights(nip,lh);
     
     FlatMatrix<SCAL> submat(ndofe,ndofu,lh);
-    submat = 0.0;
 
-    for(int k=0; k<ir.GetNIP(); k++) {	
-      
-      MappedIntegrationPoint<D,D> mip (ir[k],eltrans);
-      // set grad(u-basis) and grad(e-basis) at mapped pts in dum and dem.
-      fel_u.CalcMappedDShape( mip, dum ); 
-      fel_e.CalcMappedDShape( mip, dem );
-
-      // evaluate coefficient
-      SCAL fac = coeff_a -> T_Evaluate<SCAL>(mip);
-      fac *= mip.GetWeight() ;
+    // point loop compiled for the actual classes of fel_u, fel_e
+    SwitchFE<D>::Scalar (fel_u, [&] (const auto & felu) {
+      SwitchFE<D>::Scalar (fel_e, [&] (const auto & fele) {
+
+	for(int k=0; k<nip; k++) {	
       
-      //             [ndofe x D] * [D x ndofu]
-      submat +=  fac *  dem     * Trans(dum) ;
-    }
+	  IntRange cols(D*k, D*k+D);
+	  fe::CalcMappedDShape( felu, mir[k], bdum.Cols(cols) ); 
+	  fe::CalcMappedDShape( fele, mir[k], bdem.Cols(cols) );
+	  weights(k) = mir[k].GetWeight();
+	}
+      });
+    });
+
+    //      [ndofe x D*nip] * a(x) * [D*nip x ndofu]
+    CalcADBt(coeff_a, mir, weights, D, bdem, bdum, submat, lh);
     
     elmat.Rows(re).Cols(ru) += submat;
     if (GetInd1() != GetInd2())
@@ -79,12 +100,12 @@ namespace dpg {
 			    LocalHeap & lh) const {
     
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const HDivFiniteElement<D>   & fel_q =  // q space
-      dynamic_cast<const HDivFiniteElement<D>&  > (cfel[GetInd1()]);
+      FECast<HDivFiniteElement<D>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -93,56 +114,46 @@ namespace dpg {
     int ndofq = rq.Size();
     int ndofe = re.Size();
 
+    // quadrilaterals and hexahedra: sum factorization
+    FlatMatrix<SCAL> tensormat(ndofe,ndofq,lh);
+    if (TensorFluxTrace<D,SCAL> (fel_q, fel_e, eltrans, coeff_d,
+				 fel_q.Order()+fel_e.Order(), tensormat, lh)) {
+      elmat.Rows(re).Cols(rq) += tensormat;
+      elmat.Rows(rq).Cols(re) += Conj(Trans(tensormat));
+      return;
+    }
+
     FlatMatrix<SCAL> submat(ndofe,ndofq,lh);
-    FlatMatrixFixWidth<D> shapeq(ndofq,lh);  // q-basis (vec) values
-    FlatVector<>          shapee(ndofe,lh);  // e-basis basis 
     
     ELEMENT_TYPE eltype                      // get the type of element: 
       = fel_q.ElementType();                 // ET_TRIG in 2d, ET_TET in 3d.
 
-    // transform facet integration points to volume integration points
-    Facet2ElementTrafo transform(eltype);
-
-    int nfa = ElementTopology::GetNFacets(eltype); /* nfa = number of facets
-						      of an element */    
-    submat = 0.0;
-
-    for(int k = 0; k<nfa; k++) {
-      
-      // type of geometry of k-th facet
-      ELEMENT_TYPE eltype_facet = ElementTopology::GetFacetType(eltype, k); 
-      
-      const IntegrationRule & facet_ir =
-	SelectIntegrationRule (eltype_facet, fel_q.Order()+fel_e.Order()); 
-
-      // reference element normal vector
-      FlatVec<D> normal_ref = ElementTopology::GetNormals(eltype) [k]; 
+    // facet points of all facets and the tabulated reference values
+    // of q.n_ref and e at them (see facetshapecache.hpp)
+    FacetShapeCache<D> & cache = FacetShapeCache<D>::Instance();
+    int order = fel_q.Order()+fel_e.Order();
+    const FacetRule & fr = cache.GetRule(eltype, order);
+    unsigned orient = VertexOrientation(eltrans);
+    FlatMatrix<> shapeqn = 
+      cache.GetShapes(fel_q, FACET_HDIV_NORMAL, fr, order, orient, lh);
+    FlatMatrix<> shapee  = 
+      cache.GetShapes(fel_e, FACET_SCALAR, fr, order, orient, lh);
+
+    int npts = fr.ir.GetNIP();
+    MappedIntegrationRule<D,D> mir(fr.ir, eltrans, lh);
+    FlatVector<double> weights(npts,lh);
+
+    for (int i = 0; i < npts; i++) {
+
+      // With the Piola map, (mapped q).n * ds = sign(det) * q.n_ref *
+      // (reference facet weight), so no normal needs to be computed.
+      weights(i) = fr.ir[i].Weight();
+      if (mir[i].GetJacobiDet() < 0) weights(i) = -weights(i);
+    }
 
-      for (int l = 0; l < facet_ir.GetNIP(); l++) {
+    //     [ndofe x npts] * d(x) * [npts x ndofq]
+    CalcADBt(coeff_d, mir, weights, 1, shapee, shapeqn, submat, lh);
 
-	// map 1D facet points to volume integration points
-	IntegrationPoint volume_ip = transform(k, facet_ir[l]);
-	MappedIntegrationPoint<D,D> mip (volume_ip, eltrans);
-	
-	// compute normal on physcial element
-	Mat<D> inv_jac = mip.GetJacobianInverse();
-	double det = mip.GetJacobiDet();
-	Vec<D> normal = fabs(det) * Trans(inv_jac) * normal_ref;       
-	double len = L2Norm(normal);
-	normal /= len;
-	double weight = facet_ir[l].Weight()*len;
-	
-	// mapped H(div) basis fn values and DG fn (no need to map) values
-	fel_q.CalcMappedShape(mip,shapeq); 
-	fel_e.CalcShape(volume_ip,shapee); 
-	
-	// evaluate coefficient
-	SCAL dd = coeff_d -> T_Evaluate<SCAL>(mip);
-
-	//                   [ndofe x 1]      [ndofq x D] *  [D x 1] 	
-	submat += (dd*weight) * shapee * Trans( shapeq    *  normal ) ;
-      }
-    }
     elmat.Rows(re).Cols(rq) += submat;
     elmat.Rows(rq).Cols(re) += Conj(Trans(submat));
   }
@@ -159,11 +170,11 @@ namespace dpg {
    
 
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
     const ScalarFiniteElement<D> & fel_u =  // u space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -172,26 +183,35 @@ namespace dpg {
     int ndofe = re.Size();
     int ndofu = ru.Size();
 
-    Vector<> ushape(ndofu);
-    Vector<> eshape(ndofe);
+    // quadrilaterals and hexahedra: sum factorization
+    FlatMatrix<SCAL> tensormat(ndofe,ndofu,lh);
+    if (TensorEyeEye<D,SCAL> (fel_u, fel_e, eltrans, coeff_a,
+			      fel_u.Order()+fel_e.Order(), tensormat, lh)) {
+      elmat.Rows(re).Cols(ru) += tensormat;
+      if (GetInd1() != GetInd2())
+	elmat.Rows(ru).Cols(re) += Conj(Trans(tensormat));
+      return;
+    }
 
     ELEMENT_TYPE eltype = fel_u.ElementType();      
     const IntegrationRule &         
       ir = SelectIntegrationRule(eltype, fel_u.Order()+fel_e.Order());
-    FlatMatrix<SCAL> submat(ndofe,ndofu,lh);
-    submat = SCAL(0.0);
+    int nip = ir.GetNIP();
+    MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
 
-    for(int k=0; k<ir.GetNIP(); k++) {	
-      
-      MappedIntegrationPoint<D,D> mip (ir[k],eltrans);
+    // basis values at all points:  column k = values at point k
+    FlatMatrix<double> ushape(ndofu,nip,lh);
+    FlatMatrix<double> eshape(ndofe,nip,lh);
+    FlatVector<double> weights(nip,lh);
+    fel_u.CalcShape( ir, ushape ); 
+    fel_e.CalcShape( ir, eshape );
 
-      fel_u.CalcShape( ir[k], ushape ); 
-      fel_e.CalcShape( ir[k], eshape );
+    for(int k=0; k<nip; k++)
+      weights(k) = mir[k].GetWeight();
 
-      SCAL fac = (coeff_a -> T_Evaluate<SCAL>(mip))* mip.GetWeight() ;
-      //               [ndofe x D] * [D x ndofu]
-      submat +=  fac *  eshape     * Trans(ushape) ;
-    }
+    FlatMatrix<SCAL> submat(ndofe,ndofu,lh);
+    //      [ndofe x nip] * a(x) * [nip x ndofu]
+    CalcADBt(coeff_a, mir, weights, 1, eshape, ushape, submat, lh);
     
     elmat.Rows(re).Cols(ru) += submat;
     if (GetInd1() != GetInd2())
@@ -210,12 +230,12 @@ namespace dpg {
 			    LocalHeap & lh) const {
     
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const ScalarFiniteElement<D> & fel_u =  // u space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -223,49 +243,47 @@ namespace dpg {
     IntRange re = cfel.GetRange(GetInd2()); 
     int ndofe = re.Size();
     int ndofu = ru.Size();
-    FlatVector<>      shapee(ndofe,lh);  
-    FlatVector<>      shapeu(ndofu,lh);  
-    FlatMatrix<SCAL>  submat(ndofe,ndofu, lh);  
-    submat = SCAL(0.0);
 
-    ELEMENT_TYPE eltype = fel_u.ElementType();         
-    Facet2ElementTrafo transform(eltype);
-    int nfa = ElementTopology :: GetNFacets(eltype); 
+    // quadrilaterals and hexahedra: sum factorization
+    FlatMatrix<SCAL> tensormat(ndofe,ndofu,lh);
+    if (TensorTraceTrace<D,SCAL> (fel_u, fel_e, eltrans, coeff_c,
+				  fel_u.Order()+fel_e.Order(), tensormat, lh)) {
+      elmat.Rows(re).Cols(ru) += tensormat;
+      if (GetInd1() != GetInd2())
+	elmat.Rows(ru).Cols(re) += Conj(Trans(tensormat));
+      return;
+    }
 
-    for(int k = 0; k<nfa; k++) {
-      
-      // type of geometry of k-th facet
-      ELEMENT_TYPE eltype_facet = ElementTopology::GetFacetType(eltype, k); 
-      
-      const IntegrationRule & facet_ir =
-	SelectIntegrationRule (eltype_facet, fel_u.Order()+fel_e.Order()); 
+    FlatMatrix<SCAL>  submat(ndofe,ndofu, lh);  
 
-      // reference element normal vector
-      FlatVec<D> normal_ref = ElementTopology::GetNormals(eltype) [k]; 
+    ELEMENT_TYPE eltype = fel_u.ElementType();         
 
-      for (int l = 0; l < facet_ir.GetNIP(); l++) {
+    // tabulated reference values at the facet points of all facets
+    FacetShapeCache<D> & cache = FacetShapeCache<D>::Instance();
+    int order = fel_u.Order()+fel_e.Order();
+    const FacetRule & fr = cache.GetRule(eltype, order);
+    unsigned orient = VertexOrientation(eltrans);
+    FlatMatrix<> shapeu = 
+      cache.GetShapes(fel_u, FACET_SCALAR, fr, order, orient, lh);
+    FlatMatrix<> shapee = 
+      cache.GetShapes(fel_e, FACET_SCALAR, fr, order, orient, lh);
 
-	// map 1D facet points to volume integration points
-	IntegrationPoint volume_ip = transform(k, facet_ir[l]);
-	MappedIntegrationPoint<D,D> mip (volume_ip, eltrans);
-	
-	// compute normal on physcial element
-	Mat<D> inv_jac = mip.GetJacobianInverse();
-	double det = mip.GetJacobiDet();
-	Vec<D> normal = fabs(det) * Trans(inv_jac) * normal_ref;       
-	double len = L2Norm(normal);
-	normal /= len;
-	double weight = facet_ir[l].Weight()*len;
-	
-	fel_e.CalcShape(volume_ip,shapee); 
-	fel_u.CalcShape(volume_ip,shapeu); 
+    FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
+    int npts = fr.ir.GetNIP();
+    MappedIntegrationRule<D,D> mir(fr.ir, eltrans, lh);
+    FlatVector<double> weights(npts,lh);
 
-	SCAL cc = coeff_c  -> T_Evaluate<SCAL>(mip);
+    for (int i = 0; i < npts; i++) {
 
-	//                     [ndofe x 1]  [1 x ndofu] 
-	submat +=  (cc*weight) * shapee * Trans(shapeu);
-      }
+      // surface measure of the physical facet
+      Mat<D> inv_jac = mir[i].GetJacobianInverse();
+      double det = mir[i].GetMeasure();
+      Vec<D> normal = det * Trans(inv_jac) * normals[fr.facetnr[i]];
+      weights(i) = fr.ir[i].Weight()*L2Norm(normal);
     }
+
+    //     [ndofe x npts] * c(x) * [npts x ndofu]
+    CalcADBt(coeff_c, mir, weights, 1, shapee, shapeu, submat, lh);
     
     elmat.Rows(re).Cols(ru) += submat;
     if (GetInd1() != GetInd2())
@@ -285,14 +303,14 @@ namespace dpg {
 		       LocalHeap & lh) const {
 
     const CompoundFiniteElement &  cfel      // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
     
     // This FE is already multiplied by normal:
     const HDivNormalFiniteElement<D-1> & fel_q = // q.n space
-      dynamic_cast<const HDivNormalFiniteElement<D-1>&> (cfel[GetInd1()]);
+      FECast<HDivNormalFiniteElement<D-1>> (cfel[GetInd1()]);
 
     const HDivNormalFiniteElement<D-1> & fel_r = // r.n space
-      dynamic_cast<const HDivNormalFiniteElement<D-1>&> (cfel[GetInd2()]);
+      FECast<HDivNormalFiniteElement<D-1>> (cfel[GetInd2()]);
     
     elmat = SCAL(0.0);
 
@@ -314,7 +332,7 @@ namespace dpg {
 
       MappedIntegrationPoint<D-1,D> mip(ir[i], eltrans);
 
-      SCAL cc = coeff_c -> T_Evaluate<SCAL>(mip);
+      SCAL cc = coeff_c.T_Evaluate<SCAL>(mip);
 
       fel_r.CalcShape (ir[i], rshape);
       fel_q.CalcShape (ir[i], qshape);
@@ -355,13 +373,13 @@ namespace dpg {
 		       LocalHeap & lh) const {
 
     const CompoundFiniteElement &  cfel      // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     // get surface elements
     const ScalarFiniteElement<D-1> & fel_u = // u space
-      dynamic_cast<const ScalarFiniteElement<D-1>&> (cfel[GetInd1()]);
+      FECast<ScalarFiniteElement<D-1>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D-1> & fel_e = // u space
-      dynamic_cast<const ScalarFiniteElement<D-1>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D-1>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -383,7 +401,7 @@ namespace dpg {
 
       MappedIntegrationPoint<D-1,D> mip(ir[i], eltrans);
 
-      SCAL cc = coeff_c -> T_Evaluate<SCAL>(mip);
+      SCAL cc = coeff_c.T_Evaluate<SCAL>(mip);
 
       fel_u.CalcShape (ir[i], ushape);
       fel_e.CalcShape (ir[i], eshape);
@@ -420,74 +438,77 @@ namespace dpg {
                        FlatMatrix<SCAL> elmat,
                        LocalHeap & lh) const {
     
+    elmat = SCAL(0);
+
+    // facets on the global boundary; none for most elements
+    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
+    unsigned bfacets =
+      BoundaryFacets::Instance().Get(ma, eltrans.GetElementId());
+    if (!bfacets) return;
+
     ELEMENT_TYPE eltype                
       = base_fel.ElementType();        
     const CompoundFiniteElement &  cfel     // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     // note how we do NOT refer to D-1 elements here:
     const ScalarFiniteElement<D> & fel_u =  // u space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd1()]);
     const ScalarFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D>> (cfel[GetInd2()]);
     
-    elmat = SCAL(0);
     IntRange ru = cfel.GetRange(GetInd1());
     IntRange re = cfel.GetRange(GetInd2());
     int ndofe = re.Size();
     int ndofu = ru.Size();
             
-    FlatVector<> ushape(fel_u.GetNDof(), lh);
-    FlatVector<> eshape(fel_e.GetNDof(), lh);
     FlatMatrix<SCAL> submat(ndofe,ndofu,lh);
     submat = SCAL(0);
 
     int nfacet = ElementTopology::GetNFacets(eltype);
-    Facet2ElementTrafo transform(eltype); 
     FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);    
-    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
 
-    Array<int> fnums, sels;
-    fnums = ma.GetElFacets (eltrans.GetElementId());
+    FacetShapeCache<D> & cache = FacetShapeCache<D>::Instance();
+    int order = fel_e.Order()+fel_u.Order();
+    const FacetRule & fr = cache.GetRule(eltype, order);
+
+    // collect the facet points on the global boundary
+    FlatArray<int> bpts(fr.ir.GetNIP(), lh);
+    int nbpts = 0;
+    for (int k = 0; k < nfacet; k++)
+      if (bfacets & (1u << k))
+	for (int i : fr.FacetPoints(k)) bpts[nbpts++] = i;
+
+    unsigned orient = VertexOrientation(eltrans);
+    FlatMatrix<> ushape = 
+      cache.GetShapes(fel_u, FACET_SCALAR, fr, order, orient, lh);
+    FlatMatrix<> eshape = 
+      cache.GetShapes(fel_e, FACET_SCALAR, fr, order, orient, lh);
+
+    FlatMatrix<>     bushape(ndofu,nbpts,lh);
+    FlatMatrix<SCAL> beshape(ndofe,nbpts,lh);
       
-    for (int k = 0; k < nfacet; k++)    {
-
-      ma.GetFacetSurfaceElements (fnums[k], sels);
+    for (int j = 0 ; j < nbpts; j++) {
 
-      // if interior element, then do nothing:
-      if (sels.Size() == 0) continue; 
-
-      // else: 
-
-      Vec<D> normal_ref = normals[k];
+      int i = bpts[j];
+      MappedIntegrationPoint<D,D> mip(fr.ir[i], eltrans);
+	
+      SCAL val = coeff_c.T_Evaluate<SCAL> (mip);
 
-      ELEMENT_TYPE etfacet=ElementTopology::GetFacetType(eltype, k);
+      // this is contrived to get the surface measure in "len"
+      Mat<D> inv_jac = mip.GetJacobianInverse();
+      double det = mip.GetMeasure();
+      Vec<D> normal = det * Trans (inv_jac) * normals[fr.facetnr[i]];
+      double len = L2Norm (normal);    
 
-      IntegrationRule ir_facet(etfacet, fel_e.Order()+fel_u.Order());
-      
-      // map the facet integration points to volume reference elt ipts
-      IntegrationRule & ir_facet_vol = transform(k, ir_facet, lh);
-      // ... and further to the physical element 
-      MappedIntegrationRule<D,D> mir(ir_facet_vol, eltrans, lh);
-        
-      for (int i = 0 ; i < ir_facet_vol.GetNIP(); i++) {
+      val *= len * fr.ir[i].Weight();
 	
-	SCAL val = coeff_c->T_Evaluate<SCAL> (mir[i]);
+      bushape.Col(j) = ushape.Col(i);
+      beshape.Col(j) = val * eshape.Col(i);
+    }    
 
-	// this is contrived to get the surface measure in "len"
-	Mat<D> inv_jac = mir[i].GetJacobianInverse();
-	double det = mir[i].GetMeasure();
-	Vec<D> normal = det * Trans (inv_jac) * normal_ref;       
-	double len = L2Norm (normal);    
+    CalcABt(beshape, bushape, submat);
 
-	val *= len * ir_facet[i].Weight();
-	
-	fel_u.CalcShape (ir_facet_vol[i], ushape);
-	fel_e.CalcShape (ir_facet_vol[i], eshape);
-        
-	submat += val * eshape * Trans(ushape);
-      }    
-    }
     elmat.Rows(re).Cols(ru) += submat;
     if (GetInd1() != GetInd2())
       elmat.Rows(ru).Cols(re) += Conj(Trans(submat));
@@ -518,36 +539,35 @@ namespace dpg {
 		       FlatVector<SCAL> elvec,
 		       LocalHeap & lh) const {
 
+    elvec = SCAL(0);    
+
+    // facets on the global boundary; none for most elements
+    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
+    unsigned bfacets =
+      BoundaryFacets::Instance().Get(ma, eltrans.GetElementId());
+    if (!bfacets) return;
+
     const CompoundFiniteElement &  cfel  
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const ScalarFiniteElement<D> & fel = 
-      dynamic_cast<const ScalarFiniteElement<D>&> (cfel[indx]);
+      FECast<ScalarFiniteElement<D>> (cfel[indx]);
 
     FlatVector<> ushape(fel.GetNDof(), lh);
-    elvec = SCAL(0);    
     IntRange re = cfel.GetRange(indx);
     int ndofe = re.Size();
     FlatVector<SCAL> subvec(ndofe,lh);
     subvec = SCAL(0);
 
-    const IntegrationRule ir(fel.ElementType(), 2*fel.Order());
     ELEMENT_TYPE eltype = base_fel.ElementType();        
     int nfacet = ElementTopology::GetNFacets(eltype);
     Facet2ElementTrafo transform(eltype); 
     FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
 
-    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
-
-    Array<int> fnums, sels;
-    fnums = ma.GetElFacets (eltrans.GetElementId());
-
     for (int k = 0; k < nfacet; k++)    {
 
-      ma.GetFacetSurfaceElements (fnums[k], sels);
-
-      // if interior element, then do nothing:
-      if (sels.Size() == 0) continue; 
+      // if interior facet, then do nothing:
+      if (!(bfacets & (1u << k))) continue; 
 
       // else: 
 
@@ -562,15 +582,20 @@ namespace dpg {
       // ... and further to the physical element 
       MappedIntegrationRule<D,D> mir(ir_facet_vol, eltrans, lh);
 
-      for (int i = 0 ; i < ir_facet_vol.GetNIP(); i++) {
+      // coefficient values at all facet points
+      int nip = ir_facet_vol.GetNIP();
+      FlatMatrix<SCAL> Gvals(D,nip,lh);
+      FlatVector<SCAL> gvals(nip,lh);
+      coeff_Gx.Evaluate(mir, Gvals.Row(0));
+      coeff_Gy.Evaluate(mir, Gvals.Row(1));
+      if (D==3)  coeff_Gz.Evaluate(mir, Gvals.Row(D-1));
+      coeff_g.Evaluate(mir, gvals);
+
+      for (int i = 0 ; i < nip; i++) {
 	
-       	SCAL G[3] ;
-	G[0] = coeff_Gx -> T_Evaluate<SCAL>(mir[i]);
-	G[1] = coeff_Gy -> T_Evaluate<SCAL>(mir[i]);
-	if (D==3)  G[2] = coeff_Gz -> T_Evaluate<SCAL>(mir[i]);
-	FlatVector<SCAL> Gval(D,lh);	
-	for (int dd=0; dd<D; dd++)  Gval[dd] = G[dd];
-	SCAL g = coeff_g -> T_Evaluate<SCAL>(mir[i]);
+	Vec<D,SCAL> Gval;
+	for (int dd=0; dd<D; dd++)  Gval(dd) = Gvals(dd,i);
+	SCAL g = gvals(i);
 
 	// this is contrived to get the surface measure in "len"
 	Mat<D> inv_jac = mir[i].GetJacobianInverse();
@@ -602,14 +627,14 @@ namespace dpg {
 		       LocalHeap & lh) const {
 
     const CompoundFiniteElement &  cfel      // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     // This FE is already multiplied by normal:
     const HDivNormalFiniteElement<D-1> & fel_q = // q.n space
-      dynamic_cast<const HDivNormalFiniteElement<D-1>&> (cfel[GetInd1()]);
+      FECast<HDivNormalFiniteElement<D-1>> (cfel[GetInd1()]);
 
     const ScalarFiniteElement<D-1> & fel_w =     // w space
-      dynamic_cast<const ScalarFiniteElement<D-1>&> (cfel[GetInd2()]);
+      FECast<ScalarFiniteElement<D-1>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -631,7 +656,7 @@ namespace dpg {
 
       MappedIntegrationPoint<D-1,D> mip(ir[i], eltrans);
 
-      SCAL cc = coeff_c -> T_Evaluate<SCAL>(mip);
+      SCAL cc = coeff_c.T_Evaluate<SCAL>(mip);
 
       fel_q.CalcShape (ir[i], qshape);
       // mapped q.n-shape is simply reference q.n-shape / measure
@@ -24,23 +24,30 @@
 
 
 #include <solve.hpp>
+#include "fedispatch.hpp"
+#include "dpgcoefficient.hpp"
 
 using namespace ngsolve;
 
 namespace dpg {
 
-  class DPGintegrator : public BilinearFormIntegrator  {
+  class DPGintegrator : public BilinearFormIntegrator,
+			public ElementCoefficients  {
 
     shared_ptr<CoefficientFunction> comp1;
     shared_ptr<CoefficientFunction> comp2;
     int ind1;
     int ind2;
+    Array<shared_ptr<DPGCoefficient>> coefs;   // the rest of coeffs
 
   public:
     
     DPGintegrator(const Array<shared_ptr<CoefficientFunction>> & coeffs) 
       : comp1(coeffs[0]), comp2(coeffs[1]) {
 
+      for (int k = 2; k < coeffs.Size(); k++)
+	coefs.Append (make_shared<DPGCoefficient> (coeffs[k]));
+
       if ( comp1->IsComplex() ) {
 	  BaseMappedIntegrationPoint ip;
 	  ind1 = int( comp1 -> EvaluateComplex(ip).real() ) - 1 ;
@@ -57,15 +64,85 @@ namespace dpg {
     int GetInd1() const {return ind1;} 
     int GetInd2() const {return ind2;} 
 
+    virtual bool GetElementCoefficients (const ElementTransformation & eltrans,
+					 Array<Complex> & vals,
+					 LocalHeap & lh) const {
+      HeapReset hr(lh);
+      const BaseMappedIntegrationPoint & mip = ElementCenter(eltrans, lh);
+      for (auto & c : coefs)
+	if (!AppendValue(*c, mip, vals)) return false;
+      return true;
+    }
+
+    virtual void GetCoefficientFunctions
+    (Array<shared_ptr<CoefficientFunction>> & cfs) const {
+      for (auto & c : coefs) cfs.Append (c->Get());
+    }
   };
 
 
+  /////////////////////////////////////////////////////////////////
+  // Element matrices of the volume integrators are formed batched:
+  // the (scaled) test-side shapes at all integration points are put
+  // side by side in a [ndof x nip*dim] matrix, and the trial-side
+  // shapes likewise, so that the sum of the rank-dim updates over
+  // all points becomes one matrix-matrix product c = a * Trans(b).
+
+  inline void CalcABt (FlatMatrix<double> a, FlatMatrix<double> b,
+		       FlatMatrix<double> c) {
+    c = a * Trans(b) | Lapack;
+  }
+
+  template <class SCAL>
+  inline void CalcABt (FlatMatrix<SCAL> a, FlatMatrix<double> b,
+		       FlatMatrix<SCAL> c) {
+    c = a * Trans(b);
+  }
+
+  // c = a * diag(coef*w) * Trans(b), where point k of mir has weight
+  // w(k) and occupies the columns [dim*k, dim*k+dim) of a and b.
+  // Coefficients constant on the element are not evaluated per point:
+  // the real, coefficient-free product is formed and scaled once.
+
+  template <class SCAL>
+  void CalcADBt (const DPGCoefficient & coef,
+		 const BaseMappedIntegrationRule & mir,
+		 FlatVector<double> w, int dim,
+		 FlatMatrix<double> a, FlatMatrix<double> b,
+		 FlatMatrix<SCAL> c, LocalHeap & lh) {
+
+    HeapReset hr(lh);
+    int npts = w.Size();
+
+    if (coef.ElementConstant()) {
+      FlatMatrix<double> wa(a.Height(), a.Width(), lh);
+      for (int k = 0; k < npts; k++) {
+	IntRange cols(dim*k, dim*k+dim);
+	wa.Cols(cols) = w(k) * a.Cols(cols);
+      }
+      FlatMatrix<double> cr(c.Height(), c.Width(), lh);
+      CalcABt(wa, b, cr);
+      c = coef.ElementValue<SCAL>(mir) * cr;
+      return;
+    }
+
+    FlatVector<SCAL> cval(npts, lh);
+    coef.Evaluate(mir, cval);
+    FlatMatrix<SCAL> wa(a.Height(), a.Width(), lh);
+    for (int k = 0; k < npts; k++) {
+      IntRange cols(dim*k, dim*k+dim);
+      wa.Cols(cols) = (cval(k) * w(k)) * a.Cols(cols);
+    }
+    CalcABt(wa, b, c);
+  }
+
+
   /////////////////////////////////////////////////////////////////
   // Integrate a(x)*grad u . grad v, where u and v are in different spaces
 
   template<int D> class GradGrad : public DPGintegrator {
     
-    shared_ptr<CoefficientFunction> coeff_a;
+    DPGCoefficient coeff_a;
 
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -114,7 +191,7 @@ namespace dpg {
 
   template<int D> class FluxTrace : public DPGintegrator {
     
-    shared_ptr<CoefficientFunction>  coeff_d;
+    DPGCoefficient coeff_d;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -159,7 +236,7 @@ namespace dpg {
 
   template<int D> class EyeEye : public DPGintegrator  {
     
-    shared_ptr<CoefficientFunction> coeff_a;
+    DPGCoefficient coeff_a;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -205,7 +282,7 @@ namespace dpg {
 
   template<int D> class TraceTrace : public DPGintegrator  {
     
-    shared_ptr<CoefficientFunction> coeff_c;
+    DPGCoefficient coeff_c;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -250,7 +327,7 @@ namespace dpg {
   template<int D> 
   class FluxFluxBoundary : public DPGintegrator   {
     
-    shared_ptr<CoefficientFunction> coeff_c;
+    DPGCoefficient coeff_c;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -302,7 +379,7 @@ namespace dpg {
   template<int D> 
   class TraceTraceBoundary : public DPGintegrator   {
     
-    shared_ptr<CoefficientFunction> coeff_c;
+    DPGCoefficient coeff_c;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -359,7 +436,7 @@ namespace dpg {
   template<int D> 
   class RobinVolume : public DPGintegrator   {
     
-    shared_ptr<CoefficientFunction> coeff_c;
+    DPGCoefficient coeff_c;
 
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -380,6 +457,12 @@ namespace dpg {
     virtual xbool IsSymmetric() const { return !coeff_c->IsComplex() ; }
     
     virtual string Name () const { return "RobinVolume"; }
+
+    // depends on which facets are on the boundary
+    virtual bool GetElementCoefficients (const ElementTransformation &,
+					 Array<Complex> &, LocalHeap &) const {
+      return false;
+    }
     virtual int DimElement () const { return D; }
     virtual int DimSpace () const { return D; }		
     virtual bool BoundaryForm () const { return false; }
@@ -422,10 +505,10 @@ namespace dpg {
   class NeumannVolume : public LinearFormIntegrator   {
     
     shared_ptr<CoefficientFunction> coeff_index;
-    shared_ptr<CoefficientFunction> coeff_g;
-    shared_ptr<CoefficientFunction> coeff_Gx;
-    shared_ptr<CoefficientFunction> coeff_Gy;
-    shared_ptr<CoefficientFunction> coeff_Gz;
+    DPGCoefficient coeff_g;
+    DPGCoefficient coeff_Gx;
+    DPGCoefficient coeff_Gy;
+    DPGCoefficient coeff_Gz;
 
     template<class SCAL>
     void T_CalcElementVector (const FiniteElement & base_fel,
@@ -438,7 +521,8 @@ namespace dpg {
 
     NeumannVolume(const Array<shared_ptr<CoefficientFunction>> & coeffs) 
       : coeff_index(coeffs[0]), coeff_g(coeffs[1]), 
-	coeff_Gx(coeffs[2]), coeff_Gy(coeffs[3]), coeff_Gz(coeffs[4]) {
+	coeff_Gx(coeffs[2]), coeff_Gy(coeffs[3]),
+	coeff_Gz(coeffs.Size() > 4 ? coeffs[4] : nullptr) {
 
       indx = int( coeff_index -> EvaluateConst() ) - 1 ;
       
@@ -478,7 +562,7 @@ namespace dpg {
   template<int D> 
   class FluxTraceBoundary : public DPGintegrator   {
     
-    shared_ptr<CoefficientFunction> coeff_c;
+    DPGCoefficient coeff_c;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -0,0 +1,256 @@
+#ifndef FILE_FACETSHAPECACHE_HPP
+#define FILE_FACETSHAPECACHE_HPP
+
+
+/* Tables of reference-element basis function values at the facet
+   integration points, shared by the element-boundary integrators.
+
+   The values of a basis on the reference element at the (volume
+   images of the) facet integration points depend only on the finite
+   element class, its element type, order, number of dofs, the
+   orientation of its vertex numbers, and the rule order. So they are
+   tabulated once per such key and the integrators only apply the
+   geometric mapping per element.
+
+   Tables are laid out like the batched volume integrators: an
+   [ndof x width*npts] matrix where point i of the FacetRule occupies
+   columns [width*i, width*i+width).  Stored are
+
+     FACET_SCALAR       :  u                      (width 1)
+     FACET_HDIV_NORMAL  :  q . n_ref               (width 1)
+     FACET_HCURL        :  reference H(curl) shape (width D)
+
+   The key uses the vertex numbers of the mesh element. Spaces that
+   number the element vertices differently (e.g. the periodic spaces
+   here) would get the wrong table, so before a cached table is
+   returned it is compared with the element's own basis: at all points
+   the first time the key is reused, and after that at two points per
+   facet (a mismatch by a symmetry of the facet can agree at a single
+   symmetric point). On mismatch the table is computed afresh on the
+   heap.
+ */
+
+
+#include <solve.hpp>
+#include <mutex>
+#include <map>
+#include <set>
+#include <tuple>
+#include <typeinfo>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  /////////////////////////////////////////////////////////////////
+  // Facet integration points of all facets of a reference element,
+  // mapped into the volume reference element.  Points of facet k
+  // are FacetPoints(k) of ir.
+
+  class FacetRule {
+
+  public:
+
+    IntegrationRule ir;
+    Array<int> first;      // ir[first[k]] is the first point of facet k
+    Array<int> facetnr;    // facet number of each point
+
+    FacetRule (ELEMENT_TYPE eltype, int order) {
+
+      Facet2ElementTrafo transform(eltype);
+      int nfa = ElementTopology::GetNFacets(eltype);
+      first.SetSize(nfa+1);
+      first[0] = 0;
+
+      for (int k = 0; k < nfa; k++) {
+
+	ELEMENT_TYPE eltype_facet = ElementTopology::GetFacetType(eltype, k);
+	const IntegrationRule & facet_ir =
+	  SelectIntegrationRule (eltype_facet, order);
+
+	for (int l = 0; l < facet_ir.GetNIP(); l++) {
+	  IntegrationPoint volume_ip = transform(k, facet_ir[l]);
+	  volume_ip.SetWeight(facet_ir[l].Weight());  // facet weight
+	  volume_ip.SetNr(ir.GetNIP());
+	  ir.AddIntegrationPoint(volume_ip);
+	  facetnr.Append(k);
+	}
+	first[k+1] = ir.GetNIP();
+      }
+    }
+
+    int GetNFacets() const { return first.Size()-1; }
+    IntRange FacetPoints(int k) const { return IntRange(first[k],first[k+1]); }
+  };
+
+
+  enum FACET_SHAPE_TYPE { FACET_SCALAR, FACET_HDIV_NORMAL, FACET_HCURL };
+
+  template <int D>
+  inline int FacetShapeWidth (FACET_SHAPE_TYPE type) {
+    return (type == FACET_HCURL) ? D : 1;
+  }
+
+
+  // Reference values of fel at point i of fr into the width columns col
+  template <int D>
+  void CalcFacetShape (const FiniteElement & fel, FACET_SHAPE_TYPE type,
+		       const FacetRule & fr, int i,
+		       SliceMatrix<> col, LocalHeap & lh) {
+
+    const IntegrationPoint & ip = fr.ir[i];
+
+    switch (type) {
+
+    case FACET_SCALAR:
+      dynamic_cast<const ScalarFiniteElement<D>&> (fel).
+	CalcShape(ip, col.Col(0));
+      break;
+
+    case FACET_HDIV_NORMAL: {
+      HeapReset hr(lh);
+      FlatMatrixFixWidth<D> shape(fel.GetNDof(),lh);
+      dynamic_cast<const HDivFiniteElement<D>&> (fel).CalcShape(ip, shape);
+      FlatVec<D> normal_ref =
+	ElementTopology::GetNormals(fel.ElementType()) [fr.facetnr[i]];
+      col.Col(0) = shape * normal_ref;
+      break;
+    }
+
+    case FACET_HCURL:
+      dynamic_cast<const HCurlFiniteElement<D>&> (fel).CalcShape(ip, col);
+      break;
+    }
+  }
+
+  template <int D>
+  void TabulateFacetShapes (const FiniteElement & fel, FACET_SHAPE_TYPE type,
+			    const FacetRule & fr,
+			    SliceMatrix<> tab, LocalHeap & lh) {
+    int w = FacetShapeWidth<D>(type);
+    for (int i = 0; i < fr.ir.GetNIP(); i++)
+      CalcFacetShape<D>(fel, type, fr, i, tab.Cols(w*i, w*i+w), lh);
+  }
+
+
+  // Bit (i,j) set if vertex i of the element has a larger global
+  // number than vertex j: this fixes the local orientation of edges
+  // and faces, hence the reference shapes of the element.
+
+  inline unsigned VertexOrientation (const ElementTransformation & eltrans) {
+
+    const MeshAccess & ma = *(const MeshAccess*)eltrans.GetMesh();
+    Ngs_Element ngel = ma.GetElement(eltrans.GetElementId());
+    auto vnums = ngel.Vertices();
+
+    unsigned orient = 0, bit = 1;
+    for (int i = 0; i < vnums.Size(); i++)
+      for (int j = i+1; j < vnums.Size(); j++, bit <<= 1)
+	if (vnums[i] > vnums[j]) orient |= bit;
+    return orient;
+  }
+
+
+  /////////////////////////////////////////////////////////////////
+  // The cache itself: one instance per space dimension, shared by
+  // all integrators and threads. Entries are never removed, so the
+  // returned tables stay valid.
+
+  template <int D>
+  class FacetShapeCache {
+
+    //   fe class,   eltype, ndof, order, type, orientation, rule order
+    typedef std::tuple<size_t, int, int, int, int, unsigned, int> Key;
+
+    std::mutex mtx;
+    std::map<std::tuple<int,int>, shared_ptr<FacetRule>> rules;
+    std::map<Key, shared_ptr<Matrix<>>> tables;
+    std::set<Key> verified;     // probed at all points once
+
+    FacetShapeCache() { ; }
+
+  public:
+
+    static FacetShapeCache & Instance() {
+      static FacetShapeCache cache;
+      return cache;
+    }
+
+    const FacetRule & GetRule (ELEMENT_TYPE eltype, int order) {
+
+      std::lock_guard<std::mutex> guard(mtx);
+      auto & rule = rules[std::make_tuple(int(eltype),order)];
+      if (!rule) rule = make_shared<FacetRule>(eltype, order);
+      return *rule;
+    }
+
+    FlatMatrix<> GetShapes (const FiniteElement & fel, FACET_SHAPE_TYPE type,
+			    const FacetRule & fr, int order, unsigned orient,
+			    LocalHeap & lh) {
+
+      int ndof = fel.GetNDof();
+      int w = FacetShapeWidth<D>(type);
+      int npts = fr.ir.GetNIP();
+      Key key(typeid(fel).hash_code(), int(fel.ElementType()), ndof,
+	      fel.Order(), int(type), orient, order);
+
+      shared_ptr<Matrix<>> tab;
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	auto it = tables.find(key);
+	if (it != tables.end()) tab = it->second;
+      }
+
+      if (!tab) {  // new key: tabulate with this very element
+
+	tab = make_shared<Matrix<>>(ndof, w*npts);
+	TabulateFacetShapes<D>(fel, type, fr, *tab, lh);
+
+	std::lock_guard<std::mutex> guard(mtx);
+	return *(tables.emplace(key, tab).first->second);
+      }
+
+      // probe against the element's own basis: at all points on the
+      // first reuse of a key, then at two points of each facet (not
+      // both fixed by a symmetry of the facet, which could hide an
+      // orientation mismatch)
+      bool all;
+      {
+	std::lock_guard<std::mutex> guard(mtx);
+	all = verified.insert(key).second;
+      }
+      {
+	HeapReset hr(lh);
+	FlatMatrix<> probe(ndof, w, lh);
+	auto same = [&] (int i) {
+	  CalcFacetShape<D>(fel, type, fr, i, probe, lh);
+	  auto cached = tab->Cols(w*i, w*i+w);
+	  for (int r = 0; r < ndof; r++)
+	    for (int c = 0; c < w; c++)
+	      if (fabs(probe(r,c)-cached(r,c)) > 1e-10*(1+fabs(probe(r,c))))
+		return false;
+	  return true;
+	};
+	bool match = true;
+	for (int k = 0; k < fr.GetNFacets() && match; k++) {
+	  int n = fr.first[k+1] - fr.first[k];
+	  int nprobe = all ? n : min2(n, 2);
+	  for (int l = 0; l < nprobe && match; l++)
+	    match = same (fr.first[k] + l);
+	}
+	if (match) return *tab;
+	if (all) {       // probe again next time
+	  std::lock_guard<std::mutex> guard(mtx);
+	  verified.erase(key);
+	}
+      }
+
+      FlatMatrix<> own(ndof, w*npts, lh);
+      TabulateFacetShapes<D>(fel, type, fr, own, lh);
+      return own;
+    }
+  };
+
+}
+
+#endif
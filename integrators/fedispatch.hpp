@@ -0,0 +1,182 @@
+#ifndef FILE_FEDISPATCH_HPP
+#define FILE_FEDISPATCH_HPP
+
+
+/* Element type and FE class dispatch for the DPG integrators.
+
+   An integrator checks once per element that it got a compound
+   element (FECast<CompoundFiniteElement>, a dynamic_cast). The
+   components are then known from the integrator's definition and are
+   cast with FECast without RTTI (static_cast; checked by dynamic_cast
+   in DEBUG builds, where a wrong component index in the coefficient
+   list, coef=[2,1,...], throws).
+
+   In the integration point loops the shape functions are evaluated
+   through the fe:: functions below. SwitchFE resolves, once per
+   element, the exact NGSolve high order class of a component
+   (H1HighOrderFE<ET>, L2HighOrderFE<ET>, HCurlHighOrderFE<ET>, ...)
+   and calls a generic lambda with the element cast to it. There the
+   fe:: calls are qualified member calls, i.e. without virtual
+   dispatch, and the point loop is compiled per element type. Any
+   other class (e.g. L2EnrichedQuad, periodic spaces with their own
+   elements) falls through to the base class and virtual calls. The
+   typeid of the component is taken once and compared with the few
+   candidates of its element type.
+ */
+
+
+#include <solve.hpp>
+#include <typeinfo>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  template <class FEL>
+  inline const FEL & FECast (const FiniteElement & fel) {
+#ifdef DEBUG
+    return dynamic_cast<const FEL&> (fel);
+#else
+    return static_cast<const FEL&> (fel);
+#endif
+  }
+
+  // the compound element itself is checked in every build
+  template <>
+  inline const CompoundFiniteElement &
+  FECast<CompoundFiniteElement> (const FiniteElement & fel) {
+    return dynamic_cast<const CompoundFiniteElement&> (fel);
+  }
+
+
+  namespace fe {
+
+    // exact class: qualified, non-virtual call
+    template <class FEL, class MIP, class SHAPE>
+    inline void CalcMappedDShape (const FEL & fel, const MIP & mip, SHAPE && dshape)
+    { fel.FEL::CalcMappedDShape (mip, dshape); }
+
+    template <class FEL, class MIP, class SHAPE>
+    inline void CalcMappedShape (const FEL & fel, const MIP & mip, SHAPE && shape)
+    { fel.FEL::CalcMappedShape (mip, shape); }
+
+    template <class FEL, class MIP, class SHAPE>
+    inline void CalcMappedCurlShape (const FEL & fel, const MIP & mip, SHAPE && cshape)
+    { fel.FEL::CalcMappedCurlShape (mip, cshape); }
+
+    // base classes: virtual call
+    template <int D, class MIP, class SHAPE>
+    inline void CalcMappedDShape (const ScalarFiniteElement<D> & fel,
+				  const MIP & mip, SHAPE && dshape)
+    { fel.CalcMappedDShape (mip, dshape); }
+
+    template <int D, class MIP, class SHAPE>
+    inline void CalcMappedShape (const HCurlFiniteElement<D> & fel,
+				 const MIP & mip, SHAPE && shape)
+    { fel.CalcMappedShape (mip, shape); }
+
+    template <int D, class MIP, class SHAPE>
+    inline void CalcMappedCurlShape (const HCurlFiniteElement<D> & fel,
+				     const MIP & mip, SHAPE && cshape)
+    { fel.CalcMappedCurlShape (mip, cshape); }
+  }
+
+
+  template <class FEL, class BASE, class FUNC>
+  inline bool TryFE (const BASE & fel, const std::type_info & type,
+		     FUNC & func) {
+    if (type != typeid(FEL)) return false;
+    func (static_cast<const FEL&> (fel));
+    return true;
+  }
+
+  template <int D> class SwitchFE;
+
+  template <> class SwitchFE<2> {
+
+  public:
+
+    template <class FUNC>
+    static void Scalar (const ScalarFiniteElement<2> & fel, FUNC && func) {
+      const std::type_info & type = typeid(fel);
+      switch (fel.ElementType()) {
+      case ET_TRIG:
+	if (TryFE<H1HighOrderFE<ET_TRIG>> (fel, type, func)) return;
+	if (TryFE<L2HighOrderFE<ET_TRIG>> (fel, type, func)) return;
+	break;
+      case ET_QUAD:
+	if (TryFE<H1HighOrderFE<ET_QUAD>> (fel, type, func)) return;
+	if (TryFE<L2HighOrderFE<ET_QUAD>> (fel, type, func)) return;
+	break;
+      default:
+	break;
+      }
+      func (fel);
+    }
+
+    template <class FUNC>
+    static void HCurl (const HCurlFiniteElement<2> & fel, FUNC && func) {
+      const std::type_info & type = typeid(fel);
+      switch (fel.ElementType()) {
+      case ET_TRIG:
+	if (TryFE<HCurlHighOrderFE<ET_TRIG>> (fel, type, func)) return;
+	break;
+      case ET_QUAD:
+	if (TryFE<HCurlHighOrderFE<ET_QUAD>> (fel, type, func)) return;
+	break;
+      default:
+	break;
+      }
+      func (fel);
+    }
+  };
+
+  template <> class SwitchFE<3> {
+
+  public:
+
+    template <class FUNC>
+    static void Scalar (const ScalarFiniteElement<3> & fel, FUNC && func) {
+      const std::type_info & type = typeid(fel);
+      switch (fel.ElementType()) {
+      case ET_TET:
+	if (TryFE<H1HighOrderFE<ET_TET>> (fel, type, func)) return;
+	if (TryFE<L2HighOrderFE<ET_TET>> (fel, type, func)) return;
+	break;
+      case ET_PRISM:
+	if (TryFE<H1HighOrderFE<ET_PRISM>> (fel, type, func)) return;
+	if (TryFE<L2HighOrderFE<ET_PRISM>> (fel, type, func)) return;
+	break;
+      case ET_HEX:
+	if (TryFE<H1HighOrderFE<ET_HEX>> (fel, type, func)) return;
+	if (TryFE<L2HighOrderFE<ET_HEX>> (fel, type, func)) return;
+	break;
+      default:
+	break;
+      }
+      func (fel);
+    }
+
+    template <class FUNC>
+    static void HCurl (const HCurlFiniteElement<3> & fel, FUNC && func) {
+      const std::type_info & type = typeid(fel);
+      switch (fel.ElementType()) {
+      case ET_TET:
+	if (TryFE<HCurlHighOrderFE<ET_TET>> (fel, type, func)) return;
+	break;
+      case ET_PRISM:
+	if (TryFE<HCurlHighOrderFE<ET_PRISM>> (fel, type, func)) return;
+	break;
+      case ET_HEX:
+	if (TryFE<HCurlHighOrderFE<ET_HEX>> (fel, type, func)) return;
+	break;
+      default:
+	break;
+      }
+      func (fel);
+    }
+  };
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <fem.hpp>
 #include "dpgintegrators.hpp"
+#include "facetshapecache.hpp"
 
 
 // See end of file for all integrators provided
@@ -15,7 +16,7 @@ namespace dpg {
 
   template<int D> class CurlCurlPG : public DPGintegrator {
 
-    shared_ptr<CoefficientFunction> coeff_a;
+    DPGCoefficient coeff_a;
 
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -61,12 +62,12 @@ namespace dpg {
 					LocalHeap & lh) const {
 
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const HCurlFiniteElement<D> & fel_u =  // U space
-      dynamic_cast<const HCurlFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd1()]);
     const HCurlFiniteElement<D> & fel_v =  // V space
-      dynamic_cast<const HCurlFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -76,32 +77,38 @@ namespace dpg {
     int ndofu = ru.Size();
     int ndofv = rv.Size();
 
-    FlatMatrixFixWidth<D> curl_um(ndofu,lh); // to store curl(U-basis)
-    FlatMatrixFixWidth<D> curl_vm(ndofv,lh); // to store curl(V-basis)
-
     ELEMENT_TYPE eltype                  // get the type of element: 
       = fel_u.ElementType();             // ET_TET in 3d.
 
     const IntegrationRule &              // Note: p = fel_u.Order()-1
       ir = SelectIntegrationRule(eltype, fel_u.Order()+fel_v.Order()-2);
+    int nip = ir.GetNIP();
+    MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
+
+    // curl(U-basis) and curl(V-basis) at all mapped points,
+    // point k occupying columns [D*k, D*k+D)
+    FlatMatrix<double> bcurl_um(ndofu,D*nip,lh);
+    FlatMatrix<double> bcurl_vm(ndofv,D*nip,lh);
+    FlatVector<double> weights(nip,lh);
     
     FlatMatrix<SCAL> submat(ndofv,ndofu,lh);
-    submat = SCAL(0.0);
 
-    for(int k=0; k<ir.GetNIP(); k++) {	
-      
-      MappedIntegrationPoint<D,D> mip (ir[k],eltrans);
-      // set curl(U-basis) and curl(V-basis) at mapped pts in curl_um and curl_vm.
-      fel_u.CalcMappedCurlShape( mip, curl_um ); 
-      fel_v.CalcMappedCurlShape( mip, curl_vm );
-
-      // evaluate coefficient
-      SCAL fac = coeff_a -> T_Evaluate<SCAL>(mip);
-      fac *= mip.GetWeight() ;
+    // point loop compiled for the actual classes of fel_u, fel_v
+    SwitchFE<D>::HCurl (fel_u, [&] (const auto & felu) {
+      SwitchFE<D>::HCurl (fel_v, [&] (const auto & felv) {
+
+	for(int k=0; k<nip; k++) {	
       
-      //             [ndofv x D] * [D x ndofu]
-      submat +=  fac * curl_vm  * Trans(curl_um) ;
-    }
+	  IntRange cols(D*k, D*k+D);
+	  fe::CalcMappedCurlShape( felu, mir[k], bcurl_um.Cols(cols) ); 
+	  fe::CalcMappedCurlShape( felv, mir[k], bcurl_vm.Cols(cols) );
+	  weights(k) = mir[k].GetWeight();
+	}
+      });
+    });
+
+    //      [ndofv x D*nip] * a(x) * [D*nip x ndofu]
+    CalcADBt(coeff_a, mir, weights, D, bcurl_vm, bcurl_um, submat, lh);
     
     elmat.Rows(rv).Cols(ru) += submat;
 
@@ -118,7 +125,7 @@ namespace dpg {
 
   template<int D> class TraceTraceXn : public DPGintegrator {
     
-    shared_ptr<CoefficientFunction>  coeff_d;
+    DPGCoefficient coeff_d;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -166,12 +173,12 @@ namespace dpg {
 					  LocalHeap & lh) const {
     
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
 
     const HCurlFiniteElement<D>   & fel_h =  // H space
-      dynamic_cast<const HCurlFiniteElement<D>&  > (cfel[GetInd1()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd1()]);
     const HCurlFiniteElement<D> & fel_f =  // F space
-      dynamic_cast<const HCurlFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -181,63 +188,56 @@ namespace dpg {
     int ndoff = rf.Size();
 
     FlatMatrix<SCAL> submat(ndoff,ndofh,lh);
-    FlatMatrixFixWidth<D> shapeh(ndofh,lh);  // H-basis (vec) values
     FlatMatrixFixWidth<D> shapef(ndoff,lh);  // F-basis (vec) values 
-    FlatMatrixFixWidth<D> cp(ndoff,lh); // Cross products F x n
 
     ELEMENT_TYPE eltype                   // get the type of element: 
       = fel_h.ElementType();              // ET_TET in 3d.
 
-    // transform facet integration points to volume integration points
-    Facet2ElementTrafo transform(eltype);
-
-    int nfa = ElementTopology::GetNFacets(eltype); /* nfa = number of 
-                                                      facets of an
-                                                      element */    
-    submat = SCAL(0.0);
-
-    for(int k = 0; k<nfa; k++) {
-      
-      // type of geometry of k-th facet
-      ELEMENT_TYPE eltype_facet = ElementTopology::GetFacetType(eltype, k); 
-      
-      const IntegrationRule & facet_ir =
-	SelectIntegrationRule (eltype_facet, fel_h.Order()+fel_f.Order()); 
-
-      // reference element normal vector
-      FlatVec<D> normal_ref = ElementTopology::GetNormals(eltype) [k]; 
-
-      for (int l = 0; l < facet_ir.GetNIP(); l++) {
-
-	// map facet points to volume integration points
-	IntegrationPoint volume_ip = transform(k, facet_ir[l]);
-	MappedIntegrationPoint<D,D> mip (volume_ip, eltrans);
+    // reference H(curl) shapes at the facet points of all facets
+    FacetShapeCache<D> & cache = FacetShapeCache<D>::Instance();
+    int order = fel_h.Order()+fel_f.Order();
+    const FacetRule & fr = cache.GetRule(eltype, order);
+    unsigned orient = VertexOrientation(eltrans);
+    FlatMatrix<> shapeh_ref = 
+      cache.GetShapes(fel_h, FACET_HCURL, fr, order, orient, lh);
+    FlatMatrix<> shapef_ref = 
+      cache.GetShapes(fel_f, FACET_HCURL, fr, order, orient, lh);
+
+    FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
+    int npts = fr.ir.GetNIP();
+    MappedIntegrationRule<D,D> mir(fr.ir, eltrans, lh);
+
+    // mapped H-shapes and F x n at all points,
+    // point i occupying columns [D*i, D*i+D)
+    FlatMatrix<double> bshapeh(ndofh,D*npts,lh);
+    FlatMatrix<double> bcp(ndoff,D*npts,lh);
+    FlatVector<double> weights(npts,lh);
+
+    for (int i = 0; i < npts; i++) {
+
+      IntRange cols(D*i, D*i+D);
+
+      // compute normal on physcial element
+      Mat<D> inv_jac = mir[i].GetJacobianInverse();
+      double det = mir[i].GetJacobiDet();
+      Vec<D> normal = fabs(det) * Trans(inv_jac) * normals[fr.facetnr[i]];
+      double len = L2Norm(normal);
+      normal /= len;
+      weights(i) = fr.ir[i].Weight()*len;
 	
-	// compute normal on physcial element
-	Mat<D> inv_jac = mip.GetJacobianInverse();
-	double det = mip.GetJacobiDet();
-	Vec<D> normal = fabs(det) * Trans(inv_jac) * normal_ref;       
-	double len = L2Norm(normal);
-	normal /= len;
-	double weight = facet_ir[l].Weight()*len;
-	
-	// mapped H(curl) basis fn values 
- 	fel_h.CalcMappedShape(mip,shapeh); 
-	fel_f.CalcMappedShape(mip,shapef); 
-
-	// F x n
-	cp.Col(0) = normal(2)*shapef.Col(1)-normal(1)*shapef.Col(2);
-	cp.Col(1) = normal(0)*shapef.Col(2)-normal(2)*shapef.Col(0);
-	cp.Col(2) = normal(1)*shapef.Col(0)-normal(0)*shapef.Col(1);
-
-	// evaluate coefficient
-	SCAL dd = coeff_d -> T_Evaluate<SCAL>(mip);
-
-	//                  [ndoff x D]    [ndofh x D] 	
-	submat += (dd*weight) * cp * Trans( shapeh ) ;
-      }
+      // covariant map of the reference H(curl) values
+      bshapeh.Cols(cols) = shapeh_ref.Cols(cols) * inv_jac;
+      shapef = shapef_ref.Cols(cols) * inv_jac;
+
+      // F x n
+      bcp.Col(D*i  ) = normal(2)*shapef.Col(1)-normal(1)*shapef.Col(2);
+      bcp.Col(D*i+1) = normal(0)*shapef.Col(2)-normal(2)*shapef.Col(0);
+      bcp.Col(D*i+2) = normal(1)*shapef.Col(0)-normal(0)*shapef.Col(1);
     }
 
+    //     [ndoff x D*npts] * d(x) * [D*npts x ndofh]
+    CalcADBt(coeff_d, mir, weights, D, bcp, bshapeh, submat, lh);
+
     elmat.Rows(rf).Cols(rh) += submat;
 
     if (GetInd1() != GetInd2())
@@ -250,7 +250,7 @@ namespace dpg {
 
   template<int D> class EyeEyeEdge : public DPGintegrator  {
     
-    shared_ptr<CoefficientFunction> coeff_a;
+    DPGCoefficient coeff_a;
     
     template<class SCAL>
     void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -297,11 +297,11 @@ namespace dpg {
   				       LocalHeap & lh) const {
 
     const CompoundFiniteElement &  cfel  // product space 
-      =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+      =  FECast<CompoundFiniteElement> (base_fel);
     const HCurlFiniteElement<D> & fel_u =  // u space
-      dynamic_cast<const HCurlFiniteElement<D>&> (cfel[GetInd1()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd1()]);
     const HCurlFiniteElement<D> & fel_e =  // e space
-      dynamic_cast<const HCurlFiniteElement<D>&> (cfel[GetInd2()]);
+      FECast<HCurlFiniteElement<D>> (cfel[GetInd2()]);
 
     elmat = SCAL(0.0);
 
@@ -319,17 +319,22 @@ namespace dpg {
     FlatMatrix<SCAL> submat(ndofe,ndofu,lh);
     submat = SCAL(0.0);
 
-    for(int k=0; k<ir.GetNIP(); k++) {	
+    SwitchFE<D>::HCurl (fel_u, [&] (const auto & felu) {
+      SwitchFE<D>::HCurl (fel_e, [&] (const auto & fele) {
+
+	for(int k=0; k<ir.GetNIP(); k++) {	
       
-      MappedIntegrationPoint<D,D> mip (ir[k],eltrans);
+	  MappedIntegrationPoint<D,D> mip (ir[k],eltrans);
 
-      fel_u.CalcMappedShape( mip, ushape ); 
-      fel_e.CalcMappedShape( mip, eshape );     
+	  fe::CalcMappedShape( felu, mip, ushape ); 
+	  fe::CalcMappedShape( fele, mip, eshape );     
 
-      SCAL fac = (coeff_a -> T_Evaluate<SCAL>(mip))* mip.GetWeight() ;
-      //               [ndofe x D] * [D x ndofu]
-      submat +=  fac *   eshape    * Trans(ushape) ;
-    }
+	  SCAL fac = (coeff_a.T_Evaluate<SCAL>(mip))* mip.GetWeight() ;
+	  //               [ndofe x D] * [D x ndofu]
+	  submat +=  fac *   eshape    * Trans(ushape) ;
+	}
+      });
+    });
    
     elmat.Rows(re).Cols(ru) += submat;
 
@@ -345,7 +350,7 @@ namespace dpg {
 template<int D> 
 class XnBoundary : public DPGintegrator   {
     
-  shared_ptr<CoefficientFunction> coeff_c;
+  DPGCoefficient coeff_c;
     
   template<class SCAL>
   void T_CalcElementMatrix (const FiniteElement & base_fel,
@@ -393,13 +398,13 @@ T_CalcElementMatrix (const FiniteElement & base_fel,
 		     LocalHeap & lh) const {
 
   const CompoundFiniteElement &  cfel      // product space 
-    =  dynamic_cast<const CompoundFiniteElement&> (base_fel);
+    =  FECast<CompoundFiniteElement> (base_fel);
     
   const HCurlFiniteElement<D-1> & fel_h = // H space
-    dynamic_cast<const HCurlFiniteElement<D-1>&> (cfel[GetInd1()]);
+    FECast<HCurlFiniteElement<D-1>> (cfel[GetInd1()]);
 
   const HCurlFiniteElement<D-1> & fel_w = // W space
-    dynamic_cast<const HCurlFiniteElement<D-1>&> (cfel[GetInd2()]);
+    FECast<HCurlFiniteElement<D-1>> (cfel[GetInd2()]);
 
   elmat = SCAL(0.0);
 
@@ -431,7 +436,7 @@ T_CalcElementMatrix (const FiniteElement & base_fel,
 
     MappedIntegrationPoint<D-1,D> mip(ir[i], eltrans);
 
-    SCAL cc = coeff_c -> T_Evaluate<SCAL>(mip);
+    SCAL cc = coeff_c.T_Evaluate<SCAL>(mip);
 
     fel_w.CalcShape (ir[i], shapew_ref);
     fel_h.CalcShape (ir[i], shapeh_ref);
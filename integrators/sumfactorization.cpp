@@ -0,0 +1,669 @@
+#include <solve.hpp>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <typeinfo>
+#include "dpgintegrators.hpp"
+#include "facetshapecache.hpp"
+#include "sumfactorization.hpp"
+
+// See sumfactorization.hpp for the idea.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  static std::atomic<bool> sumfactorization(true);
+
+  void SetSumFactorization (bool on) { sumfactorization = on; }
+
+  bool UseSumFactorization () { return sumfactorization; }
+
+
+  //////////////////////////////////////////////////////////////
+  // Legendre polynomials L_a(x) = P_a(2x-1) on [0,1], a < n, and
+  // their derivatives.
+
+  static void CalcLegendre01 (int n, double x,
+			      SliceVector<> val, SliceVector<> dval) {
+
+    double s = 2*x-1;
+    val(0) = 1;  dval(0) = 0;
+    if (n > 1) { val(1) = s;  dval(1) = 2; }
+    for (int a = 1; a+1 < n; a++) {
+      val(a+1)  = ( (2*a+1)*s*val(a) - a*val(a-1) ) / (a+1);
+      dval(a+1) = dval(a-1) + 2*(2*a+1)*val(a);
+    }
+  }
+
+  // tensor Legendre values  l(a0 + n*a1 + n*n*a2) at ip
+  template <int D>
+  static void CalcTensorLegendre (int n, const IntegrationPoint & ip,
+				  FlatVector<> l, LocalHeap & lh) {
+
+    HeapReset hr(lh);
+    FlatMatrix<> val(D, n, lh), dval(D, n, lh);
+    for (int k = 0; k < D; k++)
+      CalcLegendre01(n, ip(k), val.Row(k), dval.Row(k));
+
+    for (int alpha = 0; alpha < l.Size(); alpha++) {
+      double prod = 1;
+      for (int k = 0, rem = alpha; k < D; k++, rem /= n)
+	prod *= val(k, rem % n);
+      l(alpha) = prod;
+    }
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  // Tensor Gauss rules with nq points per direction: the 1D rule,
+  // the volume rule (x fastest) and the rules on the 2D facets
+  // {x_i = s}, s = 0,1, stored as facet[2*i+s].
+
+  class TensorRule {
+
+  public:
+
+    Array<double> x, w;
+    IntegrationRule vol;
+    Array<shared_ptr<IntegrationRule>> facet;
+
+    TensorRule (int D, int nq) {
+
+      ComputeGaussRule (nq, x, w);
+
+      int npts = 1;
+      for (int k = 0; k < D; k++) npts *= nq;
+
+      for (int q = 0; q < npts; q++) {
+	double pt[3] = { 0, 0, 0 };
+	double wt = 1;
+	for (int k = 0, rem = q; k < D; k++, rem /= nq) {
+	  pt[k] = x[rem % nq];
+	  wt *= w[rem % nq];
+	}
+	vol.AddIntegrationPoint (IntegrationPoint(pt[0], pt[1], pt[2], wt));
+      }
+
+      for (int i = 0; i < D; i++)
+	for (int s = 0; s < 2; s++) {
+	  auto ir = make_shared<IntegrationRule>();
+	  for (int q = 0; q < npts/nq; q++) {
+	    double pt[3] = { 0, 0, 0 };
+	    double wt = 1;
+	    for (int k = 0, rem = q; k < D; k++) {
+	      if (k == i) { pt[k] = s; continue; }
+	      pt[k] = x[rem % nq];
+	      wt *= w[rem % nq];
+	      rem /= nq;
+	    }
+	    ir->AddIntegrationPoint (IntegrationPoint(pt[0], pt[1], pt[2], wt));
+	  }
+	  facet.Append (ir);
+	}
+    }
+  };
+
+  template <int D>
+  static const TensorRule & GetTensorRule (int nq) {
+
+    static std::mutex mtx;
+    static std::map<int, shared_ptr<TensorRule>> rules;
+
+    std::lock_guard<std::mutex> guard(mtx);
+    auto & rule = rules[nq];
+    if (!rule) rule = make_shared<TensorRule>(D, nq);
+    return *rule;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  // Tensor Legendre expansion of a basis
+
+  // values of all components at ip, row c*ndof+i
+  template <int D>
+  static void CalcComponentShapes (const FiniteElement & fel, bool hdiv,
+				   const IntegrationPoint & ip,
+				   FlatVector<> shape, LocalHeap & lh) {
+    HeapReset hr(lh);
+    int ndof = fel.GetNDof();
+    if (!hdiv) {
+      static_cast<const ScalarFiniteElement<D>&> (fel).CalcShape(ip, shape);
+      return;
+    }
+    FlatMatrixFixWidth<D> vshape(ndof, lh);
+    static_cast<const HDivFiniteElement<D>&> (fel).CalcShape(ip, vshape);
+    for (int c = 0; c < D; c++)
+      shape.Range(c*ndof, (c+1)*ndof) = vshape.Col(c);
+  }
+
+  // does the expansion tb reproduce the basis of fel at ip?
+  template <int D>
+  static bool Reproduces (const TensorBasis & tb, const FiniteElement & fel,
+			  bool hdiv, const IntegrationPoint & ip,
+			  LocalHeap & lh) {
+    HeapReset hr(lh);
+    int nrows = tb.ncomp*tb.ndof;
+    int nalpha = 1;
+    for (int k = 0; k < D; k++) nalpha *= tb.n;
+
+    FlatVector<> shape(nrows, lh), l(nalpha, lh);
+    CalcComponentShapes<D>(fel, hdiv, ip, shape, lh);
+    CalcTensorLegendre<D>(tb.n, ip, l, lh);
+
+    for (int row = 0; row < nrows; row++) {
+      double sum = 0;
+      for (int j = tb.first[row]; j < tb.first[row+1]; j++)
+	sum += tb.coef[j] * l(tb.index[j]);
+      if (fabs(sum-shape(row)) > 1e-8*(1+fabs(shape(row))))
+	return false;
+    }
+    return true;
+  }
+
+  template <int D>
+  static shared_ptr<TensorBasis>
+  CalcTensorBasis (const FiniteElement & fel, bool hdiv, LocalHeap & lh) {
+
+    HeapReset hr(lh);
+    auto tb = make_shared<TensorBasis>();
+    int n = fel.Order()+2;
+    int ndof = fel.GetNDof();
+    int ncomp = hdiv ? D : 1;
+    int nrows = ncomp*ndof;
+    tb->n = n;
+    tb->ndof = ndof;
+    tb->ncomp = ncomp;
+
+    // L2 projection, exact with n Gauss points per direction
+    const TensorRule & tr = GetTensorRule<D>(n);
+    int npts = tr.vol.GetNIP();
+    int nalpha = npts;
+
+    FlatMatrix<> shapes(nrows, npts, lh);
+    FlatMatrix<> lw(npts, nalpha, lh);
+    FlatVector<> shape(nrows, lh);
+    for (int q = 0; q < npts; q++) {
+      CalcComponentShapes<D>(fel, hdiv, tr.vol[q], shape, lh);
+      shapes.Col(q) = shape;
+      CalcTensorLegendre<D>(n, tr.vol[q], lw.Row(q), lh);
+    }
+    for (int alpha = 0; alpha < nalpha; alpha++) {
+      double norm2inv = 1;              // 1 / |L_alpha|^2
+      for (int k = 0, rem = alpha; k < D; k++, rem /= n)
+	norm2inv *= 2*(rem % n)+1;
+      for (int q = 0; q < npts; q++)
+	lw(q,alpha) *= tr.vol[q].Weight() * norm2inv;
+    }
+    FlatMatrix<> t(nrows, nalpha, lh);
+    t = shapes * lw | Lapack;
+
+    double tmax = 0;
+    for (int row = 0; row < nrows; row++)
+      for (int alpha = 0; alpha < nalpha; alpha++)
+	tmax = max2(tmax, fabs(t(row,alpha)));
+
+    tb->first.SetSize(nrows+1);
+    tb->first[0] = 0;
+    for (int row = 0; row < nrows; row++) {
+      for (int alpha = 0; alpha < nalpha; alpha++)
+	if (fabs(t(row,alpha)) > 1e-13*tmax) {
+	  tb->index.Append(alpha);
+	  tb->coef.Append(t(row,alpha));
+	}
+      tb->first[row+1] = tb->index.Size();
+    }
+
+    // check that the basis is really of this form
+    tb->istensor = true;
+    IntegrationPoint checkpts[3] =
+      { IntegrationPoint(0.1234, 0.7071, 0.3183),
+	IntegrationPoint(0.8660, 0.2718, 0.5772),
+	IntegrationPoint(0.4142, 0.9511, 0.0618) };
+    for (int i = 0; i < 3; i++)
+      if (!Reproduces<D>(*tb, fel, hdiv, checkpts[i], lh))
+	tb->istensor = false;
+
+    return tb;
+  }
+
+  // The cached expansion of the basis of fel, or nullptr if there is
+  // none that fits this element.
+  template <int D>
+  static const TensorBasis *
+  GetTensorBasis (const FiniteElement & fel, bool hdiv,
+		  unsigned orient, LocalHeap & lh) {
+
+    //   fe class,   eltype, ndof, order, hdiv, orientation
+    typedef std::tuple<size_t, int, int, int, bool, unsigned> Key;
+    static std::mutex mtx;
+    static std::map<Key, shared_ptr<TensorBasis>> bases;
+
+    Key key(typeid(fel).hash_code(), int(fel.ElementType()),
+	    fel.GetNDof(), fel.Order(), hdiv, orient);
+
+    shared_ptr<TensorBasis> tb;
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      auto it = bases.find(key);
+      if (it != bases.end()) tb = it->second;
+    }
+
+    if (!tb) {  // new key: expand the basis of this very element
+      tb = CalcTensorBasis<D>(fel, hdiv, lh);
+      std::lock_guard<std::mutex> guard(mtx);
+      tb = bases.emplace(key, tb).first->second;
+      return tb->istensor ? tb.get() : nullptr;
+    }
+
+    if (!tb->istensor) return nullptr;
+
+    // probe, as for the facet shape tables
+    IntegrationPoint probe(0.2718, 0.5772, 0.6931);
+    return Reproduces<D>(*tb, fel, hdiv, probe, lh) ? tb.get() : nullptr;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  // 1D tables: Legendre values (and derivatives) at points x
+
+  static void LegendreTable (int n, FlatArray<double> x,
+			     FlatMatrix<> val, FlatMatrix<> dval) {
+    for (int q = 0; q < x.Size(); q++)
+      CalcLegendre01(n, x[q], val.Col(q), dval.Col(q));
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  // The sum-factorized kernel
+  //
+  //   a(alpha,beta) += sum_q d(q) prod_k f[k](a_k,q_k) g[k](b_k,q_k)
+  //
+  // with  alpha = a0 + ne*a1 + ..., beta = b0 + nu*b1 + ...,
+  // f[k] of size [ne x nq_k], g[k] of size [nu x nq_k], and d in
+  // the order q0 + nq_0*q1 + ... (q0 fastest).
+  //
+  // Direction k is contracted in step k: before it, the intermediate
+  // is  x[P + m*(q_k + nq_k*r)]  with P the multi-index of the pairs
+  // p_j = a_j + ne*b_j of the directions j < k, so for each r the
+  // step is the matrix product  [np x nq_k] * [nq_k x m].
+
+  template <int D, class SCAL>
+  static void TensorKernel (FlatMatrix<> * f, FlatMatrix<> * g,
+			    FlatVector<SCAL> d, FlatMatrix<SCAL> a,
+			    LocalHeap & lh) {
+
+    HeapReset hr(lh);
+    int ne = f[0].Height();
+    int nu = g[0].Height();
+    int np = ne*nu;
+
+    SCAL * x = d.Data();
+    int m = 1;
+    int rest = d.Size();
+
+    for (int k = 0; k < D; k++) {
+
+      int nq = f[k].Width();
+      rest /= nq;
+
+      FlatMatrix<> h(np, nq, lh);
+      for (int ia = 0; ia < ne; ia++)
+	for (int ib = 0; ib < nu; ib++)
+	  for (int q = 0; q < nq; q++)
+	    h(ia+ne*ib, q) = f[k](ia,q) * g[k](ib,q);
+
+      SCAL * y = new (lh) SCAL[m*np*rest];
+      for (int r = 0; r < rest; r++) {
+	FlatMatrix<SCAL> xt(nq, m, x+m*nq*r);
+	FlatMatrix<SCAL> yt(np, m, y+m*np*r);
+	yt = h * xt;
+      }
+      x = y;
+      m *= np;
+    }
+
+    for (int P = 0; P < m; P++) {
+      int alpha = 0, beta = 0, pe = 1, pu = 1;
+      for (int k = 0, rem = P; k < D; k++, rem /= np) {
+	int pk = rem % np;
+	alpha += (pk % ne) * pe;
+	beta  += (pk / ne) * pu;
+	pe *= ne;
+	pu *= nu;
+      }
+      a(alpha,beta) += x[P];
+    }
+  }
+
+
+  // submat += T_e A T_u^T  for components ce of te and cu of tu
+  template <class SCAL>
+  static void TransformBack (const TensorBasis & te, int ce,
+			     const TensorBasis & tu, int cu,
+			     FlatMatrix<SCAL> a, FlatMatrix<SCAL> submat,
+			     LocalHeap & lh) {
+
+    HeapReset hr(lh);
+    FlatMatrix<SCAL> x(a.Height(), tu.ndof, lh);
+
+    for (int alpha = 0; alpha < a.Height(); alpha++)
+      for (int j = 0; j < tu.ndof; j++) {
+	SCAL sum = 0.0;
+	int row = cu*tu.ndof+j;
+	for (int l = tu.first[row]; l < tu.first[row+1]; l++)
+	  sum += tu.coef[l] * a(alpha, tu.index[l]);
+	x(alpha,j) = sum;
+      }
+
+    for (int i = 0; i < te.ndof; i++) {
+      int row = ce*te.ndof+i;
+      for (int l = te.first[row]; l < te.first[row+1]; l++)
+	submat.Row(i) += te.coef[l] * x.Row(te.index[l]);
+    }
+  }
+
+
+  static int Power (int n, int D) {
+    int p = 1;
+    for (int k = 0; k < D; k++) p *= n;
+    return p;
+  }
+
+  template <int D>
+  static bool IsTensorElement (ELEMENT_TYPE eltype) {
+    if (!UseSumFactorization()) return false;
+    return (D == 2 && eltype == ET_QUAD) || (D == 3 && eltype == ET_HEX);
+  }
+
+  // facet k of the reference quad/hex is  {x_i = s}
+  template <int D>
+  static void FacetDirection (ELEMENT_TYPE eltype, int k, int & i, int & s) {
+    Vec<D> normal_ref = ElementTopology::GetNormals<D>(eltype) [k];
+    for (i = 0; i < D; i++)
+      if (normal_ref(i) != 0) break;
+    s = (normal_ref(i) > 0) ? 1 : 0;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+
+  template <int D, class SCAL>
+  bool TensorEyeEye (const ScalarFiniteElement<D> & fel_u,
+		     const ScalarFiniteElement<D> & fel_e,
+		     const ElementTransformation & eltrans,
+		     const DPGCoefficient & coeff, int order,
+		     FlatMatrix<SCAL> submat, LocalHeap & lh) {
+
+    if (!IsTensorElement<D>(fel_u.ElementType())) return false;
+    unsigned orient = VertexOrientation(eltrans);
+    const TensorBasis * tu = GetTensorBasis<D>(fel_u, false, orient, lh);
+    const TensorBasis * te = GetTensorBasis<D>(fel_e, false, orient, lh);
+    if (!tu || !te) return false;
+
+    const TensorRule & tr = GetTensorRule<D>(order/2+1);
+    int nq = tr.x.Size();
+    MappedIntegrationRule<D,D> mir(tr.vol, eltrans, lh);
+
+    FlatVector<SCAL> d(mir.Size(), lh);
+    coeff.Evaluate(mir, d);
+    for (int q = 0; q < mir.Size(); q++)
+      d(q) *= mir[q].GetWeight();
+
+    FlatMatrix<> le(te->n, nq, lh), dle(te->n, nq, lh);
+    FlatMatrix<> lu(tu->n, nq, lh), dlu(tu->n, nq, lh);
+    LegendreTable(te->n, tr.x, le, dle);
+    LegendreTable(tu->n, tr.x, lu, dlu);
+
+    FlatMatrix<> f[D], g[D];
+    for (int k = 0; k < D; k++) {
+      f[k].AssignMemory(te->n, nq, le.Data());
+      g[k].AssignMemory(tu->n, nq, lu.Data());
+    }
+
+    FlatMatrix<SCAL> a(Power(te->n,D), Power(tu->n,D), lh);
+    a = SCAL(0.0);
+    TensorKernel<D>(f, g, d, a, lh);
+
+    submat = SCAL(0.0);
+    TransformBack(*te, 0, *tu, 0, a, submat, lh);
+    return true;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  grad e . grad u = sum_ij  d_i e  K_ij  d_j u  with the
+  //  reference derivatives d_i and  K = J^{-1} J^{-T}.
+
+  template <int D, class SCAL>
+  bool TensorGradGrad (const ScalarFiniteElement<D> & fel_u,
+		       const ScalarFiniteElement<D> & fel_e,
+		       const ElementTransformation & eltrans,
+		       const DPGCoefficient & coeff, int order,
+		       FlatMatrix<SCAL> submat, LocalHeap & lh) {
+
+    if (!IsTensorElement<D>(fel_u.ElementType())) return false;
+    unsigned orient = VertexOrientation(eltrans);
+    const TensorBasis * tu = GetTensorBasis<D>(fel_u, false, orient, lh);
+    const TensorBasis * te = GetTensorBasis<D>(fel_e, false, orient, lh);
+    if (!tu || !te) return false;
+
+    const TensorRule & tr = GetTensorRule<D>(max2(order,0)/2+1);
+    int nq = tr.x.Size();
+    int npts = tr.vol.GetNIP();
+    MappedIntegrationRule<D,D> mir(tr.vol, eltrans, lh);
+
+    FlatVector<SCAL> cval(npts, lh);
+    coeff.Evaluate(mir, cval);
+    FlatMatrix<SCAL> dk(D*D, npts, lh);
+    for (int q = 0; q < npts; q++) {
+      SCAL fac = cval(q) * mir[q].GetWeight();
+      Mat<D> inv_jac = mir[q].GetJacobianInverse();
+      Mat<D> metric = inv_jac * Trans(inv_jac);
+      for (int i = 0; i < D; i++)
+	for (int j = 0; j < D; j++)
+	  dk(i*D+j, q) = fac * metric(i,j);
+    }
+
+    FlatMatrix<> le(te->n, nq, lh), dle(te->n, nq, lh);
+    FlatMatrix<> lu(tu->n, nq, lh), dlu(tu->n, nq, lh);
+    LegendreTable(te->n, tr.x, le, dle);
+    LegendreTable(tu->n, tr.x, lu, dlu);
+
+    FlatMatrix<SCAL> a(Power(te->n,D), Power(tu->n,D), lh);
+    a = SCAL(0.0);
+
+    FlatMatrix<> f[D], g[D];
+    for (int i = 0; i < D; i++)
+      for (int j = 0; j < D; j++) {
+	for (int k = 0; k < D; k++) {
+	  f[k].AssignMemory(te->n, nq, (k == i ? dle : le).Data());
+	  g[k].AssignMemory(tu->n, nq, (k == j ? dlu : lu).Data());
+	}
+	FlatVector<SCAL> d(npts, &dk(i*D+j,0));
+	TensorKernel<D>(f, g, d, a, lh);
+      }
+
+    submat = SCAL(0.0);
+    TransformBack(*te, 0, *tu, 0, a, submat, lh);
+    return true;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+
+  template <int D, class SCAL>
+  bool TensorTraceTrace (const ScalarFiniteElement<D> & fel_u,
+			 const ScalarFiniteElement<D> & fel_e,
+			 const ElementTransformation & eltrans,
+			 const DPGCoefficient & coeff, int order,
+			 FlatMatrix<SCAL> submat, LocalHeap & lh) {
+
+    ELEMENT_TYPE eltype = fel_u.ElementType();
+    if (!IsTensorElement<D>(eltype)) return false;
+    unsigned orient = VertexOrientation(eltrans);
+    const TensorBasis * tu = GetTensorBasis<D>(fel_u, false, orient, lh);
+    const TensorBasis * te = GetTensorBasis<D>(fel_e, false, orient, lh);
+    if (!tu || !te) return false;
+
+    const TensorRule & tr = GetTensorRule<D>(order/2+1);
+    int nq = tr.x.Size();
+
+    FlatMatrix<> le(te->n, nq, lh), dle(te->n, nq, lh);
+    FlatMatrix<> lu(tu->n, nq, lh), dlu(tu->n, nq, lh);
+    LegendreTable(te->n, tr.x, le, dle);
+    LegendreTable(tu->n, tr.x, lu, dlu);
+
+    // values at the end points 0 and 1
+    double ends[2] = { 0, 1 };
+    FlatMatrix<> le1(te->n, 2, lh), dle1(te->n, 2, lh);
+    FlatMatrix<> lu1(tu->n, 2, lh), dlu1(tu->n, 2, lh);
+    LegendreTable(te->n, FlatArray<double>(2,ends), le1, dle1);
+    LegendreTable(tu->n, FlatArray<double>(2,ends), lu1, dlu1);
+
+    FlatMatrix<SCAL> a(Power(te->n,D), Power(tu->n,D), lh);
+    a = SCAL(0.0);
+
+    FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
+    int nfa = ElementTopology::GetNFacets(eltype);
+
+    for (int k = 0; k < nfa; k++) {
+
+      HeapReset hr(lh);
+      int i, s;
+      FacetDirection<D>(eltype, k, i, s);
+      const IntegrationRule & ir = *tr.facet[2*i+s];
+      MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
+
+      FlatVector<SCAL> d(ir.GetNIP(), lh);
+      coeff.Evaluate(mir, d);
+      for (int q = 0; q < ir.GetNIP(); q++) {
+	// surface measure of the physical facet
+	Mat<D> inv_jac = mir[q].GetJacobianInverse();
+	double det = mir[q].GetMeasure();
+	Vec<D> normal = det * Trans(inv_jac) * normals[k];
+	d(q) *= ir[q].Weight() * L2Norm(normal);
+      }
+
+      FlatMatrix<> f[D], g[D];
+      for (int l = 0; l < D; l++)
+	if (l == i) {
+	  f[l].AssignMemory(te->n, 1, lh);  f[l].Col(0) = le1.Col(s);
+	  g[l].AssignMemory(tu->n, 1, lh);  g[l].Col(0) = lu1.Col(s);
+	}
+	else {
+	  f[l].AssignMemory(te->n, nq, le.Data());
+	  g[l].AssignMemory(tu->n, nq, lu.Data());
+	}
+      TensorKernel<D>(f, g, d, a, lh);
+    }
+
+    submat = SCAL(0.0);
+    TransformBack(*te, 0, *tu, 0, a, submat, lh);
+    return true;
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  On facet {x_i = s} the Piola map gives  (mapped q).n ds =
+  //  sign(det) * (+-) q_i * (reference facet weight), so only the
+  //  i-th component of the H(div) expansion enters.
+
+  template <int D, class SCAL>
+  bool TensorFluxTrace (const HDivFiniteElement<D> & fel_q,
+			const ScalarFiniteElement<D> & fel_e,
+			const ElementTransformation & eltrans,
+			const DPGCoefficient & coeff, int order,
+			FlatMatrix<SCAL> submat, LocalHeap & lh) {
+
+    ELEMENT_TYPE eltype = fel_q.ElementType();
+    if (!IsTensorElement<D>(eltype)) return false;
+    unsigned orient = VertexOrientation(eltrans);
+    const TensorBasis * tq = GetTensorBasis<D>(fel_q, true, orient, lh);
+    const TensorBasis * te = GetTensorBasis<D>(fel_e, false, orient, lh);
+    if (!tq || !te) return false;
+
+    const TensorRule & tr = GetTensorRule<D>(order/2+1);
+    int nq = tr.x.Size();
+
+    FlatMatrix<> le(te->n, nq, lh), dle(te->n, nq, lh);
+    FlatMatrix<> lq(tq->n, nq, lh), dlq(tq->n, nq, lh);
+    LegendreTable(te->n, tr.x, le, dle);
+    LegendreTable(tq->n, tr.x, lq, dlq);
+
+    double ends[2] = { 0, 1 };
+    FlatMatrix<> le1(te->n, 2, lh), dle1(te->n, 2, lh);
+    FlatMatrix<> lq1(tq->n, 2, lh), dlq1(tq->n, 2, lh);
+    LegendreTable(te->n, FlatArray<double>(2,ends), le1, dle1);
+    LegendreTable(tq->n, FlatArray<double>(2,ends), lq1, dlq1);
+
+    // one A per component of q
+    int nalpha = Power(te->n,D), nbeta = Power(tq->n,D);
+    FlatMatrix<SCAL> a(D*nalpha, nbeta, lh);
+    a = SCAL(0.0);
+
+    FlatVector< Vec<D> > normals = ElementTopology::GetNormals<D>(eltype);
+    int nfa = ElementTopology::GetNFacets(eltype);
+
+    for (int k = 0; k < nfa; k++) {
+
+      HeapReset hr(lh);
+      int i, s;
+      FacetDirection<D>(eltype, k, i, s);
+      const IntegrationRule & ir = *tr.facet[2*i+s];
+      MappedIntegrationRule<D,D> mir(ir, eltrans, lh);
+
+      FlatVector<SCAL> d(ir.GetNIP(), lh);
+      coeff.Evaluate(mir, d);
+      for (int q = 0; q < ir.GetNIP(); q++) {
+	double weight = ir[q].Weight() * normals[k](i);
+	if (mir[q].GetJacobiDet() < 0) weight = -weight;
+	d(q) *= weight;
+      }
+
+      FlatMatrix<> f[D], g[D];
+      for (int l = 0; l < D; l++)
+	if (l == i) {
+	  f[l].AssignMemory(te->n, 1, lh);  f[l].Col(0) = le1.Col(s);
+	  g[l].AssignMemory(tq->n, 1, lh);  g[l].Col(0) = lq1.Col(s);
+	}
+	else {
+	  f[l].AssignMemory(te->n, nq, le.Data());
+	  g[l].AssignMemory(tq->n, nq, lq.Data());
+	}
+      TensorKernel<D>(f, g, d, a.Rows(i*nalpha, (i+1)*nalpha), lh);
+    }
+
+    submat = SCAL(0.0);
+    for (int i = 0; i < D; i++)
+      TransformBack(*te, 0, *tq, i, a.Rows(i*nalpha, (i+1)*nalpha),
+		    submat, lh);
+    return true;
+  }
+
+
+#define INSTANTIATE_TENSOR(D, SCAL)					\
+  template bool TensorEyeEye<D,SCAL>					\
+  (const ScalarFiniteElement<D> &, const ScalarFiniteElement<D> &,	\
+   const ElementTransformation &, const DPGCoefficient &, int,	\
+   FlatMatrix<SCAL>, LocalHeap &);					\
+  template bool TensorGradGrad<D,SCAL>					\
+  (const ScalarFiniteElement<D> &, const ScalarFiniteElement<D> &,	\
+   const ElementTransformation &, const DPGCoefficient &, int,	\
+   FlatMatrix<SCAL>, LocalHeap &);					\
+  template bool TensorTraceTrace<D,SCAL>				\
+  (const ScalarFiniteElement<D> &, const ScalarFiniteElement<D> &,	\
+   const ElementTransformation &, const DPGCoefficient &, int,	\
+   FlatMatrix<SCAL>, LocalHeap &);					\
+  template bool TensorFluxTrace<D,SCAL>					\
+  (const HDivFiniteElement<D> &, const ScalarFiniteElement<D> &,	\
+   const ElementTransformation &, const DPGCoefficient &, int,	\
+   FlatMatrix<SCAL>, LocalHeap &);
+
+  INSTANTIATE_TENSOR(2, double)
+  INSTANTIATE_TENSOR(2, Complex)
+  INSTANTIATE_TENSOR(3, double)
+  INSTANTIATE_TENSOR(3, Complex)
+}
@@ -0,0 +1,97 @@
+#ifndef FILE_SUMFACTORIZATION_HPP
+#define FILE_SUMFACTORIZATION_HPP
+
+
+/* Sum-factorized element matrices on quadrilaterals and hexahedra.
+
+   On ET_QUAD / ET_HEX every basis used in the DPG integrators (H1,
+   L2, L2EnrichedQuad, and each vector component of H(div)) is a
+   polynomial of degree <= Order()+1 in each reference coordinate. So
+   it can be written exactly in the tensor Legendre basis
+
+      L_a(x) L_b(y) (L_c(z)),     L_a(t) = P_a(2t-1),
+
+   with a sparse coefficient table T (TensorBasis, computed once per
+   kind of element and cached like the facet shape tables). An element
+   matrix is then
+
+      T_e  A  T_u^T,   A_{ab} = sum_q d(q) prod_k F_k[a_k](q_k) G_k[b_k](q_k),
+
+   where the F_k, G_k are 1D Legendre values (or derivatives) at the 1D
+   Gauss points and d(q) collects coefficient and geometry at the tensor
+   integration points. A is formed by contracting one direction at a
+   time, costing O(p^{2D+1}) instead of the O(p^{3D}) of the
+   point-by-point evaluation.
+
+   Each routine below returns false (leaving submat untouched) when
+   this does not apply, e.g. for other element types, or when an
+   element's basis does not match the cached table, and the caller then
+   uses its generic path. Otherwise submat is overwritten.
+ */
+
+
+#include <solve.hpp>
+#include "dpgcoefficient.hpp"
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  // on by default; off: the routines below return false, so the
+  // integrators use their generic path (for comparisons)
+  void SetSumFactorization (bool on);
+  bool UseSumFactorization ();
+
+  // A basis on [0,1]^D in the tensor Legendre basis with n polynomials
+  // per direction. Row  c*ndof+i  holds the expansion of component c
+  // of basis function i:  coef[l] for the multi-index
+  //   index[l] = a0 + n*a1 + n*n*a2,   first[row] <= l < first[row+1].
+
+  class TensorBasis {
+
+  public:
+
+    bool istensor;      // false: the basis is not of this form
+    int n;
+    int ndof;
+    int ncomp;          // 1, or D for H(div)
+    Array<int> first;
+    Array<int> index;
+    Array<double> coef;
+  };
+
+
+  //  a(x) * u * e  (EyeEye)
+  template <int D, class SCAL>
+  bool TensorEyeEye (const ScalarFiniteElement<D> & fel_u,
+		     const ScalarFiniteElement<D> & fel_e,
+		     const ElementTransformation & eltrans,
+		     const DPGCoefficient & coeff, int order,
+		     FlatMatrix<SCAL> submat, LocalHeap & lh);
+
+  //  a(x) * grad u . grad e  (GradGrad)
+  template <int D, class SCAL>
+  bool TensorGradGrad (const ScalarFiniteElement<D> & fel_u,
+		       const ScalarFiniteElement<D> & fel_e,
+		       const ElementTransformation & eltrans,
+		       const DPGCoefficient & coeff, int order,
+		       FlatMatrix<SCAL> submat, LocalHeap & lh);
+
+  //  c(x) * u * e  on all element facets  (TraceTrace)
+  template <int D, class SCAL>
+  bool TensorTraceTrace (const ScalarFiniteElement<D> & fel_u,
+			 const ScalarFiniteElement<D> & fel_e,
+			 const ElementTransformation & eltrans,
+			 const DPGCoefficient & coeff, int order,
+			 FlatMatrix<SCAL> submat, LocalHeap & lh);
+
+  //  d(x) * q.n * e  on all element facets  (FluxTrace)
+  template <int D, class SCAL>
+  bool TensorFluxTrace (const HDivFiniteElement<D> & fel_q,
+			const ScalarFiniteElement<D> & fel_e,
+			const ElementTransformation & eltrans,
+			const DPGCoefficient & coeff, int order,
+			FlatMatrix<SCAL> submat, LocalHeap & lh);
+}
+
+#endif
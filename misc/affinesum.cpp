@@ -0,0 +1,114 @@
+#include <solve.hpp>
+#include "affinesum.hpp"
+
+// See affinesum.hpp.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  static void ToScalar (Complex c, Complex & s) { s = c; }
+
+  static void ToScalar (Complex c, double & s) {
+    if (c.imag() != 0)
+      throw Exception ("AffineSum: complex coefficient for real matrices");
+    s = c.real();
+  }
+
+
+  AffineSum :: AffineSum (const Array<shared_ptr<BaseSparseMatrix>> & aterms)
+    : terms(aterms) {
+
+    if (terms.Size() == 0)
+      throw Exception ("AffineSum: no matrices given");
+
+    sum = dynamic_pointer_cast<BaseSparseMatrix> (terms[0]->CreateMatrix());
+    const MatrixGraph & g0 = dynamic_cast<const MatrixGraph&> (*terms[0]);
+    int n = g0.Size();
+
+    positions.SetSize(terms.Size());
+    for (int i = 1; i < terms.Size(); i++) {
+
+      if (terms[i]->IsComplex() != terms[0]->IsComplex())
+	throw Exception ("AffineSum: real and complex matrices mixed");
+      const MatrixGraph & g = dynamic_cast<const MatrixGraph&> (*terms[i]);
+      if (g.Size() != n)
+	throw Exception ("AffineSum: matrices of different sizes");
+
+      bool same = g.NZE() == g0.NZE();
+      for (int r = 0; same && r < n; r++) {
+	FlatArray<int> ri = g.GetRowIndices(r), r0 = g0.GetRowIndices(r);
+	same = ri.Size() == r0.Size();
+	for (int j = 0; same && j < ri.Size(); j++)
+	  same = ri[j] == r0[j];
+      }
+      if (same) continue;
+
+      // the entries are stored row by row
+      positions[i].SetSize(g.NZE());
+      int k = 0;
+      for (int r = 0; r < n; r++)
+	for (int c : g.GetRowIndices(r)) {
+	  int pos = g0.GetPositionTest(r, c);
+	  if (pos < 0)
+	    throw Exception ("AffineSum: pattern of matrix " + ToString(i) +
+			     " is not contained in the first one");
+	  positions[i][k++] = pos;
+	}
+    }
+
+    cout << "Affine sum of " << terms.Size() << " matrices" << endl;
+  }
+
+
+  void AffineSum :: Set (FlatArray<Complex> coefs) {
+
+    if (coefs.Size() != terms.Size())
+      throw Exception ("AffineSum: " + ToString(terms.Size()) +
+		       " coefficients expected");
+
+    if (sum->IsComplex())
+      T_Set<Complex> (coefs);
+    else
+      T_Set<double> (coefs);
+  }
+
+
+  template <class SCAL>
+  void AffineSum :: T_Set (FlatArray<Complex> coefs) {
+
+    static Timer t("AffineSum::Set");
+    RegionTimer reg(t);
+
+    FlatVector<SCAL> s = sum->AsVector().FV<SCAL>();
+    int nze = s.Size();
+
+    // terms with the pattern of the sum in one pass
+    Array<int> direct;
+    for (int i = 0; i < terms.Size(); i++)
+      if (positions[i].Size() == 0) direct.Append(i);
+
+    Array<SCAL> c(terms.Size());
+    Array<FlatVector<SCAL>> vals(terms.Size());
+    for (int i = 0; i < terms.Size(); i++) {
+      ToScalar (coefs[i], c[i]);
+      vals[i].AssignMemory (terms[i]->AsVector().FV<SCAL>().Size(),
+			    &terms[i]->AsVector().FV<SCAL>()(0));
+    }
+
+    ParallelFor (Range(nze), [&] (int j) {
+	SCAL v = 0.0;
+	for (int i : direct) v += c[i] * vals[i](j);
+	s(j) = v;
+      });
+
+    for (int i = 0; i < terms.Size(); i++) {
+      if (positions[i].Size() == 0) continue;
+      FlatArray<int> pos = positions[i];
+      ParallelFor (Range(pos.Size()), [&] (int j) {
+	  s(pos[j]) += c[i] * vals[i](j);
+	});
+    }
+  }
+}
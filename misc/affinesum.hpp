@@ -0,0 +1,66 @@
+#ifndef FILE_AFFINESUM_HPP
+#define FILE_AFFINESUM_HPP
+
+
+/* Sparse matrices depending affinely on parameters.
+
+   When the coefficients of a form depend on a parameter (e.g. the
+   frequency) only through scalar factors,
+
+       A(w) = sum_i  c_i(w) A_i,
+
+   the matrices A_i can be assembled once (each from the integrators
+   with that factor, on the same space) and A(w) formed for each new w
+   by one pass over the nonzero entries.
+
+   The result has the sparsity pattern of the first matrix A_0, and the
+   patterns of the other matrices must be contained in it (the patterns
+   of forms without volume integrators may be smaller).  Positions of
+   their entries in the result are computed once.
+
+   Integrators that add c M to one block and conj(c) M^T to the
+   transposed block (e.g. eyeeyeedge, xnbdry, with ind1 != ind2) are
+   not scaled correctly by a complex c. Assemble them with the factors
+   1 and 1j instead, and give Re(c) and Im(c) as coefficients.
+
+   Python (import libDPG):
+
+      A = libDPG.AffineSum([a0.mat, a1.mat, a2.mat])
+      A.Set([1, -k*k, k])          # A.mat = a0.mat - k*k a1.mat + k a2.mat
+      inv = A.mat.Inverse(fes.FreeDofs())
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class AffineSum {
+
+    Array<shared_ptr<BaseSparseMatrix>> terms;
+    shared_ptr<BaseSparseMatrix> sum;
+
+    // positions of the entries of terms[i] in sum (empty: same pattern)
+    Array<Array<int>> positions;
+
+  public:
+
+    AffineSum (const Array<shared_ptr<BaseSparseMatrix>> & aterms);
+
+    shared_ptr<BaseSparseMatrix> GetMatrix () const { return sum; }
+    int NumTerms () const { return terms.Size(); }
+
+    // sum = sum_i coefs[i] * terms[i]
+    void Set (FlatArray<Complex> coefs);
+
+  private:
+
+    template <class SCAL>
+    void T_Set (FlatArray<Complex> coefs);
+  };
+
+}
+
+#endif
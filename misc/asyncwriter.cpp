@@ -0,0 +1,105 @@
+#include <solve.hpp>
+#include <zlib.h>
+#include "asyncwriter.hpp"
+
+// See asyncwriter.hpp.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  AsyncWriter :: AsyncWriter (int alevel) : level(alevel) {
+
+    if (level < 0 || level > 9)
+      throw Exception ("AsyncWriter: gzip level must be 0..9");
+  }
+
+  AsyncWriter :: ~AsyncWriter () {
+
+    if (worker.joinable()) worker.join();
+  }
+
+
+  void AsyncWriter :: Wait () {
+
+    if (worker.joinable()) worker.join();
+    if (error.size()) {
+      string e = error;
+      error = "";
+      throw Exception (e);
+    }
+  }
+
+
+  void AsyncWriter :: Order (const GridFunction & gf) {
+
+    shared_ptr<FESpace> fes = gf.GetFESpace();
+    if (fes == orderfes && fes->GetNDof() == orderndof) return;
+
+    auto ma = fes->GetMeshAccess();
+    Array<int> dnums;
+    order.SetSize(0);
+    for (NODE_TYPE nt : { NT_VERTEX, NT_EDGE, NT_FACE, NT_CELL })
+      for (int i = 0; i < ma->GetNNodes(nt); i++) {
+	fes->GetDofNrs (NodeId(nt, i), dnums);
+	for (int d : dnums) order.Append (d);
+      }
+    orderfes = fes;
+    orderndof = fes->GetNDof();
+  }
+
+
+  void AsyncWriter :: Save (const GridFunction & gf, const string & filename) {
+
+    static Timer t("AsyncWriter::Save");
+    RegionTimer reg(t);
+
+    Order (gf);
+
+    // copy into the free buffer, while the other may still be written
+    const BaseVector & vec = gf.GetVector();
+    FlatVector<double> fv = vec.FVDouble();
+    int es = vec.EntrySize();
+    Array<double> & buf = buffers[current];
+    buf.SetSize (order.Size() * es);
+    ParallelFor (Range(order.Size()), [&] (int i) {
+	int d = order[i];
+	for (int k = 0; k < es; k++)
+	  buf[i*es+k] = (d >= 0) ? fv(d*es+k) : 0.0;
+      });
+
+    Wait ();
+    worker = std::thread ([this, filename] (int b) { Write (filename, b); },
+			  current);
+    current = 1 - current;
+  }
+
+
+  // runs in the worker thread
+  void AsyncWriter :: Write (const string & filename, int b) {
+
+    string mode = "wb" + ToString(level);
+    gzFile file = gzopen (filename.c_str(), mode.c_str());
+    if (!file) {
+      error = "AsyncWriter: cannot open " + filename;
+      return;
+    }
+    gzbuffer (file, 1 << 20);
+
+    // gzwrite takes an unsigned length: in pieces of 256 MB
+    const char * data = reinterpret_cast<const char*> (buffers[b].Addr(0));
+    size_t size = buffers[b].Size() * sizeof(double);
+    for (size_t pos = 0; pos < size; ) {
+      unsigned len = min2 (size - pos, size_t(1) << 28);
+      if (gzwrite (file, data+pos, len) != int(len)) {
+	error = "AsyncWriter: writing " + filename + " failed";
+	break;
+      }
+      pos += len;
+    }
+    if (gzclose (file) != Z_OK && error.empty())
+      error = "AsyncWriter: closing " + filename + " failed";
+  }
+
+}
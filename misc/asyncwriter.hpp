@@ -0,0 +1,69 @@
+#ifndef FILE_ASYNCWRITER_HPP
+#define FILE_ASYNCWRITER_HPP
+
+
+/* Snapshots of grid functions written in the background.
+
+   Save copies the vector of a grid function into one of two buffers
+   and returns; a background thread compresses the buffer (gzip) and
+   writes it to the file, while the caller (e.g. a PCG iteration)
+   continues. The next Save fills the other buffer and then waits only
+   if the previous file is not written yet. Wait (and the destructor)
+   waits for the last one.
+
+   The values are written in the order of GridFunction::Save (by
+   nodes, vertices first), so an uncompressed file can be read by
+   GridFunction.Load. Errors of the writing thread are thrown by the
+   next Save or Wait. Sequential (non-MPI) grid functions only.
+
+   Python (import libDPG):
+
+      writer = libDPG.AsyncWriter(level=1)     # gzip level, 1 = fastest
+      writer.Save(gf, "sol5.sol.gz")
+      ...
+      writer.Wait()
+
+   and later, after gunzip sol5.sol.gz:  gf.Load("sol5.sol")
+ */
+
+
+#include <solve.hpp>
+#include <thread>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class AsyncWriter {
+
+    int level;
+    Array<double> buffers[2];
+    int current = 0;                 // the buffer filled by the next Save
+    std::thread worker;
+    string error;                    // set by the worker
+
+    // positions in the vector, in the order of GridFunction::Save
+    // (-1: a dof number without value), for the space last seen
+    shared_ptr<FESpace> orderfes;
+    size_t orderndof = 0;
+    Array<int> order;
+
+  public:
+
+    AsyncWriter (int alevel = 1);
+    ~AsyncWriter ();
+
+    void Save (const GridFunction & gf, const string & filename);
+
+    // waits for the last file to be written
+    void Wait ();
+
+  private:
+
+    void Order (const GridFunction & gf);
+    void Write (const string & filename, int buf);
+  };
+
+}
+
+#endif
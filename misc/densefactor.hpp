@@ -0,0 +1,199 @@
+#ifndef FILE_DENSEFACTOR_HPP
+#define FILE_DENSEFACTOR_HPP
+
+
+/* Dense factorizations and triangular solves, shared by the element
+   condensation (dpgcondensation.hpp) and the patch solvers
+   (patchsolver.hpp).
+
+   The matrices are row major (FlatMatrix) and factored in place:
+
+     FactorCholesky   A = L L^*  in the lower triangle (the strict
+                      upper triangle is not touched), for Hermitian
+                      positive definite A; returns false otherwise
+     FactorLU         P A = L U  with partial pivoting, unit lower L
+
+   The Cholesky factorization and all solves are blocked: apart from
+   the work within the DenseBlock wide diagonal blocks and panels, they
+   are matrix products, evaluated by NGSolve's dense kernels. The
+   solves take the right hand sides as the columns of x (a vector is a
+   one column matrix); with factors in single precision, x is single
+   as well.
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  constexpr int DenseBlock = 32;
+
+  template <class T> inline T DConj (T x) { return x; }
+  template <class T> inline complex<T> DConj (complex<T> x) { return conj(x); }
+
+  template <class T> inline void ConjInPlace (SliceMatrix<T> x) { ; }
+  template <class T> inline void ConjInPlace (SliceMatrix<complex<T>> x) {
+    for (size_t i = 0; i < x.Height(); i++)
+      for (size_t j = 0; j < x.Width(); j++)
+	x(i,j) = conj(x(i,j));
+  }
+
+  // the right hand sides: T deduced from the factor only
+  template <class T> struct DenseRHS { typedef SliceMatrix<T> type; };
+
+  template <class T>
+  inline SliceMatrix<T> AsMatrix (FlatVector<T> x) {
+    return FlatMatrix<T> (x.Size(), 1, &x(0));
+  }
+
+
+  template <class T>
+  bool FactorCholesky (FlatMatrix<T> a) {
+
+    int n = a.Height();
+    const int nb = DenseBlock;
+    Matrix<T> lc(min2(nb, n), min2(nb, n));   // conjugated panel rows
+
+    for (int j0 = 0; j0 < n; j0 += nb) {
+      int j1 = min2(j0+nb, n);
+
+      // the diagonal block (earlier columns are subtracted already)
+      for (int j = j0; j < j1; j++) {
+	T d = a(j,j);
+	for (int k = j0; k < j; k++) d -= a(j,k) * DConj(a(j,k));
+	if (!(real(d) > 0)) return false;
+	auto ljj = sqrt(real(d));
+	a(j,j) = ljj;
+	for (int i = j+1; i < j1; i++) {
+	  T s = a(i,j);
+	  for (int k = j0; k < j; k++) s -= a(i,k) * DConj(a(j,k));
+	  a(i,j) = s / ljj;
+	}
+      }
+      if (j1 == n) break;
+
+      // the panel below:  A21 <- A21 L11^{-*}
+      for (int i = j1; i < n; i++)
+	for (int j = j0; j < j1; j++) {
+	  T s = a(i,j);
+	  for (int k = j0; k < j; k++) s -= a(i,k) * DConj(a(j,k));
+	  a(i,j) = s / a(j,j);
+	}
+
+      // the lower triangle of the rest:  A22 -= L21 L21^*, by block
+      // columns; products below the diagonal blocks
+      for (int c0 = j1; c0 < n; c0 += nb) {
+	int c1 = min2(c0+nb, n);
+	auto lcc = lc.Rows(0, c1-c0).Cols(0, j1-j0);
+	for (int i = c0; i < c1; i++)
+	  for (int k = j0; k < j1; k++)
+	    lcc(i-c0, k-j0) = DConj(a(i,k));
+	if (c1 < n)
+	  a.Rows(c1, n).Cols(c0, c1) -=
+	    a.Rows(c1, n).Cols(j0, j1) * Trans(lcc);
+	for (int i = c0; i < c1; i++)
+	  for (int j = c0; j <= i; j++) {
+	    T s = 0.0;
+	    for (int k = j0; k < j1; k++) s += a(i,k) * lcc(j-c0, k-j0);
+	    a(i,j) -= s;
+	  }
+      }
+    }
+    return true;
+  }
+
+
+  // P A = L U in place; throws if singular
+  template <class T>
+  void FactorLU (FlatMatrix<T> a, FlatArray<int> piv) {
+
+    int n = a.Height();
+    for (int j = 0; j < n; j++) {
+      int p = j;
+      for (int i = j+1; i < n; i++)
+	if (abs(a(i,j)) > abs(a(p,j))) p = i;
+      piv[j] = p;
+      if (p != j)
+	for (int k = 0; k < n; k++) swap (a(j,k), a(p,k));
+      if (a(j,j) == T(0.0))
+	throw Exception ("FactorLU: singular matrix");
+      T djj = T(1.0) / a(j,j);
+      for (int i = j+1; i < n; i++) a(i,j) *= djj;
+      if (j+1 < n)
+	a.Rows(j+1, n).Cols(j+1, n) -=
+	  a.Rows(j+1, n).Cols(j, j+1) * a.Rows(j, j+1).Cols(j+1, n);
+    }
+  }
+
+
+  // x <- L^{-1} x  (unit diagonal if unit)
+  template <class T>
+  void SolveLower (FlatMatrix<T> l, typename DenseRHS<T>::type x, bool unit = false) {
+
+    int n = l.Height();
+    for (int i0 = 0; i0 < n; i0 += DenseBlock) {
+      int i1 = min2(i0+DenseBlock, n);
+      if (i0 > 0)
+	x.Rows(i0, i1) -= l.Rows(i0, i1).Cols(0, i0) * x.Rows(0, i0);
+      for (int i = i0; i < i1; i++) {
+	for (int k = i0; k < i; k++) x.Row(i) -= l(i,k) * x.Row(k);
+	if (!unit) x.Row(i) *= T(1.0) / l(i,i);
+      }
+    }
+  }
+
+  // x <- U^{-1} x,  U the upper triangle of u
+  template <class T>
+  void SolveUpper (FlatMatrix<T> u, typename DenseRHS<T>::type x) {
+
+    int n = u.Height();
+    for (int i1 = n; i1 > 0; i1 -= DenseBlock) {
+      int i0 = max2(i1-DenseBlock, 0);
+      if (i1 < n)
+	x.Rows(i0, i1) -= u.Rows(i0, i1).Cols(i1, n) * x.Rows(i1, n);
+      for (int i = i1-1; i >= i0; i--) {
+	for (int k = i+1; k < i1; k++) x.Row(i) -= u(i,k) * x.Row(k);
+	x.Row(i) *= T(1.0) / u(i,i);
+      }
+    }
+  }
+
+  // x <- L^{-*} x,  as conj(L^{-T} conj(x))
+  template <class T>
+  void SolveLowerH (FlatMatrix<T> l, typename DenseRHS<T>::type x) {
+
+    int n = l.Height();
+    ConjInPlace (x);
+    for (int i1 = n; i1 > 0; i1 -= DenseBlock) {
+      int i0 = max2(i1-DenseBlock, 0);
+      if (i1 < n)
+	x.Rows(i0, i1) -= Trans(l.Rows(i1, n).Cols(i0, i1)) * x.Rows(i1, n);
+      for (int i = i1-1; i >= i0; i--) {
+	for (int k = i+1; k < i1; k++) x.Row(i) -= l(k,i) * x.Row(k);
+	x.Row(i) *= T(1.0) / l(i,i);
+      }
+    }
+    ConjInPlace (x);
+  }
+
+  // x <- A^{-1} x  from FactorCholesky (chol) or FactorLU
+  template <class T>
+  void SolveFactored (FlatMatrix<T> a, FlatArray<int> piv, bool chol,
+		      typename DenseRHS<T>::type x) {
+    if (chol) {
+      SolveLower (a, x);
+      SolveLowerH (a, x);
+      return;
+    }
+    for (int i = 0; i < a.Height(); i++)
+      if (piv[i] != i)
+	for (int j = 0; j < x.Width(); j++) swap (x(i,j), x(piv[i],j));
+    SolveLower (a, x, true);
+    SolveUpper (a, x);
+  }
+
+}
+
+#endif
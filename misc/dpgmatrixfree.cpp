@@ -0,0 +1,348 @@
+#include <solve.hpp>
+#include "dpgmatrixfree.hpp"
+
+// See dpgmatrixfree.hpp for what is computed here.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  //////////////////////////////////////////////////////////////
+  // The element matrix of a form split into external (e) and
+  // internal (i) dofs, the internal ones being LOCAL_DOFs.
+
+  template <class SCAL>
+  class CondensedElement {
+
+  public:
+
+    FlatArray<int> ext, inner;        // dof numbers
+    FlatMatrix<SCAL> s;               // A_ee - A_ei A_ii^{-1} A_ie
+    FlatMatrix<SCAL> aei, aie;
+    FlatMatrix<SCAL> aiiinv;          // A_ii^{-1}
+
+    CondensedElement (const BilinearForm & bfa, const FESpace & fes,
+		      ElementId ei, LocalHeap & lh) {
+
+      const FiniteElement & fel = fes.GetFE(ei, lh);
+      const ElementTransformation & eltrans =
+	fes.GetMeshAccess()->GetTrafo(ei, lh);
+      ArrayMem<int,100> dofs;
+      fes.GetDofNrs(ei, dofs);
+      int n = dofs.Size();
+
+      FlatMatrix<SCAL> elmat(n, n, lh), part(n, n, lh);
+      elmat = SCAL(0.0);
+      for (int k = 0; k < bfa.NumIntegrators(); k++) {
+	const BilinearFormIntegrator & bfi = *bfa.GetIntegrator(k);
+	if (bfi.VB() != ei.VB() || !bfi.DefinedOn(eltrans.GetElementIndex()))
+	  continue;
+	bfi.CalcElementMatrix(fel, eltrans, part, lh);
+	elmat += part;
+      }
+
+      // local positions of the external and internal dofs
+      int ne = 0, ni = 0;
+      for (int d : dofs)
+	if (d >= 0) {
+	  if (fes.GetDofCouplingType(d) == LOCAL_DOF) ni++; else ne++;
+	}
+      FlatArray<int> le(ne, lh), li(ni, lh);
+      ext.Assign(ne, lh);
+      inner.Assign(ni, lh);
+      ne = ni = 0;
+      for (int k = 0; k < n; k++) {
+	if (dofs[k] < 0) continue;
+	if (fes.GetDofCouplingType(dofs[k]) == LOCAL_DOF) {
+	  li[ni] = k;  inner[ni++] = dofs[k];
+	}
+	else {
+	  le[ne] = k;  ext[ne++] = dofs[k];
+	}
+      }
+
+      s.AssignMemory(ne, ne, lh);
+      aei.AssignMemory(ne, ni, lh);
+      aie.AssignMemory(ni, ne, lh);
+      aiiinv.AssignMemory(ni, ni, lh);
+      for (int k = 0; k < ne; k++) {
+	for (int l = 0; l < ne; l++) s(k,l) = elmat(le[k],le[l]);
+	for (int l = 0; l < ni; l++) aei(k,l) = elmat(le[k],li[l]);
+      }
+      for (int k = 0; k < ni; k++) {
+	for (int l = 0; l < ne; l++) aie(k,l) = elmat(li[k],le[l]);
+	for (int l = 0; l < ni; l++) aiiinv(k,l) = elmat(li[k],li[l]);
+      }
+      if (ni == 0) return;
+
+      CalcInverse (aiiinv);
+      FlatMatrix<SCAL> tmp(ni, ne, lh);
+      tmp = aiiinv * aie;
+      s -= aei * tmp;
+    }
+  };
+
+
+  // external dofs of element ei (as ordered in CondensedElement)
+  static void ExternalDofs (const FESpace & fes, ElementId ei,
+			    FlatArray<int> & ext, LocalHeap & lh) {
+
+    ArrayMem<int,100> dofs;
+    fes.GetDofNrs(ei, dofs);
+    int ne = 0;
+    for (int d : dofs)
+      if (d >= 0 && fes.GetDofCouplingType(d) != LOCAL_DOF) ne++;
+    ext.Assign(ne, lh);
+    ne = 0;
+    for (int d : dofs)
+      if (d >= 0 && fes.GetDofCouplingType(d) != LOCAL_DOF) ext[ne++] = d;
+  }
+
+
+
+  DPGMatrixFree :: DPGMatrixFree (shared_ptr<BilinearForm> abfa, bool acache,
+				  size_t aheapsize, bool asingle)
+    : bfa(abfa), fes(abfa->GetFESpace()), cache(acache), single(asingle),
+      heapsize(aheapsize) {
+
+    if (single && !cache)
+      throw Exception ("DPGMatrixFree: single precision needs the cache");
+
+    for (int i = 0; i < bfa->NumIntegrators(); i++)
+      if (bfa->GetIntegrator(i)->SkeletonForm())
+	throw Exception ("DPGMatrixFree: skeleton integrators are not "
+			 "supported");
+
+    // once: heapsize for each thread, mapped for the lifetime
+    heap = unique_ptr<LocalHeap> (new LocalHeap (heapsize, "dpgmatrixfree",
+						  true));
+
+    cout << "DPG matrix-free operator using " << bfa->NumIntegrators()
+	 << " integrators" << (cache ? ", caching element matrices" : "")
+	 << (single ? " in single precision" : "") << endl;
+    Update();
+  }
+
+
+  void DPGMatrixFree :: Update () {
+
+    if (fes->IsComplex())
+      T_Update<Complex> ();
+    else
+      T_Update<double> ();
+  }
+
+  template <class SCAL>
+  void DPGMatrixFree :: T_Update () {
+
+    for (int ivb = 0; ivb < 2; ivb++) {
+      first[ivb].SetSize(0);
+      data[ivb].SetSize(0);
+      sdata[ivb].SetSize(0);
+    }
+    if (!cache) return;
+
+    static Timer t("DPGMatrixFree::Update");
+    RegionTimer reg(t);
+
+    LocalHeap & lh = *heap;
+    HeapReset hr(lh);
+    auto ma = fes->GetMeshAccess();
+    int nd = sizeof(SCAL)/sizeof(double);
+
+    for (int ivb = 0; ivb < 2; ivb++) {
+
+      VorB vb = (ivb == 0) ? VOL : BND;
+      int ne = ma->GetNE(vb);
+      first[ivb].SetSize(ne+1);
+      first[ivb][0] = 0;
+      for (int i = 0; i < ne; i++) {
+	HeapReset hr(lh);
+	FlatArray<int> ext;
+	ExternalDofs(*fes, ElementId(vb, i), ext, lh);
+	first[ivb][i+1] = first[ivb][i] + nd * ext.Size() * ext.Size();
+      }
+      if (single)
+	sdata[ivb].SetSize(first[ivb][ne]);
+      else
+	data[ivb].SetSize(first[ivb][ne]);
+
+      IterateElements
+	(*fes, vb, lh,
+	 [&] (FESpace::Element el, LocalHeap & lh) {
+	  CondensedElement<SCAL> c(*bfa, *fes, el, lh);
+	  int n = c.ext.Size();
+	  if (n == 0) return;
+	  if (single) {
+	    FlatVector<double> sd(nd*n*n, reinterpret_cast<double*>(c.s.Data()));
+	    float * store = &sdata[ivb][first[ivb][el.Nr()]];
+	    for (int k = 0; k < sd.Size(); k++) store[k] = sd(k);
+	    return;
+	  }
+	  FlatMatrix<SCAL> store(n, n, reinterpret_cast<SCAL*>
+				 (&data[ivb][first[ivb][el.Nr()]]));
+	  store = c.s;
+	});
+    }
+
+    cout << "DPGMatrixFree: cached " << first[0].Last() + first[1].Last()
+	 << (single ? " floats" : " doubles") << endl;
+  }
+
+
+  template <class SCAL>
+  FlatMatrix<SCAL> DPGMatrixFree ::
+  ElementSchur (ElementId ei, FlatArray<int> & extdofs, LocalHeap & lh) const {
+
+    if (cache) {
+      int ivb = (ei.VB() == VOL) ? 0 : 1;
+      ExternalDofs(*fes, ei, extdofs, lh);
+      int n = extdofs.Size();
+      if (n == 0) return FlatMatrix<SCAL> (0, 0, lh);
+      if (single) {
+	FlatMatrix<SCAL> s(n, n, lh);
+	FlatVector<double> sd(sizeof(SCAL)/sizeof(double)*n*n,
+			      reinterpret_cast<double*>(s.Data()));
+	const float * store = &sdata[ivb][first[ivb][ei.Nr()]];
+	for (int k = 0; k < sd.Size(); k++) sd(k) = store[k];
+	return s;
+      }
+      return FlatMatrix<SCAL> (n, n, reinterpret_cast<SCAL*>
+			       (const_cast<double*>
+				(&data[ivb][first[ivb][ei.Nr()]])));
+    }
+
+    CondensedElement<SCAL> c(*bfa, *fes, ei, lh);
+    extdofs.Assign(c.ext.Size(), lh);
+    extdofs = c.ext;
+    return c.s;
+  }
+
+
+  AutoVector DPGMatrixFree :: CreateVector () const {
+
+    if (IsComplex())
+      return make_shared<VVector<Complex>> (VHeight());
+    return make_shared<VVector<double>> (VHeight());
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  y += s * sum over elements of S x
+
+  template <class SCAL>
+  void DPGMatrixFree ::
+  T_MultAdd (SCAL s, const BaseVector & x, BaseVector & y) const {
+
+    static Timer t("DPGMatrixFree::MultAdd");
+    RegionTimer reg(t);
+
+    LocalHeap & lh = *heap;
+    HeapReset hr(lh);
+
+    for (VorB vb : { VOL, BND })
+      IterateElements
+	(*fes, vb, lh,
+	 [&] (FESpace::Element el, LocalHeap & lh) {
+	  FlatArray<int> ext;
+	  FlatMatrix<SCAL> schur = ElementSchur<SCAL> (el, ext, lh);
+	  int n = ext.Size();
+	  if (n == 0) return;
+	  FlatVector<SCAL> xe(n, lh), ye(n, lh);
+	  x.GetIndirect(ext, xe);
+	  ye = s * (schur * xe);
+	  y.AddIndirect(ext, ye);
+	});
+  }
+
+  void DPGMatrixFree :: Mult (const BaseVector & x, BaseVector & y) const {
+    y = 0.0;
+    MultAdd (1.0, x, y);
+  }
+
+  void DPGMatrixFree ::
+  MultAdd (double s, const BaseVector & x, BaseVector & y) const {
+    if (IsComplex())
+      T_MultAdd<Complex> (s, x, y);
+    else
+      T_MultAdd<double> (s, x, y);
+  }
+
+  void DPGMatrixFree ::
+  MultAdd (Complex s, const BaseVector & x, BaseVector & y) const {
+    if (!IsComplex())
+      throw Exception ("DPGMatrixFree: complex scaling of a real operator");
+    T_MultAdd<Complex> (s, x, y);
+  }
+
+
+  //////////////////////////////////////////////////////////////
+  //  mode 0:  u_i += -A_ii^{-1} A_ie u_e    (harmonic extension)
+  //  mode 1:  f_e += -A_ei A_ii^{-1} f_i    (its transpose)
+  //  mode 2:  u_i +=  A_ii^{-1} f_i         (inner solve)
+
+  template <class SCAL>
+  void DPGMatrixFree ::
+  T_Extend (int mode, const BaseVector & f, BaseVector & u) const {
+
+    LocalHeap & lh = *heap;
+    HeapReset hr(lh);
+
+    for (VorB vb : { VOL, BND })
+      IterateElements
+	(*fes, vb, lh,
+	 [&] (FESpace::Element el, LocalHeap & lh) {
+
+	  CondensedElement<SCAL> c(*bfa, *fes, el, lh);
+	  int ne = c.ext.Size();
+	  int ni = c.inner.Size();
+	  if (ni == 0) return;
+
+	  FlatVector<SCAL> fi(ni, lh), ui(ni, lh);
+	  switch (mode) {
+	  case 0: {
+	    FlatVector<SCAL> ue(ne, lh);
+	    u.GetIndirect(c.ext, ue);
+	    fi = c.aie * ue;
+	    ui = -(c.aiiinv * fi);
+	    u.AddIndirect(c.inner, ui);
+	    break;
+	  }
+	  case 1: {
+	    FlatVector<SCAL> fe(ne, lh);
+	    u.GetIndirect(c.inner, fi);
+	    ui = c.aiiinv * fi;
+	    fe = -(c.aei * ui);
+	    u.AddIndirect(c.ext, fe);
+	    break;
+	  }
+	  default:
+	    f.GetIndirect(c.inner, fi);
+	    ui = c.aiiinv * fi;
+	    u.AddIndirect(c.inner, ui);
+	  }
+	});
+  }
+
+  void DPGMatrixFree :: Extend (BaseVector & u) const {
+    if (IsComplex()) T_Extend<Complex> (0, u, u);
+    else T_Extend<double> (0, u, u);
+  }
+
+  void DPGMatrixFree :: ExtendTrans (BaseVector & f) const {
+    if (IsComplex()) T_Extend<Complex> (1, f, f);
+    else T_Extend<double> (1, f, f);
+  }
+
+  void DPGMatrixFree :: InnerSolve (const BaseVector & f, BaseVector & u) const {
+    if (IsComplex()) T_Extend<Complex> (2, f, u);
+    else T_Extend<double> (2, f, u);
+  }
+
+
+  template FlatMatrix<double> DPGMatrixFree::ElementSchur<double>
+  (ElementId, FlatArray<int> &, LocalHeap &) const;
+  template FlatMatrix<Complex> DPGMatrixFree::ElementSchur<Complex>
+  (ElementId, FlatArray<int> &, LocalHeap &) const;
+}
@@ -0,0 +1,108 @@
+#ifndef FILE_DPGMATRIXFREE_HPP
+#define FILE_DPGMATRIXFREE_HPP
+
+
+/* The statically condensed DPG system without assembled matrices.
+
+   With "eliminate_internal", assembling a DPG form stores the
+   condensed matrix on the external (interface) dofs, and the
+   harmonic_extension, harmonic_extension_trans and inner_solve
+   matrices. For large problems these take most of the memory.
+
+   DPGMatrixFree applies the same operators element by element from
+   the integrators of the (unassembled) form:  per element, with the
+   dofs split into internal (LOCAL_DOF) and external ones,
+
+       S  = A_ee - A_ei A_ii^{-1} A_ie
+
+   is added to the result in Mult, and A_ii^{-1}, A_ei, A_ie give the
+   extension and inner solve operators. With cache = true the element
+   matrices S (only) are computed once and kept (which is still much
+   less than the assembled matrices); otherwise all of it is recomputed
+   in every application, trading flops for memory. With single = true
+   the cached matrices are stored in single precision, halving the
+   memory traffic of Mult; use it as the inner operator of an iterative
+   refinement (refine() in projects/pyutils/refine.py) whose residuals
+   are computed with a double precision operator.
+
+   Python (import libDPG):
+
+      A = libDPG.DPGMatrixFree(a, cache=False)
+      A.ExtendTrans(f.vec)          # f += harmonic_extension_trans * f
+      u.vec.data = pcg(A, B, f.vec)
+      A.Extend(u.vec)               # u += harmonic_extension * u
+      A.InnerSolve(f.vec, u.vec)    # u += inner_solve * f
+
+   and VertexPatchSchwarz can build its patch matrices from it
+   (see vertexschwarz.hpp).
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  class DPGMatrixFree : public BaseMatrix {
+
+    shared_ptr<BilinearForm> bfa;
+    shared_ptr<FESpace> fes;
+    bool cache;
+    bool single;          // cache in single precision
+    size_t heapsize;      // of the LocalHeap split among the threads
+    unique_ptr<LocalHeap> heap;   // allocated once, for all applications
+
+    // cached S of each element of VOL (0) and BND (1), stored by rows
+    // of doubles (two per Complex) from first[vb][el], or of floats
+    Array<size_t> first[2];
+    Array<double> data[2];
+    Array<float> sdata[2];
+
+  public:
+
+    DPGMatrixFree (shared_ptr<BilinearForm> abfa, bool acache = false,
+		   size_t aheapsize = 10000000, bool asingle = false);
+
+    // recompute the cache after a change of mesh, space or coefficients
+    void Update ();
+
+    shared_ptr<BilinearForm> GetBilinearForm () const { return bfa; }
+    shared_ptr<FESpace> GetFESpace () const { return fes; }
+
+    virtual bool IsComplex () const { return fes->IsComplex(); }
+    virtual int VHeight () const { return fes->GetNDof(); }
+    virtual int VWidth () const { return fes->GetNDof(); }
+    virtual AutoVector CreateVector () const;
+
+    virtual void Mult (const BaseVector & x, BaseVector & y) const;
+    virtual void MultAdd (double s, const BaseVector & x, BaseVector & y) const;
+    virtual void MultAdd (Complex s, const BaseVector & x, BaseVector & y) const;
+
+    // u += harmonic_extension * u
+    void Extend (BaseVector & u) const;
+    // f += harmonic_extension_trans * f
+    void ExtendTrans (BaseVector & f) const;
+    // u += inner_solve * f
+    void InnerSolve (const BaseVector & f, BaseVector & u) const;
+
+    // S and the external dofs of element ei (from the cache if kept)
+    template <class SCAL>
+    FlatMatrix<SCAL> ElementSchur (ElementId ei, FlatArray<int> & extdofs,
+				   LocalHeap & lh) const;
+
+  private:
+
+    template <class SCAL>
+    void T_MultAdd (SCAL s, const BaseVector & x, BaseVector & y) const;
+
+    template <class SCAL>
+    void T_Extend (int mode, const BaseVector & f, BaseVector & u) const;
+
+    template <class SCAL>
+    void T_Update ();
+  };
+
+}
+
+#endif
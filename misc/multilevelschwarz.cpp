@@ -0,0 +1,196 @@
+// See multilevelschwarz.hpp for a description.
+
+
+#include <solve.hpp>
+#include "multilevelschwarz.hpp"
+
+
+namespace ngcomp  {
+
+  MultilevelSchwarz ::
+  MultilevelSchwarz (const PDE & pde, const Flags & flags,
+		     const string & aname)
+    : Preconditioner (&pde, flags, aname), smootherflags(flags)  {
+
+    coarsesmooth = flags.GetDefineFlag("coarsesmooth");
+    globalsmooth = flags.GetDefineFlag("globalsmooth");
+    // the smoothers of the levels are updated here only
+    smootherflags.SetFlag ("not_register_for_auto_update");
+
+    cout << endl << "Constructor of MultilevelSchwarz" ;
+
+    bfa = pde.GetBilinearForm (flags.GetStringFlag ("bilinearform", ""));
+  }
+
+  MultilevelSchwarz ::
+  MultilevelSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
+		     const string aname)
+    : Preconditioner (abfa, aflags, aname), smootherflags(aflags)  {
+
+    coarsesmooth = flags.GetDefineFlag("coarsesmooth");
+    globalsmooth = flags.GetDefineFlag("globalsmooth");
+    smootherflags.SetFlag ("not_register_for_auto_update");
+
+    cout << endl << "Constructor of MultilevelSchwarz" ;
+
+    bfa = abfa;
+  }
+
+
+  void MultilevelSchwarz :: Update()  {
+
+    shared_ptr<FESpace> fes = bfa->GetFESpace();
+    int meshlevel = ma->GetNLevels()-1;
+
+    // reassembled on the same mesh: replace the level
+    if (levels.Size() && levels.Last().meshlevel == meshlevel)
+      levels.SetSize (levels.Size()-1);
+    // a mesh was skipped: no prolongation from the last level
+    if (levels.Size() && levels.Last().meshlevel != meshlevel-1) {
+      cout << endl << "MultilevelSchwarz: levels not consecutive, restarting"
+	   << endl;
+      levels.SetSize (0);
+    }
+    if (levels.Size() && !fes->GetProlongation())
+      throw Exception ("MultilevelSchwarz: the space has no prolongation");
+
+    Level lev;
+    lev.meshlevel = meshlevel;
+    lev.nv = ma->GetNV();
+    lev.mat = bfa->GetMatrixPtr();
+    lev.freedofs = fes->GetFreeDofs (bfa->UsesEliminateInternal());
+
+    auto smoother = [&] (shared_ptr<BitArray> active)  {
+      auto s = make_shared<VertexPatchSchwarz> (bfa, smootherflags,
+						"mlschwarz smoother");
+      s->SetActiveVertices (active);
+      s->Update();
+      return s;
+    };
+
+    if (levels.Size() == 0 && !coarsesmooth)
+      lev.inverse = lev.mat->InverseMatrix (lev.freedofs);
+    else if (levels.Size() == 0 || globalsmooth)
+      lev.smoother = smoother (nullptr);
+    else {
+      auto active = RefinedVertices (levels.Last().nv);
+      cout << endl << "MultilevelSchwarz: local smoothing on "
+	   << active->NumSet() << " of " << lev.nv << " vertices" << endl;
+      lev.smoother = smoother (active);
+      lev.full = smoother (nullptr);
+    }
+    // the previous finest level smooths locally from now on
+    if (levels.Size()) levels.Last().full = nullptr;
+    levels.Append (lev);
+
+    cout << endl << "MultilevelSchwarz: " << levels.Size() << " levels, "
+	 << "ndof = " << lev.mat->VHeight() << endl;
+
+    if (test) Test();
+  }
+
+
+  /*
+    Netgen's refinement keeps the vertex numbers and appends the new
+    vertices. The elements with a new vertex are the refined ones; the
+    patches of their vertices changed, all other patch matrices are
+    those of the previous mesh.
+  */
+
+  shared_ptr<BitArray> MultilevelSchwarz ::
+  RefinedVertices (int nvcoarse) const  {
+
+    auto active = make_shared<BitArray> (ma->GetNV());
+    active->Clear();
+    for (int i = 0; i < ma->GetNE(); i++) {
+      auto pnums = ma->GetElVertices (ElementId(VOL, i));
+      bool refined = false;
+      for (int v : pnums)
+	if (v >= nvcoarse) refined = true;
+      if (refined)
+	for (int v : pnums) active->Set (v);
+    }
+    return active;
+  }
+
+
+  // zero the entries of non-free dofs
+  static void SetFree (BaseVector & v, const BitArray & freedofs)  {
+
+    FlatVector<double> fv = v.FVDouble();
+    int es = v.EntrySize();
+    for (int i = 0; i < freedofs.Size(); i++)
+      if (!freedofs.Test(i))
+	fv.Range (i*es, (i+1)*es) = 0.0;
+  }
+
+
+  void MultilevelSchwarz ::
+  Cycle (int l, const BaseVector & f, BaseVector & u) const  {
+
+    const Level & lev = levels[l];
+
+    if (lev.inverse) {
+      lev.inverse->Mult (f, u);
+      return;
+    }
+
+    // all patches on the finest level, the local ones below
+    const VertexPatchSchwarz & smoother =
+      lev.full ? *lev.full : *lev.smoother;
+
+    if (l == 0) {
+      smoother.Mult (f, u);
+      return;
+    }
+
+    auto r = f.CreateVector();
+    auto w = f.CreateVector();
+
+    smoother.Mult (f, u);
+
+    *r = f - (*lev.mat) * u;
+    CoarseCorrection (l, *r, *w);
+    u += *w;
+
+    *r = f - (*lev.mat) * u;
+    smoother.Mult (*r, *w);
+    u += *w;
+  }
+
+
+  void MultilevelSchwarz ::
+  CoarseCorrection (int l, const BaseVector & r, BaseVector & w) const  {
+
+    static Timer t("MultilevelSchwarz::CoarseCorrection");
+    RegionTimer reg(t);
+
+    const Level & fine = levels[l];
+    const Level & coarse = levels[l-1];
+    auto prol = bfa->GetFESpace()->GetProlongation();
+    int es = r.EntrySize();
+    int nc = coarse.mat->VHeight();
+
+    // the coarse values are the first ones of a fine vector
+    w = r;
+    SetFree (w, *fine.freedofs);
+    prol->RestrictInline (fine.meshlevel, w);
+
+    auto rc = coarse.mat->CreateVector();
+    auto wc = coarse.mat->CreateVector();
+    rc->FVDouble() = w.FVDouble().Range (0, nc*es);
+    SetFree (*rc, *coarse.freedofs);
+
+    Cycle (l-1, *rc, *wc);
+
+    w = 0.0;
+    w.FVDouble().Range (0, nc*es) = wc->FVDouble();
+    prol->ProlongateInline (fine.meshlevel, w);
+    SetFree (w, *fine.freedofs);
+  }
+
+
+  static RegisterPreconditioner<MultilevelSchwarz>
+  initmlschwarz ("mlschwarz");
+
+}
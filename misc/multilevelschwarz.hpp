@@ -0,0 +1,106 @@
+#ifndef FILE_MULTILEVELSCHWARZ_HPP
+#define FILE_MULTILEVELSCHWARZ_HPP
+
+/*
+
+  A multilevel (V-cycle) preconditioner on the refinement hierarchy of
+  an adaptive loop, with the vertex patch smoothers of vertexschwarz.hpp.
+
+  Each Update (after mesh.Refine(), the space update and assembly) adds
+  a level: the assembled matrix, its free dofs and VertexPatchSchwarz
+  smoothers are kept, and the levels of the earlier meshes are reused.
+  The coarsest level (the first assembled mesh) is solved by a sparse
+  direct factor, or smoothed like the others with the flag
+  "coarsesmooth".
+
+  Below the finest level the smoothing is local: only the patches of
+  the vertices of elements with a new vertex (the vertices whose
+  patch matrix changed by the refinement) are smoothed, so that a
+  cycle costs patch solves in proportion to the refined regions, not
+  to the number of levels times the dofs. The finest level has a
+  smoother on all patches as well, which smooths the high order dofs
+  the prolongations do not reach; it is dropped when the next level is
+  added. (The residuals and transfers are still computed on all dofs
+  of a level.) With the flag "globalsmooth" all levels keep smoothing
+  all patches. One cycle on level l is
+
+    u  = S_l f                            (symmetric patch sweeps)
+    u += P_l B_{l-1} P_l^T (f - A_l u)    (coarse correction)
+    u += S_l (f - A_l u)
+
+  where P_l is the prolongation of the space from the previous mesh.
+  The cycle is symmetric. NGSolve's prolongations act on the low order
+  (vertex, lowest-order edge) dofs, so the coarse levels correct the
+  low order part, and the patch smoothers the rest.
+
+  The levels must come from consecutive meshes; a skipped mesh (no
+  assembly on it) restarts the hierarchy. The space (all components)
+  must provide a prolongation. Other flags (e.g. "sequential",
+  "single") are passed to the smoothers. The colored (parallel) patch
+  sweeps need a nonsymmetric matrix (BilinearForm(symmetric=False)).
+
+  Python: c = Preconditioner(a, "mlschwarz") before the adaptive loop.
+
+*/
+
+
+#include <solve.hpp>
+#include "vertexschwarz.hpp"
+
+
+namespace ngcomp  {
+
+  class MultilevelSchwarz : public Preconditioner  {
+
+    shared_ptr<BilinearForm> bfa;
+    Flags smootherflags;
+    bool coarsesmooth = false;
+    bool globalsmooth = false;
+
+    struct Level {
+      int meshlevel;
+      int nv;                                    // vertices of the mesh
+      shared_ptr<BaseMatrix> mat;
+      shared_ptr<BitArray> freedofs;
+      shared_ptr<VertexPatchSchwarz> smoother;   // local, or, on the coarsest,
+      shared_ptr<BaseMatrix> inverse;            // a direct solve
+      shared_ptr<VertexPatchSchwarz> full;       // all patches, finest only
+    };
+
+    Array<Level> levels;
+
+  public:
+
+    MultilevelSchwarz (const PDE & pde, const Flags & flags,
+		       const string & aname);
+    MultilevelSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
+		       const string aname = "mlschwarz");
+
+    virtual void Update();
+
+    virtual int VHeight() const { return GetAMatrix().VHeight(); }
+
+    virtual int VWidth() const { return GetAMatrix().VWidth(); }
+
+    virtual void Mult (const BaseVector & f, BaseVector & u) const  {
+      Cycle (levels.Size()-1, f, u);
+    }
+
+    virtual const BaseMatrix & GetAMatrix() const  {
+      return *levels.Last().mat;
+    }
+
+  private:
+
+    // the vertices of the elements with a vertex new on this mesh
+    shared_ptr<BitArray> RefinedVertices (int nvcoarse) const;
+
+    void Cycle (int l, const BaseVector & f, BaseVector & u) const;
+
+    // w = P_l B_{l-1} P_l^T r
+    void CoarseCorrection (int l, const BaseVector & r, BaseVector & w) const;
+  };
+
+}
+
+#endif
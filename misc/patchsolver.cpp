@@ -0,0 +1,228 @@
+#include <solve.hpp>
+#include <unordered_map>
+#include "patchsolver.hpp"
+#include "densefactor.hpp"
+
+// See patchsolver.hpp.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  template <class SCAL>
+  PatchSolver<SCAL> :: PatchSolver (FlatArray<int> sizes, bool asingle,
+				    bool areusable)
+    : single(asingle), reusable(areusable) {
+
+    int nmax = 0;
+    for (int n : sizes) nmax = max2(nmax, n);
+
+    // group number of each block size, in order of size
+    Array<int> groupof(nmax+1);
+    groupof = -1;
+    for (int n : sizes) groupof[n] = 0;
+    int ng = 0;
+    for (int n = 0; n <= nmax; n++)
+      if (groupof[n] == 0) groupof[n] = ng++;
+
+    groups.SetSize(ng);
+    for (int n = 0; n <= nmax; n++)
+      if (groupof[n] >= 0) {
+	groups[groupof[n]].n = n;
+	groups[groupof[n]].nblocks = 0;
+      }
+
+    group.SetSize(sizes.Size());
+    pos.SetSize(sizes.Size());
+    for (int b = 0; b < sizes.Size(); b++) {
+      group[b] = groupof[sizes[b]];
+      pos[b] = groups[group[b]].nblocks++;
+    }
+
+    for (Group & g : groups) {
+      g.data.SetSize(size_t(g.nblocks)*g.n*g.n);
+      g.data = SCAL(0.0);
+      g.piv.SetSize(size_t(g.nblocks)*g.n);
+      g.chol.SetSize(g.nblocks);
+    }
+  }
+
+
+  template <class SCAL>
+  static bool IsHermitian (FlatMatrix<SCAL> a) {
+
+    int n = a.Height();
+    for (int i = 0; i < n; i++) {
+      if (abs(imag(a(i,i))) > 1e-12 * abs(a(i,i)))
+	return false;
+      for (int j = 0; j < i; j++)
+	if (abs(a(i,j) - Conj(a(j,i))) > 1e-12 * (abs(a(i,i)) + abs(a(j,j))))
+	  return false;
+    }
+    return true;
+  }
+
+  // Hermitian A = L L^* (densefactor.hpp); if A is not positive
+  // definite, A is restored (from its upper triangle) and false returned
+  template <class SCAL>
+  static bool FactorPatchCholesky (FlatMatrix<SCAL> a) {
+
+    int n = a.Height();
+    VectorMem<100,SCAL> diag(n);
+    for (int j = 0; j < n; j++) diag(j) = a(j,j);
+
+    if (FactorCholesky (a)) return true;
+    for (int i = 0; i < n; i++) {
+      a(i,i) = diag(i);
+      for (int k = 0; k < i; k++) a(i,k) = Conj(a(k,i));
+    }
+    return false;
+  }
+
+
+  // the entries relative to the largest, to about 12 digits
+  template <class SCAL, class FUNC>
+  static void RoundedEntries (FlatMatrix<SCAL> a, FUNC func) {
+
+    double scale = 0;
+    for (int i = 0; i < a.Height(); i++)
+      for (int j = 0; j < a.Width(); j++)
+	scale = max2(scale, abs(a(i,j)));
+
+    auto round = [&] (double x) -> long long {
+      return scale > 0 ? llround (x / scale * 1e12) : 0;
+    };
+    for (int i = 0; i < a.Height(); i++)
+      for (int j = 0; j < a.Width(); j++) {
+	func (round (real(a(i,j))));
+	func (round (imag(a(i,j))));
+      }
+  }
+
+  // hash of the size and the rounded entries
+  template <class SCAL>
+  static size_t BlockKey (FlatMatrix<SCAL> a) {
+
+    size_t hash = a.Height();
+    RoundedEntries (a, [&] (long long q) {
+	hash ^= std::hash<long long>()(q) + 0x9e3779b97f4a7c15 + (hash<<6) + (hash>>2);
+      });
+    return hash;
+  }
+
+  // the same rounded entries (the keys may collide)
+  template <class SCAL>
+  static bool SameBlock (FlatMatrix<SCAL> a, FlatMatrix<SCAL> b) {
+
+    if (a.Height() != b.Height()) return false;
+    Array<long long> qa;
+    RoundedEntries (a, [&] (long long q) { qa.Append (q); });
+    size_t i = 0;
+    bool same = true;
+    RoundedEntries (b, [&] (long long q) { same = same && qa[i++] == q; });
+    return same;
+  }
+
+
+  template <class SCAL>
+  void PatchSolver<SCAL> :: Factor (const PatchSolver<SCAL> * previous) {
+
+    static Timer t("PatchSolver::Factor");
+    RegionTimer reg(t);
+
+    int nblocks = group.Size();
+    keys.SetSize(nblocks);
+    ParallelFor (Range(nblocks), [&] (int b) {
+	keys[b] = BlockKey (GetMatrix(b));
+      });
+
+    // keep the unfactored blocks, for a later Factor(this)
+    if (reusable)
+      for (Group & g : groups) g.original = g.data;
+
+    // the block of previous with the same key, if any
+    Array<int> from(nblocks);
+    from = -1;
+    if (previous && previous->reusable && previous->keys.Size()) {
+      std::unordered_map<size_t, int> prevblock;
+      for (int b = 0; b < previous->keys.Size(); b++)
+	prevblock[previous->keys[b]] = b;
+      for (int b = 0; b < nblocks; b++) {
+	auto it = prevblock.find(keys[b]);
+	if (it != prevblock.end() &&
+	    previous->groups[previous->group[it->second]].n == groups[group[b]].n)
+	  from[b] = it->second;
+      }
+    }
+
+    atomic<size_t> nreused{0};
+    ParallelFor (Range(nblocks), [&] (int b) {
+	Group & g = groups[group[b]];
+	int n = g.n;
+	if (n == 0) return;
+	size_t k = pos[b];
+	FlatMatrix<SCAL> a(n, n, &g.data[k*n*n]);
+	FlatArray<int> piv(n, &g.piv[k*n]);
+
+	const Group * pg = nullptr;
+	size_t pk = 0;
+	if (from[b] >= 0) {
+	  pg = &previous->groups[previous->group[from[b]]];
+	  pk = previous->pos[from[b]];
+	  FlatMatrix<SCAL> pa(n, n, const_cast<SCAL*> (&pg->original[pk*n*n]));
+	  if (!SameBlock (pa, a)) pg = nullptr;
+	}
+
+	if (pg) {
+	  // copy the factors (widened, if single: narrowing is exact)
+	  for (size_t i = 0; i < size_t(n)*n; i++)
+	    g.data[k*n*n+i] =
+	      previous->single ? SCAL(pg->sdata[pk*n*n+i]) : pg->data[pk*n*n+i];
+	  for (int i = 0; i < n; i++) piv[i] = pg->piv[pk*n+i];
+	  g.chol[k] = pg->chol[pk];
+	  nreused++;
+	  return;
+	}
+
+	g.chol[k] = IsHermitian (a) && FactorPatchCholesky (a);
+	if (!g.chol[k])
+	  FactorLU (a, piv);
+      });
+    reused = nreused;
+
+    if (single)
+      for (Group & g : groups) {
+	g.sdata.SetSize(g.data.Size());
+	for (size_t i = 0; i < g.data.Size(); i++) g.sdata[i] = TF(g.data[i]);
+	g.data = Array<SCAL>();
+      }
+  }
+
+
+  template <class SCAL>
+  void PatchSolver<SCAL> :: Solve (int b, FlatVector<SCAL> x) const {
+
+    const Group & g = groups[group[b]];
+    if (g.n == 0) return;
+    size_t k = pos[b];
+    size_t offset = k*g.n*g.n;
+    FlatArray<int> piv(g.n, const_cast<int*> (&g.piv[k*g.n]));
+    if (single) {
+      // solve in single precision, with the factors as they are stored
+      VectorMem<100,TF> xs(g.n);
+      for (int i = 0; i < g.n; i++) xs(i) = TF(x(i));
+      FlatMatrix<TF> a(g.n, g.n, const_cast<TF*> (&g.sdata[offset]));
+      SolveFactored (a, piv, g.chol[k], AsMatrix<TF> (xs));
+      for (int i = 0; i < g.n; i++) x(i) = SCAL(xs(i));
+    }
+    else {
+      FlatMatrix<SCAL> a(g.n, g.n, const_cast<SCAL*> (&g.data[offset]));
+      SolveFactored (a, piv, g.chol[k], AsMatrix (x));
+    }
+  }
+
+
+  template class PatchSolver<double>;
+  template class PatchSolver<Complex>;
+}
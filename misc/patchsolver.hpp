@@ -0,0 +1,92 @@
+#ifndef FILE_PATCHSOLVER_HPP
+#define FILE_PATCHSOLVER_HPP
+
+
+/* Dense factorizations of many small patch matrices.
+
+   The patch (block) matrices of a Schwarz preconditioner are kept in
+   contiguous storage, grouped by size: all n x n blocks of a group lie
+   one after the other (row major), so that factoring and solving runs
+   through memory in order, and no allocation per block is needed.
+
+   Each block is factored in place, once:
+
+     Cholesky  A = L L^*      if A is Hermitian and positive definite
+                              (the usual case for DPG), else
+     LU        P A = L U      with partial pivoting.
+
+   The factorizations and the solves are those of densefactor.hpp. A
+   solve is a forward and a backward substitution (the same flops as
+   multiplying with an inverse, but the setup is a third of the cost
+   of inverting). With single = true the factors are stored in single
+   precision and the solves run in single precision (half the memory
+   traffic); only the right hand side is converted.
+
+   Factor(previous) reuses the factors of the solver of an earlier setup
+   (e.g. before a local mesh refinement) for blocks whose matrix is the
+   same: blocks are keyed by a hash of their size and entries (relative
+   to the largest one, to about 12 digits, as the assembly may sum in a
+   different order), and a block with a matching key is compared entry
+   by entry with the unfactored block kept by the previous solver. Dof
+   numbers may change between setups; a block whose dofs are ordered
+   differently is just factored again. Only solvers created with
+   reusable = true keep their unfactored blocks (in full precision,
+   the memory of the blocks once more) and can serve as previous.
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  template <class SCAL>
+  class PatchSolver {
+
+    typedef typename std::conditional<is_same<SCAL,Complex>::value,
+				      complex<float>, float>::type TF;
+
+    struct Group {
+      int n;                    // block size
+      int nblocks;
+      Array<SCAL> data;         // nblocks * n * n
+      Array<TF> sdata;          // ... after Factor(), if single
+      Array<SCAL> original;     // unfactored, if reusable
+      Array<int> piv;           // nblocks * n, LU pivots
+      Array<char> chol;         // per block: Cholesky or LU
+    };
+
+    Array<Group> groups;
+    Array<int> group;           // group of block b
+    Array<int> pos;             // position of block b in its group
+    Array<size_t> keys;         // of the unfactored block b
+    bool single;
+    bool reusable;
+    size_t reused = 0;
+
+  public:
+
+    PatchSolver (FlatArray<int> sizes, bool asingle = false,
+		 bool areusable = false);
+
+    // the (zero-initialized) matrix of block b, to be filled before Factor()
+    FlatMatrix<SCAL> GetMatrix (int b) {
+      Group & g = groups[group[b]];
+      return FlatMatrix<SCAL> (g.n, g.n, &g.data[size_t(pos[b])*g.n*g.n]);
+    }
+
+    void Factor (const PatchSolver<SCAL> * previous = nullptr);
+
+    // the number of blocks whose factors were taken from previous
+    size_t NumReused () const { return reused; }
+
+    // x = A_b^{-1} x
+    void Solve (int b, FlatVector<SCAL> x) const;
+
+    size_t NumBlocks () const { return group.Size(); }
+  };
+
+}
+
+#endif
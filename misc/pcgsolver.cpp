@@ -0,0 +1,532 @@
+#include <solve.hpp>
+#include "pcgsolver.hpp"
+
+// See pcgsolver.hpp.
+
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  // independent of the number of threads
+  static int NumChunks (size_t n) {
+    return int(min2 (size_t(256), n/1024 + 1));
+  }
+
+  // <a, b>, conjugating a
+  template <class SCAL>
+  static SCAL Dot (FlatVector<SCAL> a, FlatVector<SCAL> b) {
+
+    int nc = NumChunks (a.Size());
+    Array<SCAL> partial(nc);
+    ParallelFor (Range(nc), [&] (int c) {
+	SCAL sum = 0.0;
+	for (size_t i : Range(a.Size()).Split (c, nc))
+	  sum += Conj(a(i)) * b(i);
+	partial[c] = sum;
+      });
+    SCAL sum = 0.0;
+    for (SCAL s : partial) sum += s;
+    return sum;
+  }
+
+
+  template <class SCAL>
+  static int T_PCG (const BaseMatrix & A, const BaseMatrix & B,
+		    const BaseVector & b, BaseVector & x,
+		    double tol, int maxits,
+		    function<void(BaseVector&,int)> callback, bool printrates) {
+
+    static Timer t("dpg::PCG");
+    RegionTimer reg(t);
+
+    auto r = b.CreateVector();
+    auto p = b.CreateVector();
+    auto w = b.CreateVector();      // B r and A p
+
+    *r = b;
+    A.MultAdd (-1.0, x, *r);
+    B.Mult (*r, *w);
+    *p = *w;
+
+    FlatVector<SCAL> xv = x.FV<SCAL>(), rv = r->FV<SCAL>();
+    FlatVector<SCAL> pv = p->FV<SCAL>(), wv = w->FV<SCAL>();
+    size_t n = xv.Size();
+    int nc = NumChunks (n);
+
+    SCAL rBr0 = 0.0, rBr1 = Dot (rv, wv);
+    int it = 0;
+
+    for ( ; it < maxits; it++) {
+
+      rBr0 = rBr1;
+      A.Mult (*p, *w);
+      SCAL pAp = Dot (pv, wv);
+      SCAL alpha = rBr0 / pAp;
+
+      ParallelFor (Range(nc), [&] (int c) {
+	  for (size_t i : Range(n).Split (c, nc)) {
+	    xv(i) += alpha * pv(i);
+	    rv(i) -= alpha * wv(i);
+	  }
+	});
+
+      B.Mult (*r, *w);
+      rBr1 = Dot (rv, wv);
+      SCAL beta = rBr1 / rBr0;
+
+      ParallelFor (Range(nc), [&] (int c) {
+	  for (size_t i : Range(n).Split (c, nc))
+	    pv(i) = wv(i) + beta * pv(i);
+	});
+
+      if (callback) callback (x, it);
+
+      if (fabs(imag(rBr1)) > 1e-8 || fabs(imag(pAp)) > 1e-8) {
+	cout << endl << "*** rBr= " << rBr0 << ", " << rBr1
+	     << endl << "*** pAp= " << pAp << endl;
+	cout << "*** System not Hermitian!" << endl;
+      }
+      else if (real(rBr0) * real(rBr1) < 0)
+	cout << endl << "*** Preconditioner indefinite!" << endl;
+
+      if (printrates)
+	cout << "PCG" << setw(6) << it << " : pAp=" << setw(12)
+	     << setprecision(9) << real(pAp) << " " << setw(12)
+	     << real(rBr1) << endl;
+
+      if (abs(pAp) < tol || abs(rBr1) < tol) {
+	it++;
+	break;
+      }
+    }
+
+    return it;
+  }
+
+
+  int PCG (const BaseMatrix & A, const BaseMatrix & B,
+	   const BaseVector & b, BaseVector & x,
+	   double tol, int maxits,
+	   function<void(BaseVector&,int)> callback, bool printrates) {
+
+    if (b.IsComplex())
+      return T_PCG<Complex> (A, B, b, x, tol, maxits, callback, printrates);
+    else
+      return T_PCG<double> (A, B, b, x, tol, maxits, callback, printrates);
+  }
+
+
+
+  template <class SCAL>
+  static SCAL Sum (FlatArray<SCAL> partial) {
+    SCAL sum = 0.0;
+    for (SCAL s : partial) sum += s;
+    return sum;
+  }
+
+  template <class SCAL>
+  static int T_PipelinedPCG (const BaseMatrix & A, const BaseMatrix & B,
+			     const BaseVector & b, BaseVector & x,
+			     double tol, int maxits, int replace,
+			     function<void(BaseVector&,int)> callback,
+			     bool printrates) {
+
+    static Timer t("dpg::PipelinedPCG");
+    RegionTimer reg(t);
+
+    auto r = b.CreateVector(), u = b.CreateVector(), w = b.CreateVector();
+    auto m = b.CreateVector(), an = b.CreateVector();
+    auto p = b.CreateVector(), s = b.CreateVector();
+    auto q = b.CreateVector(), z = b.CreateVector();
+
+    FlatVector<SCAL> xv = x.FV<SCAL>(), rv = r->FV<SCAL>();
+    FlatVector<SCAL> uv = u->FV<SCAL>(), wv = w->FV<SCAL>();
+    FlatVector<SCAL> mv = m->FV<SCAL>(), nv = an->FV<SCAL>();
+    FlatVector<SCAL> pv = p->FV<SCAL>(), sv = s->FV<SCAL>();
+    FlatVector<SCAL> qv = q->FV<SCAL>(), zv = z->FV<SCAL>();
+    size_t n = xv.Size();
+    int nc = NumChunks (n);
+
+    // gamma = <r, u>, delta = <u, w>, by chunks
+    Array<SCAL> pg(nc), pd(nc);
+    auto reductions = [&] () {
+      ParallelFor (Range(nc), [&] (int c) {
+	  SCAL g = 0.0, d = 0.0;
+	  for (size_t i : Range(n).Split (c, nc)) {
+	    g += Conj(rv(i)) * uv(i);
+	    d += Conj(uv(i)) * wv(i);
+	  }
+	  pg[c] = g;
+	  pd[c] = d;
+	});
+    };
+
+    // r = b - A x, u = B r, w = A u
+    auto residual = [&] () {
+      *r = b;
+      A.MultAdd (-1.0, x, *r);
+      B.Mult (*r, *u);
+      A.Mult (*u, *w);
+    };
+
+    residual();
+    *p = 0.0;  *s = 0.0;  *q = 0.0;  *z = 0.0;
+    reductions();
+
+    SCAL gamma = Sum<SCAL> (pg), delta = Sum<SCAL> (pd);
+    SCAL gamma0 = 0.0, alpha0 = 1.0;
+    int it = 0;
+
+    for ( ; it < maxits; it++) {
+
+      // m = B w, n = A m: independent of alpha and beta
+      B.Mult (*w, *m);
+      A.Mult (*m, *an);
+
+      SCAL beta = (it > 0) ? gamma / gamma0 : SCAL(0.0);
+      SCAL alpha = gamma / (delta - beta * gamma / alpha0);
+
+      // all updates, and the reductions of the next step, in one pass
+      ParallelFor (Range(nc), [&] (int c) {
+	  SCAL g = 0.0, d = 0.0;
+	  for (size_t i : Range(n).Split (c, nc)) {
+	    zv(i) = nv(i) + beta * zv(i);    // A B A p
+	    qv(i) = mv(i) + beta * qv(i);    // B A p
+	    sv(i) = wv(i) + beta * sv(i);    // A p
+	    pv(i) = uv(i) + beta * pv(i);
+	    xv(i) += alpha * pv(i);
+	    rv(i) -= alpha * sv(i);
+	    uv(i) -= alpha * qv(i);          // B r
+	    wv(i) -= alpha * zv(i);          // A B r
+	    g += Conj(rv(i)) * uv(i);
+	    d += Conj(uv(i)) * wv(i);
+	  }
+	  pg[c] = g;
+	  pd[c] = d;
+	});
+
+      // the recurrences drift from the true residual: recompute
+      if (replace > 0 && (it+1) % replace == 0) {
+	residual();
+	A.Mult (*p, *s);
+	B.Mult (*s, *q);
+	A.Mult (*q, *z);
+	reductions();
+      }
+
+      gamma0 = gamma;
+      alpha0 = alpha;
+      gamma = Sum<SCAL> (pg);
+      delta = Sum<SCAL> (pd);
+      SCAL pAp = gamma0 / alpha;
+
+      if (callback) callback (x, it);
+
+      if (fabs(imag(gamma)) > 1e-8 || fabs(imag(pAp)) > 1e-8) {
+	cout << endl << "*** rBr= " << gamma0 << ", " << gamma
+	     << endl << "*** pAp= " << pAp << endl;
+	cout << "*** System not Hermitian!" << endl;
+      }
+      else if (real(gamma0) * real(gamma) < 0)
+	cout << endl << "*** Preconditioner indefinite!" << endl;
+
+      if (printrates)
+	cout << "PipelinedPCG" << setw(6) << it << " : pAp=" << setw(12)
+	     << setprecision(9) << real(pAp) << " " << setw(12)
+	     << real(gamma) << endl;
+
+      if (abs(pAp) < tol || abs(gamma) < tol) {
+	it++;
+	break;
+      }
+    }
+
+    return it;
+  }
+
+
+  int PipelinedPCG (const BaseMatrix & A, const BaseMatrix & B,
+		    const BaseVector & b, BaseVector & x,
+		    double tol, int maxits, int replace,
+		    function<void(BaseVector&,int)> callback, bool printrates) {
+
+    if (b.IsComplex())
+      return T_PipelinedPCG<Complex> (A, B, b, x, tol, maxits, replace,
+				      callback, printrates);
+    else
+      return T_PipelinedPCG<double> (A, B, b, x, tol, maxits, replace,
+				     callback, printrates);
+  }
+
+
+
+  // views of the vectors (FlatVector assignment copies values, so the
+  // array is sized first and the views are set by AssignMemory)
+  template <class SCAL>
+  static Array<FlatVector<SCAL>> Flat (FlatArray<shared_ptr<BaseVector>> v) {
+    Array<FlatVector<SCAL>> fv(v.Size());
+    for (int j = 0; j < v.Size(); j++) {
+      FlatVector<SCAL> vj = v[j]->FV<SCAL>();
+      fv[j].AssignMemory (vj.Size(), &vj(0));
+    }
+    return fv;
+  }
+
+
+  // ab = a^* b for blocks of vectors, in one pass over the vectors
+  template <class SCAL>
+  static void InnerProducts (FlatArray<FlatVector<SCAL>> a,
+			     FlatArray<FlatVector<SCAL>> b,
+			     FlatMatrix<SCAL> ab) {
+
+    int na = a.Size(), nb = b.Size();
+    size_t n = na ? a[0].Size() : 0;
+    int nc = NumChunks (n);
+    Array<SCAL> partial(nc*na*nb);
+    ParallelFor (Range(nc), [&] (int c) {
+	FlatMatrix<SCAL> sum(na, nb, &partial[c*na*nb]);
+	sum = SCAL(0.0);
+	for (size_t m : Range(n).Split (c, nc))
+	  for (int i = 0; i < na; i++) {
+	    SCAL ai = Conj(a[i](m));
+	    for (int j = 0; j < nb; j++)
+	      sum(i,j) += ai * b[j](m);
+	  }
+      });
+    ab = SCAL(0.0);
+    for (int c = 0; c < nc; c++)
+      ab += FlatMatrix<SCAL> (na, nb, &partial[c*na*nb]);
+  }
+
+
+  // one pass over the rows of a sparse matrix with scalar entries
+  template <class SCAL>
+  static bool SpMM (const BaseMatrix & M, FlatArray<shared_ptr<BaseVector>> x,
+		    FlatArray<shared_ptr<BaseVector>> y) {
+
+    auto mat = dynamic_cast<const SparseMatrixTM<SCAL>*> (&M);
+    if (!mat || dynamic_cast<const SparseMatrixSymmetricTM<SCAL>*> (&M))
+      return false;
+
+    int k = x.Size();
+    auto xv = Flat<SCAL> (x), yv = Flat<SCAL> (y);
+
+    ParallelFor (Range(mat->Height()), [&] (int i) {
+	FlatArray<int> ri = mat->GetRowIndices(i);
+	FlatVector<SCAL> rv = mat->GetRowValues(i);
+	VectorMem<16,SCAL> sum(k);
+	sum = SCAL(0.0);
+	for (int j = 0; j < ri.Size(); j++)
+	  for (int l = 0; l < k; l++)
+	    sum(l) += rv(j) * xv[l](ri[j]);
+	for (int l = 0; l < k; l++)
+	  yv[l](i) = sum(l);
+      });
+    return true;
+  }
+
+
+  void MultBlock (const BaseMatrix & M, FlatArray<shared_ptr<BaseVector>> x,
+		  FlatArray<shared_ptr<BaseVector>> y) {
+
+    if (x.Size() == 0) return;
+    if (auto bm = dynamic_cast<const BlockMult*> (&M)) {
+      bm->MultBlock (x, y);
+      return;
+    }
+    bool done = x[0]->IsComplex() ? SpMM<Complex> (M, x, y) : SpMM<double> (M, x, y);
+    if (!done)
+      for (int l = 0; l < x.Size(); l++)
+	M.Mult (*x[l], *y[l]);
+  }
+
+
+  /*
+    p[0..s) orthonormal, spanning p[0..m) up to dropped (numerically
+    dependent or zero) vectors; returns s. Classical Gram-Schmidt,
+    twice: each projection is one pass for the inner products with all
+    of p[0..s) and one for the update, which also sums the new norm.
+  */
+  template <class SCAL>
+  static int Orthonormalize (Array<shared_ptr<BaseVector>> & p, int m) {
+
+    auto pv = Flat<SCAL> (p.Range(0, m));
+    size_t n = pv[0].Size();
+    int nc = NumChunks (n);
+
+    Matrix<SCAL> gram(m, m);
+    InnerProducts<SCAL> (pv, pv, gram);
+    Array<double> norm0(m);
+    double nmax = 0;
+    for (int j = 0; j < m; j++) {
+      norm0[j] = sqrt (real (gram(j,j)));
+      nmax = max2 (nmax, norm0[j]);
+    }
+
+    // the kept vectors, in order
+    Array<int> kept;
+    Array<FlatVector<SCAL>> kv(m);
+    Array<double> partial(nc);
+    for (int j = 0; j < m; j++) {
+      int s = kept.Size();
+      FlatVector<SCAL> pj = pv[j];
+      double nj = norm0[j];
+      for (int pass = 0; pass < 2 && s > 0; pass++) {     // twice is enough
+	Matrix<SCAL> c(s, 1);
+	InnerProducts<SCAL> (kv.Range(0, s), pv.Range(j, j+1), c);
+	ParallelFor (Range(nc), [&] (int ch) {
+	    double sum = 0;
+	    for (size_t l : Range(n).Split (ch, nc)) {
+	      SCAL v = pj(l);
+	      for (int i = 0; i < s; i++) v -= c(i,0) * kv[i](l);
+	      pj(l) = v;
+	      sum += real (Conj(v) * v);
+	    }
+	    partial[ch] = sum;
+	  });
+	nj = sqrt (Sum<double> (partial));
+      }
+      if (nj > 1e-10 * norm0[j] && nj > 1e-14 * nmax) {
+	*p[j] *= 1/nj;
+	kv[s].AssignMemory (n, &pj(0));
+	kept.Append (j);
+      }
+    }
+
+    // move the kept vectors to the front
+    Array<shared_ptr<BaseVector>> old(m);
+    for (int j = 0; j < m; j++) old[j] = p[j];
+    Array<bool> used(m);
+    used = false;
+    int s = 0;
+    for (int j : kept) {
+      p[s++] = old[j];
+      used[j] = true;
+    }
+    for (int j = 0; j < m; j++)
+      if (!used[j]) p[s++] = old[j];
+    return kept.Size();
+  }
+
+
+  template <class SCAL>
+  static int T_BlockPCG (const BaseMatrix & A, const BaseMatrix & B,
+			 FlatArray<shared_ptr<BaseVector>> b,
+			 FlatArray<shared_ptr<BaseVector>> x,
+			 double tol, int maxits, bool printrates) {
+
+    static Timer t("dpg::BlockPCG");
+    RegionTimer reg(t);
+
+    int k = b.Size();
+    auto vectors = [&] () {
+      Array<shared_ptr<BaseVector>> v(k);
+      for (auto & vi : v) vi = shared_ptr<BaseVector> (b[0]->CreateVector());
+      return v;
+    };
+    Array<shared_ptr<BaseVector>> r = vectors(), z = vectors();
+    Array<shared_ptr<BaseVector>> p = vectors(), q = vectors();
+
+    Array<double> bnorm(k);
+    MultBlock (A, x, q);
+    for (int j = 0; j < k; j++) {
+      *r[j] = *b[j] - *q[j];
+      bnorm[j] = sqrt (real (Dot (b[j]->FV<SCAL>(), b[j]->FV<SCAL>())));
+      if (bnorm[j] == 0) bnorm[j] = 1;
+    }
+    MultBlock (B, r, z);
+    for (int j = 0; j < k; j++) *p[j] = *z[j];
+    int s = Orthonormalize<SCAL> (p, k);
+
+    size_t n = b[0]->FV<SCAL>().Size();
+    int nc = NumChunks (n);
+    auto xv = Flat<SCAL> (x), rv = Flat<SCAL> (r);
+    Array<double> partial(nc*k);
+
+    int it = 0;
+    for ( ; it < maxits && s > 0; it++) {
+
+      MultBlock (A, p.Range(0, s), q.Range(0, s));
+      auto pv = Flat<SCAL> (p.Range(0, s)), qv = Flat<SCAL> (q.Range(0, s));
+
+      // alpha = (P^* A P)^{-1} P^* R, with P^* [Q R] in one pass
+      Array<FlatVector<SCAL>> qr(s+k);
+      for (int i = 0; i < s; i++) qr[i].AssignMemory (n, &qv[i](0));
+      for (int j = 0; j < k; j++) qr[s+j].AssignMemory (n, &rv[j](0));
+      Matrix<SCAL> pqr(s, s+k);
+      InnerProducts<SCAL> (pv, qr, pqr);
+      Matrix<SCAL> pq = pqr.Cols(0, s), pr = pqr.Cols(s, s+k);
+      CalcInverse (pq);
+      Matrix<SCAL> alpha = pq * pr;
+
+      // X += P alpha,  R -= Q alpha, and the norms of R (one pass)
+      ParallelFor (Range(nc), [&] (int c) {
+	  FlatVector<double> rr(k, &partial[c*k]);
+	  rr = 0.0;
+	  for (size_t m : Range(n).Split (c, nc))
+	    for (int j = 0; j < k; j++) {
+	      SCAL sx = 0.0, sr = 0.0;
+	      for (int i = 0; i < s; i++) {
+		sx += pv[i](m) * alpha(i,j);
+		sr += qv[i](m) * alpha(i,j);
+	      }
+	      xv[j](m) += sx;
+	      SCAL rj = rv[j](m) - sr;
+	      rv[j](m) = rj;
+	      rr(j) += real (Conj(rj) * rj);
+	    }
+	});
+
+      double maxres = 0;
+      for (int j = 0; j < k; j++) {
+	double rr = 0;
+	for (int c = 0; c < nc; c++) rr += partial[c*k+j];
+	maxres = max2 (maxres, sqrt (rr) / bnorm[j]);
+      }
+      if (printrates)
+	cout << "BlockPCG" << setw(6) << it << " : block size " << s
+	     << ", max |r|/|b| = " << maxres << endl;
+      if (maxres <= tol) {
+	it++;
+	break;
+      }
+
+      // P = orth (Z + P beta),  beta = -(P^* A P)^{-1} Q^* Z
+      MultBlock (B, r, z);
+      auto zv = Flat<SCAL> (z);
+      Matrix<SCAL> qz(s, k);
+      InnerProducts<SCAL> (qv, zv, qz);
+      Matrix<SCAL> beta = pq * qz;
+      beta *= -1.0;
+
+      ParallelFor (Range(nc), [&] (int c) {
+	  for (size_t m : Range(n).Split (c, nc))
+	    for (int j = 0; j < k; j++) {
+	      SCAL sum = 0.0;
+	      for (int i = 0; i < s; i++) sum += pv[i](m) * beta(i,j);
+	      zv[j](m) += sum;
+	    }
+	});
+
+      swap (p, z);
+      s = Orthonormalize<SCAL> (p, k);
+    }
+
+    return it;
+  }
+
+
+  int BlockPCG (const BaseMatrix & A, const BaseMatrix & B,
+		FlatArray<shared_ptr<BaseVector>> b,
+		FlatArray<shared_ptr<BaseVector>> x,
+		double tol, int maxits, bool printrates) {
+
+    if (b.Size() == 0) return 0;
+    if (b[0]->IsComplex())
+      return T_BlockPCG<Complex> (A, B, b, x, tol, maxits, printrates);
+    else
+      return T_BlockPCG<double> (A, B, b, x, tol, maxits, printrates);
+  }
+
+}
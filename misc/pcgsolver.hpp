@@ -0,0 +1,102 @@
+#ifndef FILE_PCGSOLVER_HPP
+#define FILE_PCGSOLVER_HPP
+
+
+/* Preconditioned conjugate gradients with fused vector updates.
+
+   The same iteration as pcg() in projects/pyutils/pcg.py (for A x = b,
+   preconditioner B, in the inv(B)-inner product), with the vector work
+   of a step done in three passes over memory instead of one per
+   operation:
+
+     pAp = <p, Ap>                        (after Ap = A p)
+     x += alpha p,  r -= alpha Ap         (one pass)
+     rBr = <r, Br>                        (after Br = B r)
+     p = Br + beta p
+
+   The inner products are conjugated (Hermitian A and B) and summed in
+   a fixed number of chunks, so the results do not depend on the number
+   of threads. The diagnostics of pcg.py are kept: a warning if <r,Br>
+   or <p,Ap> are not real (A or B not Hermitian), or if <r,Br> changes
+   sign (B indefinite). Stops when |pAp| or |rBr| is below tol, or after
+   maxits steps. callback(x, it) is called after each step.
+
+   Python (import libDPG):
+
+      x = libDPG.pcg(A, B, b, x=None, tol=1e-16, maxits=100, saveitfn=None)
+
+
+   Pipelined PCG (Ghysels, Vanroose 2014): the same iterates in exact
+   arithmetic, rearranged so that the two inner products of a step are
+   computed together, in the pass that updates the vectors, and the
+   applications of B and A of the next step (m = B w, n = A m) do not
+   wait for them. A step is one pass over memory between the matrix
+   applications, instead of the three above, at the price of four more
+   vectors (s = A p, q = B s, z = A q, w = A u) kept by recurrences.
+   These drift from the true values, so every "replace" steps they are
+   recomputed from x and p (residual replacement; 0 for never), at the
+   cost of three applications of A and two of B.
+
+      x = libDPG.pipelinedpcg(A, B, b, x=None, tol=1e-16, maxits=100,
+                              replace=50, saveitfn=None)
+
+
+   Block PCG for several right hand sides b_1..b_k with the same A and
+   B (e.g. several incident fields): the search directions of all are
+   combined, so A and B are applied to blocks of vectors, reading the
+   matrix (and the patch factors of a VertexPatchSchwarz) once for all
+   vectors (see BlockMult). Breakdown-free variant (Ji, Li 2017): the
+   block of search directions is orthonormalized, and directions that
+   are (numerically) dependent are dropped, so the block shrinks as
+   right hand sides converge or become linearly dependent. Stops when
+   |r_j| <= tol |b_j| for all j.
+
+      xs = libDPG.blockpcg(A, B, [b1, b2, b3], tol=1e-10, maxits=1000)
+ */
+
+
+#include <solve.hpp>
+
+using namespace ngsolve;
+
+namespace dpg {
+
+  // returns the number of steps
+  int PCG (const BaseMatrix & A, const BaseMatrix & B,
+	   const BaseVector & b, BaseVector & x,
+	   double tol = 1e-16, int maxits = 100,
+	   function<void(BaseVector&,int)> callback = nullptr,
+	   bool printrates = true);
+
+  // returns the number of steps
+  int PipelinedPCG (const BaseMatrix & A, const BaseMatrix & B,
+		    const BaseVector & b, BaseVector & x,
+		    double tol = 1e-16, int maxits = 100, int replace = 50,
+		    function<void(BaseVector&,int)> callback = nullptr,
+		    bool printrates = true);
+
+
+  // operators that multiply blocks of vectors in one pass
+  class BlockMult {
+  public:
+    virtual ~BlockMult () { ; }
+    // y[j] = M x[j]
+    virtual void MultBlock (FlatArray<shared_ptr<BaseVector>> x,
+			    FlatArray<shared_ptr<BaseVector>> y) const = 0;
+  };
+
+  // y[j] = M x[j]: by MultBlock, one pass over a sparse matrix with
+  // rows, or M.Mult for each vector
+  void MultBlock (const BaseMatrix & M, FlatArray<shared_ptr<BaseVector>> x,
+		  FlatArray<shared_ptr<BaseVector>> y);
+
+  // returns the number of steps; x holds initial guesses
+  int BlockPCG (const BaseMatrix & A, const BaseMatrix & B,
+		FlatArray<shared_ptr<BaseVector>> b,
+		FlatArray<shared_ptr<BaseVector>> x,
+		double tol = 1e-10, int maxits = 1000,
+		bool printrates = true);
+
+}
+
+#endif
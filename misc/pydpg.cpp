@@ -0,0 +1,456 @@
+#include <solve.hpp>
+#include <python_ngstd.hpp>
+#include "../integrators/dpgcondensation.hpp"
+#include "../integrators/dpgbundle.hpp"
+#include "../integrators/cachedintegrator.hpp"
+#include "../integrators/sumfactorization.hpp"
+#include "dpgmatrixfree.hpp"
+#include "vertexschwarz.hpp"
+#include "affinesum.hpp"
+#include "pcgsolver.hpp"
+#include "asyncwriter.hpp"
+
+/* Python interface of libDPG.
+
+   Integrators that are created from coefficients only are available
+   after loading the library with CDLL (see python/ folder). Objects
+   that need other NGSolve objects are exported here: after NGSolve,
+   import the library as a python module, e.g.
+
+      from ngsolve import *
+      import sys; sys.path.append("..")
+      import libDPG
+ */
+
+
+using namespace ngsolve;
+using namespace dpg;
+
+
+// a CoefficientFunction, or a real or complex number
+static shared_ptr<CoefficientFunction> MakeCoefficient (py::object obj) {
+
+  if (PyComplex_Check(obj.ptr()))
+    return make_shared<ConstantCoefficientFunctionC> (py::cast<Complex>(obj));
+  if (py::isinstance<py::float_>(obj) || py::isinstance<py::int_>(obj))
+    return make_shared<ConstantCoefficientFunction> (py::cast<double>(obj));
+  return py::cast<shared_ptr<CoefficientFunction>> (obj);
+}
+
+// factor the blocks mats[b] (lists of rows) with a PatchSolver and
+// return the solutions for rhs[b] (lists)
+template <class SCAL>
+static py::list PatchSolve (py::list mats, py::list rhs, bool single) {
+
+  Array<int> sizes;
+  for (auto m : mats) sizes.Append (py::len(m));
+  PatchSolver<SCAL> solver(sizes, single);
+  for (int b = 0; b < sizes.Size(); b++) {
+    FlatMatrix<SCAL> a = solver.GetMatrix(b);
+    py::list rows = py::cast<py::list> (mats[b]);
+    for (int i = 0; i < sizes[b]; i++) {
+      py::list row = py::cast<py::list> (rows[i]);
+      for (int j = 0; j < sizes[b]; j++) a(i,j) = py::cast<SCAL> (row[j]);
+    }
+  }
+  solver.Factor();
+
+  py::list result;
+  for (int b = 0; b < sizes.Size(); b++) {
+    py::list f = py::cast<py::list> (rhs[b]);
+    Vector<SCAL> x(sizes[b]);
+    for (int i = 0; i < sizes[b]; i++) x(i) = py::cast<SCAL> (f[i]);
+    solver.Solve (b, x);
+    py::list xl;
+    for (int i = 0; i < sizes[b]; i++) xl.append (py::cast(x(i)));
+    result.append (xl);
+  }
+  return result;
+}
+
+PYBIND11_MODULE(libDPG, m) {
+
+  m.doc() = "Python interface to the DPG library";
+
+
+  py::class_<DPGCondensation, shared_ptr<DPGCondensation>>
+    (m, "DPGCondensation", R"raw(
+Element-level elimination of the error representation component.
+
+Given the (unassembled) DPG form 'bf' and right hand side 'lf' on a
+compound space S, where component 'testcomp' of S is the test space
+error representation, provides integrators on the compound space of
+the remaining components (in the same order) giving
+
+   C - Bt G^{-1} B    and    f_x - Bt G^{-1} f_y
+
+element by element, using a Cholesky factorization of the Gram
+matrix G only. With cache=True the factors of G and the blocks B, Bt
+are kept from the matrix assembly for LFI and Estimate.
+
+Example:
+
+   cond = libDPG.DPGCondensation(a, 2, f)
+   ac = BilinearForm(Sx, eliminate_internal=True)
+   ac += cond.BFI()
+   fc = LinearForm(Sx)
+   fc += cond.LFI()
+   ...solve for uq in Sx...
+   elerr = cond.Estimate(uq)
+)raw")
+
+    .def(py::init([] (shared_ptr<BilinearForm> bf, int testcomp,
+		      shared_ptr<LinearForm> lf, bool cache) {
+		    return make_shared<DPGCondensation>(bf, lf, testcomp, cache);
+		  }),
+      py::arg("bf"), py::arg("testcomp"), py::arg("lf")=nullptr,
+      py::arg("cache")=true)
+
+    .def("BFI", [] (shared_ptr<DPGCondensation> self, VorB vb)
+	 -> shared_ptr<BilinearFormIntegrator> {
+	   return make_shared<DPGCondensedIntegrator>(self, vb);
+	 }, py::arg("vb")=VOL,
+      "condensed integrator of the VOL or BND integrators of bf")
+
+    .def("LFI", [] (shared_ptr<DPGCondensation> self, VorB vb)
+	 -> shared_ptr<LinearFormIntegrator> {
+	   return make_shared<DPGCondensedSource>(self, vb);
+	 }, py::arg("vb")=VOL,
+      "condensed integrator of the VOL or BND integrators of lf")
+
+    .def("Estimate", [] (shared_ptr<DPGCondensation> self,
+			 shared_ptr<GridFunction> gf) {
+	   LocalHeap lh(10000000, "dpgestimate", true);
+	   Vector<> est = self->Estimate(gf, lh);
+	   py::list elerr;
+	   for (int i = 0; i < est.Size(); i++) elerr.append(est(i));
+	   return elerr;
+	 }, py::arg("gf"),
+      "element-wise squared Y-norms of the error representation "
+      "computed from the trial solution gf");
+
+
+  m.def("SetSumFactorization", [] (bool on) { SetSumFactorization (on); },
+	py::arg("on"), R"raw(
+Sum factorization of GradGrad, EyeEye, TraceTrace and FluxTrace on
+quadrilaterals and hexahedra (on by default). Off: the generic
+integration, e.g. to compare.
+)raw");
+
+
+  m.def("DPGBundle", [] (py::list pyterms, int dim)
+	-> shared_ptr<BilinearFormIntegrator> {
+
+	  Array<shared_ptr<DPGTerm>> terms;
+	  for (auto item : pyterms) {
+	    py::tuple t = py::cast<py::tuple>(item);
+	    if (t.size() != 4)
+	      throw Exception ("DPGBundle: terms are (kernel, ind1, ind2, coef)");
+	    terms.Append (make_shared<DPGTerm> (py::cast<string>(t[0]),
+						py::cast<int>(t[1]),
+						py::cast<int>(t[2]),
+						MakeCoefficient(t[3]), dim));
+	  }
+	  if (dim == 2) return make_shared<DPGBundle<2>> (terms);
+	  return make_shared<DPGBundle<3>> (terms);
+	}, py::arg("terms"), py::arg("dim")=3, R"raw(
+Several DPG volume integrators on the same compound space, computed
+in one pass over the element (shared geometry and shape tables).
+
+terms: list of (kernel, ind1, ind2, coef), where kernel is the name of
+the integrator (gradgrad, eyeeye, curlcurlpg, eyeeyeedge, flxtrc,
+trctrc, trctrcxn) and ind1, ind2, coef are as in its coefficient list.
+
+Example:
+
+   a += libDPG.DPGBundle([("curlcurlpg", 2,1, 1),       # (curl E, curl v)
+                          ("eyeeyeedge", 2,1, -k*k),    # -(k*k E, v)
+                          ("trctrcxn",   3,1, 1j)])     # i<<M, v x n>>
+)raw");
+
+
+  py::class_<DPGMatrixFree, shared_ptr<DPGMatrixFree>, BaseMatrix>
+    (m, "DPGMatrixFree", R"raw(
+The condensed DPG matrix (of a form with eliminate_internal=True) as
+an operator that is never assembled: element matrices are computed
+and condensed on the fly in every application, or, with cache=True,
+the condensed element matrices are kept.
+
+Example:
+
+   A = libDPG.DPGMatrixFree(a)       # instead of a.Assemble()
+   B = libDPG.VertexSchwarz(A)
+   A.ExtendTrans(f.vec)
+   u.vec.data = pcg(A, B, f.vec)
+   A.Extend(u.vec)
+   A.InnerSolve(f.vec, u.vec)
+
+With cache=True, single=True the condensed element matrices are kept
+in single precision; use such an operator inside refine() (pyutils).
+)raw")
+
+    .def(py::init([] (shared_ptr<BilinearForm> bf, bool cache,
+		      size_t heapsize, bool single) {
+		    return make_shared<DPGMatrixFree>(bf, cache, heapsize,
+						      single);
+		  }),
+      py::arg("bf"), py::arg("cache")=false, py::arg("heapsize")=10000000,
+      py::arg("single")=false)
+
+    .def("Update", &DPGMatrixFree::Update,
+	 "recompute the cached element matrices")
+
+    .def("Extend", [] (shared_ptr<DPGMatrixFree> self, BaseVector & u) {
+	   self->Extend(u);
+	 }, py::arg("u"), "u += harmonic_extension * u")
+
+    .def("ExtendTrans", [] (shared_ptr<DPGMatrixFree> self, BaseVector & f) {
+	   self->ExtendTrans(f);
+	 }, py::arg("f"), "f += harmonic_extension_trans * f")
+
+    .def("InnerSolve", [] (shared_ptr<DPGMatrixFree> self,
+			   BaseVector & f, BaseVector & u) {
+	   self->InnerSolve(f, u);
+	 }, py::arg("f"), py::arg("u"), "u += inner_solve * f");
+
+
+  m.def("VertexSchwarz", [] (shared_ptr<DPGMatrixFree> mf, bool single,
+			     int chebyshev, int lanczossteps, bool reuse)
+	-> shared_ptr<BaseMatrix> {
+	  Flags flags;
+	  if (single) flags.SetFlag("single");
+	  if (reuse) flags.SetFlag("reuse");
+	  if (chebyshev) flags.SetFlag("chebyshev", double(chebyshev));
+	  flags.SetFlag("lanczossteps", double(lanczossteps));
+	  auto pre = make_shared<VertexPatchSchwarz> (mf, flags);
+	  pre->Update();
+	  return pre;
+	}, py::arg("A"), py::arg("single")=false, py::arg("chebyshev")=0,
+	py::arg("lanczossteps")=20, py::arg("reuse")=false, R"raw(
+Additive vertex patch Schwarz preconditioner for a DPGMatrixFree
+operator A, with patch matrices summed from its element matrices,
+their inverses kept in single precision if single=True. With
+chebyshev=k > 0, k steps of a Chebyshev iteration with the additive
+operator (bounds from lanczossteps Lanczos steps). With reuse=True
+unchanged patches keep their factors in later Updates (more memory).
+)raw");
+
+
+  py::class_<CachedIntegrator, shared_ptr<CachedIntegrator>,
+	     BilinearFormIntegrator>
+    (m, "CachedIntegrator", R"raw(
+A bilinear form integrator whose element matrices are kept across
+assemblies, and only recomputed for new or changed elements (e.g.
+after mesh.Refine()). The values of Parameter coefficients are part
+of the key; integrators with GridFunction coefficients are not cached
+(cacheable is False). Coefficients of other integrators than SymbolicBFI
+and those of libDPG must depend only on the position and the material;
+call Clear() if they change otherwise.
+)raw")
+    .def("Clear", &CachedIntegrator::Clear, "forget all element matrices")
+    .def_property_readonly("hits", &CachedIntegrator::Hits)
+    .def_property_readonly("misses", &CachedIntegrator::Misses)
+    .def_property_readonly("size", &CachedIntegrator::Size)
+    .def_property_readonly("cacheable", &CachedIntegrator::Cacheable);
+
+  m.def("Cached", [] (shared_ptr<BilinearFormIntegrator> bfi,
+		      bool translations) {
+	  return make_shared<CachedIntegrator> (bfi, translations);
+	}, py::arg("bfi"), py::arg("translations")=false, R"raw(
+Wrap the integrator bfi into a CachedIntegrator.
+
+With translations=True (integrators of libDPG only), translated copies
+of an element with the same coefficient values share one matrix.
+
+Example:
+
+   a += libDPG.Cached(SymbolicBFI(grad(u) * grad(v)))
+   a += libDPG.Cached(BFI("gradgrad", coef=[2,1,1.0]), translations=True)
+)raw");
+
+
+  py::class_<AffineSum, shared_ptr<AffineSum>>
+    (m, "AffineSum", R"raw(
+The sparse matrix  sum_i c_i A_i  for given coefficients c_i, formed
+by one pass over the nonzero entries. The patterns of A_1, A_2, ...
+must be contained in the pattern of A_0.
+
+Example:
+
+   A = libDPG.AffineSum([a0.mat, a1.mat, a2.mat])
+   for w in frequencies:
+      A.Set([1, -k(w)**2, k(w)])
+      inv = A.mat.Inverse(fes.FreeDofs())
+)raw")
+
+    .def(py::init([] (py::list mats) {
+		    Array<shared_ptr<BaseSparseMatrix>> terms;
+		    for (auto item : mats) {
+		      auto mat = dynamic_pointer_cast<BaseSparseMatrix>
+			(py::cast<shared_ptr<BaseMatrix>>(item));
+		      if (!mat)
+			throw Exception ("AffineSum: sparse matrices expected");
+		      terms.Append (mat);
+		    }
+		    return make_shared<AffineSum>(terms);
+		  }), py::arg("mats"))
+
+    .def("Set", [] (shared_ptr<AffineSum> self, py::list pycoefs) {
+	   Array<Complex> coefs;
+	   for (auto item : pycoefs)
+	     coefs.Append (py::cast<Complex>(item));
+	   self->Set(coefs);
+	 }, py::arg("coefs"), "mat = sum of coefs[i] * mats[i]")
+
+    .def_property_readonly("mat", [] (shared_ptr<AffineSum> self)
+			   -> shared_ptr<BaseMatrix> {
+			     return self->GetMatrix();
+			   }, "the sum");
+
+
+  py::class_<AsyncWriter, shared_ptr<AsyncWriter>>
+    (m, "AsyncWriter", R"raw(
+Writes snapshots of grid functions (gzip compressed, in the format of
+GridFunction.Save) in a background thread. Save copies the vector and
+returns; it waits only if the previous file is still being written.
+
+Example (PCG iterates):
+
+   writer = libDPG.AsyncWriter()
+   def save(x, it):
+      writer.Save(gf, 'sol%d.sol.gz' % it)
+   libDPG.pcg(A, B, b, x=gf.vec, saveitfn=save)
+   writer.Wait()
+)raw")
+
+    .def(py::init([] (int level) {
+		    return make_shared<AsyncWriter>(level);
+		  }), py::arg("level")=1, "gzip compression level 0..9")
+
+    .def("Save", [] (shared_ptr<AsyncWriter> self,
+		     shared_ptr<GridFunction> gf, string filename) {
+	   self->Save (*gf, filename);
+	 }, py::arg("gf"), py::arg("filename"),
+	 "copy the vector of gf and write it to filename in the background")
+
+    .def("Wait", [] (shared_ptr<AsyncWriter> self) { self->Wait(); },
+	 "wait until the last file is written");
+
+
+  m.def("PatchSolve", [] (py::list mats, py::list rhs, bool cplx, bool single) {
+	  return cplx ? PatchSolve<Complex> (mats, rhs, single)
+	    : PatchSolve<double> (mats, rhs, single);
+	}, py::arg("mats"), py::arg("rhs"), py::arg("complex")=false,
+	py::arg("single")=false, R"raw(
+Solve A_b x_b = f_b with the dense patch factorizations of
+VertexPatchSchwarz (Cholesky if Hermitian positive definite, else LU;
+in single precision if single). mats are lists of rows, rhs lists.
+For tests.
+)raw");
+
+
+  m.def("PatchInfo", [] (shared_ptr<BaseMatrix> pre) {
+	  auto schwarz = dynamic_pointer_cast<VertexPatchSchwarz> (pre);
+	  if (!schwarz)
+	    throw Exception ("PatchInfo: not a vertex or edge patch Schwarz "
+			     "preconditioner");
+	  py::dict info;
+	  py::list blocks;
+	  if (auto table = schwarz->GetBlocks())
+	    for (int i = 0; i < table->Size(); i++) {
+	      py::list block;
+	      for (int d : (*table)[i]) block.append (d);
+	      blocks.append (block);
+	    }
+	  info["blocks"] = blocks;
+	  info["reused"] = schwarz->NumReused();
+	  info["lmin"] = schwarz->SpectrumMin();
+	  info["lmax"] = schwarz->SpectrumMax();
+	  return info;
+	}, py::arg("pre"), R"raw(
+Information on a Schwarz preconditioner (vertexschwarz, edgeschwarz or
+VertexSchwarz), after its Update, for tests:
+
+   blocks    the patches, lists of dofs
+   reused    patches whose factors the last Update kept (flag "reuse")
+   lmin, lmax   the interval of the Chebyshev iteration (chebyshev=k)
+)raw");
+
+
+  m.def("pcg", [] (shared_ptr<BaseMatrix> A, shared_ptr<BaseMatrix> B,
+		   shared_ptr<BaseVector> b, shared_ptr<BaseVector> x,
+		   double tol, int maxits, py::object saveitfn, bool printrates)
+	-> shared_ptr<BaseVector> {
+	  if (!x) {
+	    x = shared_ptr<BaseVector> (b->CreateVector());
+	    *x = 0.0;
+	  }
+	  function<void(BaseVector&,int)> callback;
+	  if (!saveitfn.is_none())
+	    callback = [&] (BaseVector &, int it) { saveitfn(x, it); };
+	  PCG (*A, *B, *b, *x, tol, maxits, callback, printrates);
+	  return x;
+	}, py::arg("A"), py::arg("B"), py::arg("b"), py::arg("x")=nullptr,
+	py::arg("tol")=1e-16, py::arg("maxits")=100,
+	py::arg("saveitfn")=py::none(), py::arg("printrates")=true, R"raw(
+Preconditioned conjugate gradients for A x = b with preconditioner B,
+as pcg() in projects/pyutils/pcg.py, with fused vector updates. x is
+the initial guess (default 0) and is overwritten. saveitfn(x, it) is
+called after each step. Returns x.
+)raw");
+
+
+  m.def("pipelinedpcg", [] (shared_ptr<BaseMatrix> A, shared_ptr<BaseMatrix> B,
+			    shared_ptr<BaseVector> b, shared_ptr<BaseVector> x,
+			    double tol, int maxits, int replace,
+			    py::object saveitfn, bool printrates)
+	-> shared_ptr<BaseVector> {
+	  if (!x) {
+	    x = shared_ptr<BaseVector> (b->CreateVector());
+	    *x = 0.0;
+	  }
+	  function<void(BaseVector&,int)> callback;
+	  if (!saveitfn.is_none())
+	    callback = [&] (BaseVector &, int it) { saveitfn(x, it); };
+	  PipelinedPCG (*A, *B, *b, *x, tol, maxits, replace, callback, printrates);
+	  return x;
+	}, py::arg("A"), py::arg("B"), py::arg("b"), py::arg("x")=nullptr,
+	py::arg("tol")=1e-16, py::arg("maxits")=100, py::arg("replace")=50,
+	py::arg("saveitfn")=py::none(), py::arg("printrates")=true, R"raw(
+Pipelined variant of pcg: the inner products of a step are fused into
+one pass with the vector updates, and the applications of A and B do
+not wait for them. Every replace steps (0 for never) the recurrences
+are refreshed from the true residual. Arguments as for pcg.
+)raw");
+
+
+  m.def("blockpcg", [] (shared_ptr<BaseMatrix> A, shared_ptr<BaseMatrix> B,
+			py::list bs, py::object xs,
+			double tol, int maxits, bool printrates) {
+	  Array<shared_ptr<BaseVector>> b, x;
+	  for (auto bi : bs)
+	    b.Append (py::cast<shared_ptr<BaseVector>> (bi));
+	  if (xs.is_none())
+	    for (auto bi : b) {
+	      x.Append (shared_ptr<BaseVector> (bi->CreateVector()));
+	      *x.Last() = 0.0;
+	    }
+	  else
+	    for (auto xi : py::list(xs))
+	      x.Append (py::cast<shared_ptr<BaseVector>> (xi));
+	  if (x.Size() != b.Size())
+	    throw Exception ("blockpcg: xs and bs differ in length");
+	  BlockPCG (*A, *B, b, x, tol, maxits, printrates);
+	  py::list result;
+	  for (auto xi : x) result.append (py::cast(xi));
+	  return result;
+	}, py::arg("A"), py::arg("B"), py::arg("bs"), py::arg("xs")=py::none(),
+	py::arg("tol")=1e-10, py::arg("maxits")=1000,
+	py::arg("printrates")=true, R"raw(
+Block PCG for A x_j = b_j, j = 1..k, with preconditioner B: one
+iteration for all right hand sides bs (a list of vectors), applying A
+and B to blocks of vectors. xs are the initial guesses (default 0) and
+are overwritten. Stops when |r_j| <= tol |b_j| for all j. Returns the
+list of solutions.
+)raw");
+}
@@ -1,71 +1,24 @@
 
-/*
-
-  Provides Schwarz subspace correction preconditioners using vertex
-  patches.
-
-  All dofs, after condensation, that are on facets connected to a
-  vertex, define the subspaces. Corrections on these subspaces are
-  multiplicatively combined. 
-
-  An optional coarse solve using wirebasket dofs is turned off by
-  default.
-
-*/
+// See vertexschwarz.hpp for a description.
 
 
 #include <solve.hpp>
+#include "vertexschwarz.hpp"
+#include "../spaces/periodicdofmap.hpp"
 
 
 namespace ngcomp  {
   
-  class VertexPatchSchwarz : public Preconditioner  {
-
-    shared_ptr<BilinearForm> bfa;
-    shared_ptr<BaseBlockJacobiPrecond> jacobi;
-    shared_ptr<BaseMatrix>  coarseinv;
-    bool                    addcoarse; 
-
-  public:
-
-    VertexPatchSchwarz (const PDE & pde, const Flags & flags, 
-			const string & aname);
-    VertexPatchSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
-                        const string aname = "mgprecond");
-
-    ~VertexPatchSchwarz ();
-
-    virtual void Update();
-
-    virtual int VHeight() const { return jacobi->VHeight(); }
-    
-    virtual int VWidth() const { return jacobi->VWidth(); }
-	
-    virtual void Mult (const BaseVector & f, BaseVector & u) const  {
-
-      // jacobi -> Mult (f, u);
-
-      u = 0.0;
-      jacobi -> GSSmooth (u, f);
-      jacobi -> GSSmoothBack (u, f);
-
-      if (addcoarse)
-	coarseinv->MultAdd( 1, f, u );  // u = u + 1 * inv(A0) * f
-    }
-
-    virtual const BaseMatrix & GetAMatrix() const   {
-
-      return bfa -> GetMatrix();
-    }
-
-  };
-
-
   VertexPatchSchwarz::VertexPatchSchwarz (const PDE & pde, 
 		      const Flags & flags, const string & aname)
     : Preconditioner (&pde, flags, aname), jacobi(NULL)  {
 
     addcoarse = flags.GetDefineFlag("addcoarse");
+    sequential = flags.GetDefineFlag("sequential");
+    single = flags.GetDefineFlag("single");
+    reuse = flags.GetDefineFlag("reuse");
+    chebyshev = int(flags.GetNumFlag("chebyshev", 0));
+    lanczossteps = int(flags.GetNumFlag("lanczossteps", 20));
 
     cout << endl << "Constructor of VertexPatchSchwarz" ;
     if (addcoarse) cout << "with coarse solve" ;      
@@ -79,6 +32,11 @@ namespace ngcomp  {
     : Preconditioner (abfa, aflags, aname)
   {
     addcoarse = flags.GetDefineFlag("addcoarse");
+    sequential = flags.GetDefineFlag("sequential");
+    single = flags.GetDefineFlag("single");
+    reuse = flags.GetDefineFlag("reuse");
+    chebyshev = int(flags.GetNumFlag("chebyshev", 0));
+    lanczossteps = int(flags.GetNumFlag("lanczossteps", 20));
 
     cout << endl << "Constructor of VertexPatchSchwarz" ;
     if (addcoarse) cout << "with coarse solve" ;      
@@ -87,6 +45,27 @@ namespace ngcomp  {
   }
 
 
+  VertexPatchSchwarz::
+  VertexPatchSchwarz (shared_ptr<dpg::DPGMatrixFree> amf,
+		      const Flags & aflags, const string aname)
+    : Preconditioner (amf->GetBilinearForm(), aflags, aname), mf(amf)
+  {
+    addcoarse = flags.GetDefineFlag("addcoarse");
+    if (addcoarse)
+      throw Exception ("VertexPatchSchwarz: no coarse solve without an "
+		       "assembled matrix");
+    single = flags.GetDefineFlag("single");
+    reuse = flags.GetDefineFlag("reuse");
+    chebyshev = int(flags.GetNumFlag("chebyshev", 0));
+    lanczossteps = int(flags.GetNumFlag("lanczossteps", 20));
+
+    cout << endl << "Constructor of matrix-free VertexPatchSchwarz" ;
+    if (single) cout << " with single precision patch inverses" ;
+
+    bfa = mf->GetBilinearForm();
+  }
+
+
   VertexPatchSchwarz :: ~VertexPatchSchwarz ()  
   { 
     // noting to delete with shared ptr
@@ -98,10 +77,116 @@ namespace ngcomp  {
 
     // delete jacobi;
 
+    if (mf) {
+      fine.blocks = CreateBlocks (mf->GetFESpace()->GetFreeDofs(true));
+      SetupPatches (fine, false);
+      if (chebyshev) EstimateSpectrum();
+      if (test) Test();
+      return;
+    }
+
+    amat = bfa->GetMatrixPtr();
     const BaseSparseMatrix & mat 
-      = dynamic_cast<const BaseSparseMatrix&> (bfa->GetMatrix());
+      = dynamic_cast<const BaseSparseMatrix&> (*amat);
+
+    fine.blocks = CreateBlocks (bfa->GetFESpace()->GetFreeDofs());
+
+    // colored smoothing needs whole rows of a matrix with scalar entries
+    bool rows =
+      (dynamic_cast<const SparseMatrixTM<double>*> (&mat) &&
+       !dynamic_cast<const SparseMatrixSymmetricTM<double>*> (&mat)) ||
+      (dynamic_cast<const SparseMatrixTM<Complex>*> (&mat) &&
+       !dynamic_cast<const SparseMatrixSymmetricTM<Complex>*> (&mat));
+
+    if (sequential || !rows) {
+      if (!sequential)
+	cout << endl << "VertexPatchSchwarz: symmetric or block matrix, "
+	     << "using sequential smoothing" << endl;
+      //jacobi = mat.CreateBlockJacobiPrecond (shared_ptr<Table<int>>(creator.GetTable()));
+      jacobi = mat.CreateBlockJacobiPrecond (fine.blocks);
+    }
+    else {
+      jacobi = nullptr;
+      SetupPatches (fine, !chebyshev);    // no colors for additive
+      if (chebyshev) EstimateSpectrum();
+    }
+
+    if (addcoarse) {
+      shared_ptr<FESpace> fes = bfa -> GetFESpace();
+      int ndof = fes->GetNDof();
+      auto coarsedofs = make_shared<BitArray>(ndof);
+      coarsedofs->Clear();
+
+      for (int i=0; i<ndof; i++) 
+	if (fes->GetDofCouplingType(i) == WIREBASKET_DOF)
+	  coarsedofs->Set(i);
+      coarsedofs->And(*fes->GetFreeDofs());
+
+      coarseinv = mat.InverseMatrix(coarsedofs);
+    }
     
-    shared_ptr<BitArray> freedofs = bfa->GetFESpace()->GetFreeDofs();
+    if (test) Test();
+  }
+
+
+  // dof -> blocks containing it, and the position in each
+  static void DofBlocks (const Table<int> & bl, int ndof,
+			 Table<int> & dof2block, Table<int> & dof2pos)  {
+
+    TableCreator<int> cblock(ndof), cpos(ndof);
+    for ( ; !cblock.Done(); cblock++, cpos++)
+      for (int b = 0; b < bl.Size(); b++)
+	for (int k = 0; k < bl[b].Size(); k++) {
+	  cblock.Add (bl[b][k], b);
+	  cpos.Add (bl[b][k], k);
+	}
+    dof2block = cblock.MoveTable();
+    dof2pos = cpos.MoveTable();
+  }
+
+
+  void VertexPatchSchwarz :: SetupPatches (Patches & p, bool color)  {
+
+    int ndof = GetAMatrix().VHeight();
+    Table<int> dof2block, dof2pos;
+    DofBlocks (*p.blocks, ndof, dof2block, dof2pos);
+    if (color)
+      ColorBlocks (p, dynamic_cast<const MatrixGraph&> (*amat),
+		   dof2block);
+    if (GetAMatrix().IsComplex())
+      PatchUpdate<Complex> (p, p.csolver, dof2block, dof2pos);
+    else
+      PatchUpdate<double> (p, p.rsolver, dof2block, dof2pos);
+  }
+
+
+  // the dofs in dofs that are not identified with another one
+  static void MasterDofs (Array<int> & dofs, FlatArray<int> dofmaster)  {
+
+    int k = 0;
+    for (int d : dofs)
+      if (d >= 0 && dofmaster[d] == d) dofs[k++] = d;
+    dofs.SetSize(k);
+  }
+
+  // identified nodes may add a dof twice to a block (one element across)
+  static shared_ptr<Table<int>> UniqueBlocks (Table<int> & blocks)  {
+
+    for (int b = 0; b < blocks.Size(); b++)
+      QuickSort (blocks[b]);
+    TableCreator<int> unique(blocks.Size());
+    for ( ; !unique.Done(); unique++)
+      for (int b = 0; b < blocks.Size(); b++)
+	for (int j = 0; j < blocks[b].Size(); j++)
+	  if (j == 0 || blocks[b][j] != blocks[b][j-1])
+	    unique.Add (b, blocks[b][j]);
+
+    return make_shared<Table<int>> (unique.MoveTable());
+  }
+
+
+  shared_ptr<Table<int>> VertexPatchSchwarz ::
+  CreateBlocks (shared_ptr<BitArray> freedofs)  {
 
     shared_ptr<FESpace> fes = bfa -> GetFESpace();
     
@@ -172,8 +257,20 @@ namespace ngcomp  {
         A table-creator creates a table in compressed form.  
 	A filtered table-creator also filters out Dirichlet-dofs and
 	eliminated internal dofs.
+
+	With periodic spaces, the patch of a vertex is that of its
+	master vertex, and only master dofs enter (the dofs of a
+	slave node are those of its master node, which is added
+	to the same patches).
      */
 
+    Array<int> dofmaster, vmaster;
+    bool periodic = PeriodicMaps (dofmaster, vmaster);
+
+    auto masters = [&] (Array<int> & dofs) {
+      if (periodic) MasterDofs (dofs, dofmaster);
+    };
+
     FilteredTableCreator creator(freedofs.get());
 
     while (!creator.Done())  {
@@ -184,9 +281,10 @@ namespace ngcomp  {
 	
 	// vdofs = dof# of vertex i (many for compound space)
 	fes->GetVertexDofNrs(i,vdofs);
+	masters(vdofs);
 
 	// to the block of vertex i, add that vertex dof
-	creator.Add(i, vdofs);  // Add(block#, array of dof#s)
+	creator.Add(vmaster[i], vdofs);  // Add(block#, array of dof#s)
       }
 
       for (int i=0; i < ma->GetNEdges(); i++) {
@@ -196,9 +294,10 @@ namespace ngcomp  {
 	  
 	  // collect dof nums interior to edge i in dofs.
 	  fes->GetEdgeDofNrs(i,dofs);
+	  masters(dofs);
 	
 	for (int j=0; j<2; j++) 
-	  creator.Add(pnums[j],dofs);
+	  creator.Add(vmaster[pnums[j]],dofs);
       }
       
       if (ma->GetDimension()==3) {   // 3D case 
@@ -210,9 +309,10 @@ namespace ngcomp  {
 	  
 	  // collect dof nums interior to face i in dofs.
 	  fes->GetFaceDofNrs(i,dofs);
+	  masters(dofs);
 	  
 	  for (int j=0; j<pnums.Size(); j++) 
-	    creator.Add(pnums[j],dofs);
+	    creator.Add(vmaster[pnums[j]],dofs);
 	}
       }
       
@@ -221,28 +321,820 @@ namespace ngcomp  {
     
     //cout << "Blocks: "<< endl << *creator.GetTable() << endl;
     
-    //jacobi = mat.CreateBlockJacobiPrecond (shared_ptr<Table<int>>(creator.GetTable()));
-    jacobi = mat.CreateBlockJacobiPrecond (make_shared<Table<int>> (creator.MoveTable()));
+    Table<int> blocks = creator.MoveTable();
+    auto patches = periodic ? UniqueBlocks (blocks)
+      : make_shared<Table<int>> (move(blocks));
+    if (!activevertices)
+      return patches;
 
-    if (addcoarse) {
-      int ndof = fes->GetNDof();
-      auto coarsedofs = make_shared<BitArray>(ndof);
-      coarsedofs->Clear();
+    // local smoothing: the patches of the active vertices only
+    BitArray active (ma->GetNV());
+    active.Clear();
+    for (int i = 0; i < ma->GetNV(); i++)
+      if (activevertices->Test(i)) active.Set (vmaster[i]);
 
-      for (int i=0; i<ndof; i++) 
-	if (fes->GetDofCouplingType(i) == WIREBASKET_DOF)
-	  coarsedofs->Set(i);
-      coarsedofs->And(*fes->GetFreeDofs());
+    TableCreator<int> selected;
+    for ( ; !selected.Done(); selected++)  {
+      int k = 0;
+      for (int b = 0; b < patches->Size(); b++)
+	if (active.Test(b) && (*patches)[b].Size())
+	  selected.Add (k++, (*patches)[b]);
+    }
+    return make_shared<Table<int>> (selected.MoveTable());
+  }
 
-      coarseinv = mat.InverseMatrix(coarsedofs);
+
+  /*
+    The identifications of periodic spaces (periodicdofmap.hpp), for
+    the space or its components. Returns false if there are none, and
+    otherwise the master of each dof and vertex.
+  */
+
+  bool VertexPatchSchwarz ::
+  PeriodicMaps (Array<int> & dofmaster, Array<int> & vmaster) const  {
+
+    shared_ptr<FESpace> fes = bfa -> GetFESpace();
+
+    dofmaster.SetSize (fes->GetNDof());
+    for (int i = 0; i < dofmaster.Size(); i++) dofmaster[i] = i;
+    vmaster.SetSize (ma->GetNV());
+    for (int i = 0; i < vmaster.Size(); i++) vmaster[i] = i;
+
+    bool periodic = false;
+    auto add = [&] (const FESpace & space, int offset) {
+      auto map = dynamic_cast<const dpg::PeriodicDofMap*> (&space);
+      if (!map) return;
+      periodic = true;
+      for (int i = 0; i < space.GetNDof(); i++)
+	dofmaster[offset+i] = offset + map->MasterDof(i);
+      for (int v = 0; v < vmaster.Size(); v++)
+	vmaster[v] = map->MasterVertex(v);
+    };
+
+    auto cfes = dynamic_pointer_cast<CompoundFESpace> (fes);
+    if (cfes)
+      for (int i = 0; i < cfes->GetNSpaces(); i++)
+	add (*(*cfes)[i], cfes->GetRange(i).First());
+    else
+      add (*fes, 0);
+
+    return periodic;
+  }
+
+
+  /*
+    Patches of one color share no dof and no matrix entry couples their
+    dofs, so they can be smoothed concurrently with the same result as
+    in any sequential order. Greedy coloring of the conflict graph.
+  */
+
+  void VertexPatchSchwarz ::
+  ColorBlocks (Patches & p, const MatrixGraph & graph,
+	       const Table<int> & dof2block)  {
+
+    const Table<int> & bl = *p.blocks;
+    int nblocks = bl.Size();
+
+    Array<int> color(nblocks);
+    Array<int> usedby;           // usedby[c] == b: c taken by a neighbor of b
+    int ncolors = 0;
+
+    for (int b = 0; b < nblocks; b++) {
+      for (int i : bl[b])
+	for (int j : graph.GetRowIndices(i))
+	  for (int c : dof2block[j])
+	    if (c < b) usedby[color[c]] = b;
+      int cb = 0;
+      while (cb < ncolors && usedby[cb] == b) cb++;
+      if (cb == ncolors) {
+	ncolors++;
+	usedby.Append(-1);
+      }
+      color[b] = cb;
     }
-    
-    if (test) Test();
+
+    TableCreator<int> creator(ncolors);
+    for ( ; !creator.Done(); creator++)
+      for (int b = 0; b < nblocks; b++)
+	creator.Add (color[b], b);
+    p.colors = creator.MoveTable();
+
+    cout << endl << "VertexPatchSchwarz: " << nblocks << " patches in "
+	 << ncolors << " colors" << endl;
+  }
+
+
+  /*
+    The patch matrix of a vertex is the restriction of the (condensed)
+    matrix to the patch dofs. In matrix-free mode it is the sum of the
+    element Schur complements restricted to the patch: each element
+    matrix is computed once and scattered into all patches containing
+    its dofs.
+  */
+  
+  template <class SCAL>
+  void VertexPatchSchwarz ::
+  PatchUpdate (Patches & p, shared_ptr<dpg::PatchSolver<SCAL>> & solver,
+	       const Table<int> & dof2block, const Table<int> & dof2pos)  {
+
+    static Timer t("VertexPatchSchwarz::PatchUpdate");
+    RegionTimer reg(t);
+
+    const Table<int> & bl = *p.blocks;
+    int nblocks = bl.Size();
+
+    Array<int> sizes(nblocks);
+    for (int b = 0; b < nblocks; b++) sizes[b] = bl[b].Size();
+    auto previous = solver;     // of the last Update, e.g. before refinement
+    solver = make_shared<dpg::PatchSolver<SCAL>> (sizes, single, reuse);
+
+    if (mf) {
+      LocalHeap lh(10000000, "vertexschwarz");
+      for (VorB vb : { VOL, BND })
+	for (int i = 0; i < ma->GetNE(vb); i++) {
+
+	  HeapReset hr(lh);
+	  FlatArray<int> ext;
+	  FlatMatrix<SCAL> s = mf->ElementSchur<SCAL> (ElementId(vb, i), ext, lh);
+
+	  for (int k = 0; k < ext.Size(); k++)
+	    for (int jb = 0; jb < dof2block[ext[k]].Size(); jb++) {
+	      int b = dof2block[ext[k]][jb];
+	      int pk = dof2pos[ext[k]][jb];
+	      FlatMatrix<SCAL> pm = solver->GetMatrix(b);
+	      for (int l = 0; l < ext.Size(); l++)
+		for (int jl = 0; jl < dof2block[ext[l]].Size(); jl++)
+		  if (dof2block[ext[l]][jl] == b)
+		    pm(pk, dof2pos[ext[l]][jl]) += s(k,l);
+	    }
+	}
+    }
+    else {
+      const SparseMatrixTM<SCAL> & mat =
+	dynamic_cast<const SparseMatrixTM<SCAL>&> (*amat);
+      ParallelFor (Range(nblocks), [&] (int b) {
+	  FlatMatrix<SCAL> pm = solver->GetMatrix(b);
+	  for (int k = 0; k < bl[b].Size(); k++) {
+	    FlatArray<int> ri = mat.GetRowIndices(bl[b][k]);
+	    FlatVector<SCAL> rv = mat.GetRowValues(bl[b][k]);
+	    for (int j = 0; j < ri.Size(); j++)
+	      for (int jb = 0; jb < dof2block[ri[j]].Size(); jb++)
+		if (dof2block[ri[j]][jb] == b)
+		  pm(k, dof2pos[ri[j]][jb]) = rv(j);
+	  }
+	});
+    }
+
+    solver->Factor (previous.get());
+    if (previous)
+      cout << endl << "VertexPatchSchwarz: refactored "
+	   << solver->NumBlocks() - solver->NumReused() << " of "
+	   << solver->NumBlocks() << " patches" << endl;
+  }
+
+
+  template <class SCAL>
+  void VertexPatchSchwarz ::
+  T_PatchMult (const Patches & p, const dpg::PatchSolver<SCAL> & solver,
+	       const BaseVector & f, BaseVector & u, int steps,
+	       bool additive) const  {
+
+    const Table<int> & bl = *p.blocks;
+    u = 0.0;
+
+    if (mf || additive) {
+
+      // additive: u = sum over patches of  R_p^T inv(A_p) R_p f
+      // (a multiplicative sweep would need the assembled matrix)
+
+      ParallelFor (Range(bl.Size()), [&] (int b) {
+	  int n = bl[b].Size();
+	  if (n == 0) return;
+	  VectorMem<100,SCAL> up(n);
+	  f.GetIndirect (bl[b], up);
+	  solver.Solve (b, up);
+	  u.AddIndirect (bl[b], up, true);    // atomic
+	});
+      return;
+    }
+
+    // multiplicative: forward sweep over the colors, then backward,
+    // the patches of one color in parallel
+
+    static Timer t("VertexPatchSchwarz::ColoredSmooth");
+    RegionTimer reg(t);
+
+    const SparseMatrixTM<SCAL> & mat =
+      dynamic_cast<const SparseMatrixTM<SCAL>&> (*amat);
+    FlatVector<SCAL> fv = f.FV<SCAL>();
+    FlatVector<SCAL> uv = u.FV<SCAL>();
+    int nc = p.colors.Size();
+
+    for (int step = 0; step < 2*nc*steps; step++) {
+
+      int sc = step % (2*nc);
+      FlatArray<int> cblocks = p.colors[sc < nc ? sc : 2*nc-1-sc];
+      ParallelFor (Range(cblocks.Size()), [&] (int kb) {
+	  int b = cblocks[kb];
+	  int n = bl[b].Size();
+	  if (n == 0) return;
+	  VectorMem<100,SCAL> rp(n);
+
+	  // patch rows of the residual f - A u
+	  for (int k = 0; k < n; k++) {
+	    int row = bl[b][k];
+	    FlatArray<int> ri = mat.GetRowIndices(row);
+	    FlatVector<SCAL> rv = mat.GetRowValues(row);
+	    SCAL sum = fv(row);
+	    for (int j = 0; j < ri.Size(); j++)
+	      sum -= rv(j) * uv(ri[j]);
+	    rp(k) = sum;
+	  }
+
+	  solver.Solve (b, rp);
+	  for (int k = 0; k < n; k++)
+	    uv(bl[b][k]) += rp(k);
+	});
+    }
+  }
+
+  void VertexPatchSchwarz ::
+  PatchMult (const Patches & p, const BaseVector & f, BaseVector & u,
+	     int steps, bool additive) const  {
+
+    if (GetAMatrix().IsComplex())
+      T_PatchMult<Complex> (p, *p.csolver, f, u, steps, additive);
+    else
+      T_PatchMult<double> (p, *p.rsolver, f, u, steps, additive);
+  }
+
+
+  void VertexPatchSchwarz ::
+  AddCorrections (const BaseVector & f, BaseVector & u) const  {
+
+    if (addcoarse)
+      coarseinv->MultAdd( 1, f, u );  // u = u + 1 * inv(A0) * f
+  }
+
+
+  void VertexPatchSchwarz ::
+  MultBlock (FlatArray<shared_ptr<BaseVector>> f,
+	     FlatArray<shared_ptr<BaseVector>> u) const  {
+
+    if (jacobi || chebyshev) {
+      for (int l = 0; l < f.Size(); l++)
+	Mult (*f[l], *u[l]);
+      return;
+    }
+
+    if (GetAMatrix().IsComplex())
+      T_PatchMultBlock<Complex> (fine, *fine.csolver, f, u);
+    else
+      T_PatchMultBlock<double> (fine, *fine.rsolver, f, u);
+
+    for (int l = 0; l < f.Size(); l++)
+      AddCorrections (*f[l], *u[l]);
+  }
+
+
+  // T_PatchMult (one step) for k vectors: the patch values of all
+  // vectors are kept together (k x n) and solved with the same factor
+  template <class SCAL>
+  void VertexPatchSchwarz ::
+  T_PatchMultBlock (const Patches & p, const dpg::PatchSolver<SCAL> & solver,
+		    FlatArray<shared_ptr<BaseVector>> f,
+		    FlatArray<shared_ptr<BaseVector>> u) const  {
+
+    static Timer t("VertexPatchSchwarz::MultBlock");
+    RegionTimer reg(t);
+
+    const Table<int> & bl = *p.blocks;
+    int k = f.Size();
+    // sized first: FlatVector assignment copies values
+    Array<FlatVector<SCAL>> fv(k), uv(k);
+    for (int l = 0; l < k; l++) {
+      *u[l] = 0.0;
+      fv[l].AssignMemory (f[l]->FV<SCAL>().Size(), &f[l]->FV<SCAL>()(0));
+      uv[l].AssignMemory (u[l]->FV<SCAL>().Size(), &u[l]->FV<SCAL>()(0));
+    }
+
+    if (mf) {
+      ParallelFor (Range(bl.Size()), [&] (int b) {
+	  int n = bl[b].Size();
+	  if (n == 0) return;
+	  VectorMem<400,SCAL> mem(k*n);
+	  FlatMatrix<SCAL> up(k, n, &mem(0));
+	  for (int l = 0; l < k; l++) {
+	    f[l]->GetIndirect (bl[b], up.Row(l));
+	    solver.Solve (b, up.Row(l));
+	    u[l]->AddIndirect (bl[b], up.Row(l), true);    // atomic
+	  }
+	});
+      return;
+    }
+
+    const SparseMatrixTM<SCAL> & mat =
+      dynamic_cast<const SparseMatrixTM<SCAL>&> (*amat);
+    int nc = p.colors.Size();
+
+    for (int step = 0; step < 2*nc; step++) {
+
+      FlatArray<int> cblocks = p.colors[step < nc ? step : 2*nc-1-step];
+      ParallelFor (Range(cblocks.Size()), [&] (int kb) {
+	  int b = cblocks[kb];
+	  int n = bl[b].Size();
+	  if (n == 0) return;
+	  VectorMem<400,SCAL> mem(k*n);
+	  FlatMatrix<SCAL> rp(k, n, &mem(0));
+
+	  // patch rows of the residuals f - A u, each row read once
+	  for (int kk = 0; kk < n; kk++) {
+	    int row = bl[b][kk];
+	    FlatArray<int> ri = mat.GetRowIndices(row);
+	    FlatVector<SCAL> rv = mat.GetRowValues(row);
+	    for (int l = 0; l < k; l++) rp(l,kk) = fv[l](row);
+	    for (int j = 0; j < ri.Size(); j++)
+	      for (int l = 0; l < k; l++)
+		rp(l,kk) -= rv(j) * uv[l](ri[j]);
+	  }
+
+	  for (int l = 0; l < k; l++) {
+	    solver.Solve (b, rp.Row(l));
+	    for (int kk = 0; kk < n; kk++)
+	      uv[l](bl[b][kk]) += rp(l,kk);
+	  }
+	});
+    }
+  }
+
+
+  /*
+    Chebyshev iteration for A u = f, from u = 0, preconditioned by the
+    additive patch operator B, for the spectrum of B A in [lmin, lmax].
+    A fixed number of steps makes this a polynomial in B A, times B:
+    symmetric and positive definite (a preconditioner for CG).
+  */
+
+  void VertexPatchSchwarz ::
+  ChebyshevMult (const BaseVector & f, BaseVector & u) const  {
+
+    static Timer t("VertexPatchSchwarz::Chebyshev");
+    RegionTimer reg(t);
+
+    const BaseMatrix & A = GetAMatrix();
+    double theta = (lmax + lmin) / 2, delta = (lmax - lmin) / 2;
+    double sigma = theta / delta, rho = 1 / sigma;
+
+    auto r = f.CreateVector();
+    auto d = f.CreateVector();
+    auto w = f.CreateVector();
+
+    *r = f;
+    PatchMult (fine, *r, *w, 1, true);
+    *d = (1/theta) * *w;
+    u = *d;
+
+    for (int k = 1; k < chebyshev; k++) {
+      A.MultAdd (-1.0, *d, *r);
+      double rhonew = 1 / (2*sigma - rho);
+      PatchMult (fine, *r, *w, 1, true);
+      *d *= rhonew * rho;
+      *d += (2*rhonew/delta) * *w;
+      u += *d;
+      rho = rhonew;
+    }
+  }
+
+
+  template <class SCAL>
+  static double Dot (const BaseVector & a, const BaseVector & b)  {
+
+    FlatVector<SCAL> av = a.FV<SCAL>(), bv = b.FV<SCAL>();
+    SCAL sum = 0.0;
+    for (size_t i = 0; i < av.Size(); i++) sum += Conj(av(i)) * bv(i);
+    return real(sum);
+  }
+
+  // the number of eigenvalues below x of the symmetric tridiagonal
+  // matrix with diagonal d and off-diagonal e (Sturm sequence)
+  static int CountBelow (FlatArray<double> d, FlatArray<double> e, double x)  {
+
+    int count = 0;
+    double q = 1;
+    for (int i = 0; i < d.Size(); i++) {
+      q = d[i] - x - (i > 0 ? e[i-1]*e[i-1] / q : 0.0);
+      if (q == 0) q = 1e-300;
+      if (q < 0) count++;
+    }
+    return count;
+  }
+
+
+  /*
+    A few CG steps for A with the additive patch preconditioner B, on a
+    random right hand side, give the Lanczos tridiagonal matrix of B A;
+    its extreme eigenvalues (by bisection) estimate those of B A from
+    inside. The interval is widened by 10 percent at both ends to
+    bracket the spectrum: the Chebyshev iteration diverges on
+    eigenvalues above it (B would become indefinite), and converges
+    slowly on those below.
+  */
+
+  template <class SCAL>
+  void VertexPatchSchwarz :: T_EstimateSpectrum ()  {
+
+    static Timer t("VertexPatchSchwarz::EstimateSpectrum");
+    RegionTimer reg(t);
+
+    const BaseMatrix & A = GetAMatrix();
+    auto r = A.CreateVector();
+    auto z = A.CreateVector();
+    auto p = A.CreateVector();
+    auto ap = A.CreateVector();
+
+    FlatVector<SCAL> rv = r->FV<SCAL>();
+    srand(1);
+    for (size_t i = 0; i < rv.Size(); i++)
+      rv(i) = double(rand()) / RAND_MAX - 0.5;
+
+    Array<double> alpha, beta;
+    PatchMult (fine, *r, *z, 1, true);
+    *p = *z;
+    double rz = Dot<SCAL> (*r, *z), rz0 = rz;
+
+    for (int j = 0; j < lanczossteps && rz > 1e-30 * rz0; j++) {
+      A.Mult (*p, *ap);
+      double a = rz / Dot<SCAL> (*p, *ap);
+      *r -= a * *ap;
+      PatchMult (fine, *r, *z, 1, true);
+      double rznew = Dot<SCAL> (*r, *z);
+      alpha.Append (a);
+      beta.Append (rznew / rz);
+      *p *= beta.Last();
+      *p += *z;
+      rz = rznew;
+    }
+
+    int n = alpha.Size();
+    if (n == 0) {                         // B r = 0: nothing to smooth
+      lmin = 0; lmax = 1;
+      return;
+    }
+    Array<double> d(n), e(n-1);
+    for (int j = 0; j < n; j++) {
+      d[j] = 1/alpha[j] + (j > 0 ? beta[j-1]/alpha[j-1] : 0.0);
+      if (j < n-1) e[j] = sqrt(beta[j]) / alpha[j];
+    }
+
+    // Gershgorin interval, then bisection
+    double lo = d[0], hi = d[0];
+    for (int j = 0; j < n; j++) {
+      double rad = (j > 0 ? fabs(e[j-1]) : 0.0) + (j < n-1 ? fabs(e[j]) : 0.0);
+      lo = min2(lo, d[j] - rad);
+      hi = max2(hi, d[j] + rad);
+    }
+    auto eigenvalue = [&] (int k) {       // the k-th smallest, from 1
+      double a = lo, b = hi;
+      for (int it = 0; it < 100; it++) {
+	double m = (a + b) / 2;
+	if (CountBelow (d, e, m) >= k) b = m; else a = m;
+      }
+      return (a + b) / 2;
+    };
+
+    lmin = max2 (0.9 * eigenvalue(1), 0.0);
+    lmax = 1.1 * eigenvalue(n);
+
+    cout << endl << "VertexPatchSchwarz: Chebyshev degree " << chebyshev
+	 << " on [" << lmin << ", " << lmax << "] from "
+	 << n << " Lanczos steps" << endl;
+  }
+
+
+  void VertexPatchSchwarz :: EstimateSpectrum ()  {
+
+    if (GetAMatrix().IsComplex())
+      T_EstimateSpectrum<Complex> ();
+    else
+      T_EstimateSpectrum<double> ();
   }
   
 
+
+
+  ////////////////////////////////////////////////////////////////////////
+  //  EdgePatchSchwarz
+  ////////////////////////////////////////////////////////////////////////
+
+  EdgePatchSchwarz ::
+  EdgePatchSchwarz (const PDE & pde, const Flags & flags, const string & aname)
+    : VertexPatchSchwarz (pde, flags, aname)  {
+
+    gradients = flags.GetDefineFlag("gradients");
+    cout << endl << "VertexPatchSchwarz on edge patches" ;
+    if (gradients) cout << " with vertex gradient corrections" ;
+  }
+
+  EdgePatchSchwarz ::
+  EdgePatchSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
+		    const string aname)
+    : VertexPatchSchwarz (abfa, aflags, aname)  {
+
+    gradients = flags.GetDefineFlag("gradients");
+    cout << endl << "VertexPatchSchwarz on edge patches" ;
+    if (gradients) cout << " with vertex gradient corrections" ;
+  }
+
+
+  void EdgePatchSchwarz :: Update()  {
+
+    VertexPatchSchwarz::Update();
+
+    grad.blocks = nullptr;
+    if (!gradients) return;
+    if (jacobi) {
+      cout << endl << "EdgePatchSchwarz: no gradient corrections with "
+	   << "sequential smoothing" << endl;
+      return;
+    }
+
+    GradientBlocks (bfa->GetFESpace()->GetFreeDofs());
+
+    int ndof = GetAMatrix().VHeight();
+    Table<int> dof2block, dof2pos;
+    DofBlocks (*grad.blocks, ndof, dof2block, dof2pos);
+    ColorBlocks (grad, dynamic_cast<const MatrixGraph&> (*amat),
+		 dof2block);
+    if (GetAMatrix().IsComplex())
+      GradientUpdate<Complex> (grad.csolver, dof2block, dof2pos);
+    else
+      GradientUpdate<double> (grad.rsolver, dof2block, dof2pos);
+  }
+
+
+  void EdgePatchSchwarz ::
+  AddCorrections (const BaseVector & f, BaseVector & u) const  {
+
+    VertexPatchSchwarz::AddCorrections (f, u);
+
+    if (grad.blocks) {
+      auto w = u.CreateVector();
+      if (GetAMatrix().IsComplex())
+	GradientMult<Complex> (*grad.csolver, f, *w);
+      else
+	GradientMult<double> (*grad.rsolver, f, *w);
+      u += *w;
+    }
+  }
+
+
+  /*
+    The patch of an edge. With periodic spaces, identified edges (the
+    master edge has the master vertices) share one patch.
+  */
+
+  shared_ptr<Table<int>> EdgePatchSchwarz ::
+  CreateBlocks (shared_ptr<BitArray> freedofs)  {
+
+    shared_ptr<FESpace> fes = bfa -> GetFESpace();
+    int ned = ma->GetNEdges();
+
+    Array<int> dofmaster, vmaster;
+    bool periodic = PeriodicMaps (dofmaster, vmaster);
+
+    Array<int> emaster(ned);
+    for (int i = 0; i < ned; i++) emaster[i] = i;
+    if (periodic) {
+      HashTable<INT<2>, int> vp2e(ned);
+      for (int i = 0; i < ned; i++) {
+	auto pnums = ma->GetEdgePNums(i);
+	if (vmaster[pnums[0]] == pnums[0] && vmaster[pnums[1]] == pnums[1]) {
+	  INT<2> key(pnums[0], pnums[1]);
+	  key.Sort();
+	  vp2e[key] = i;
+	}
+      }
+      for (int i = 0; i < ned; i++) {
+	auto pnums = ma->GetEdgePNums(i);
+	INT<2> key(vmaster[pnums[0]], vmaster[pnums[1]]);
+	key.Sort();
+	if (vp2e.Used(key)) emaster[i] = vp2e[key];
+      }
+    }
+
+    auto masters = [&] (Array<int> & dofs) {
+      if (periodic) MasterDofs (dofs, dofmaster);
+    };
+
+    FilteredTableCreator creator(freedofs.get());
+
+    while (!creator.Done())  {
+
+      Array<int> dofs, fedges;
+
+      for (int i = 0; i < ned; i++) {
+
+	fes->GetEdgeDofNrs (i, dofs);
+	masters (dofs);
+	creator.Add (emaster[i], dofs);
+
+	auto pnums = ma->GetEdgePNums(i);
+	for (int j = 0; j < 2; j++) {
+	  fes->GetVertexDofNrs (pnums[j], dofs);
+	  masters (dofs);
+	  creator.Add (emaster[i], dofs);
+	}
+      }
+
+      if (ma->GetDimension()==3)
+	for (int i = 0; i < ma->GetNFaces(); i++) {
+	  fes->GetFaceDofNrs (i, dofs);
+	  masters (dofs);
+	  ma->GetFaceEdges (i, fedges);
+	  for (int e : fedges)
+	    creator.Add (emaster[e], dofs);
+	}
+
+      creator++;
+    }
+
+    Table<int> blocks = creator.MoveTable();
+    return UniqueBlocks (blocks);
+  }
+
+
+  /*
+    In the lowest-order H(curl) space (NGSolve's first edge dof, the
+    Whitney function l_a grad l_b - l_b grad l_a of the edge from the
+    vertex a with the lower number to b), the gradient of the hat
+    function of a vertex v is
+
+        grad l_v = sum over edges e at v of  +-1 * (Whitney function of e),
+
+    with +1 if v is the end b of e, -1 if v is its start a. A vertex is
+    used if the lowest-order dofs of all its edges are free (its hat
+    function is in the space).
+  */
+
+  void EdgePatchSchwarz :: GradientBlocks (shared_ptr<BitArray> freedofs)  {
+
+    shared_ptr<FESpace> fes = bfa -> GetFESpace();
+    int nv = ma->GetNV();
+    int ned = ma->GetNEdges();
+
+    Array<int> dofmaster, vmaster;
+    PeriodicMaps (dofmaster, vmaster);
+
+    // the lowest-order H(curl) components
+    Array<shared_ptr<FESpace>> comps;
+    Array<int> offsets;
+    auto add = [&] (shared_ptr<FESpace> space, int offset) {
+      if (dynamic_pointer_cast<HCurlHighOrderFESpace> (space)) {
+	comps.Append (space);
+	offsets.Append (offset);
+      }
+    };
+    auto cfes = dynamic_pointer_cast<CompoundFESpace> (fes);
+    if (cfes)
+      for (int i = 0; i < cfes->GetNSpaces(); i++)
+	add ((*cfes)[i], cfes->GetRange(i).First());
+    else
+      add (fes, 0);
+
+    // the lowest-order dof of each edge (-1 if a slave), by component
+    Array<int> edof(comps.Size() * ned);
+    BitArray fixed (comps.Size() * nv);
+    fixed.Clear();
+    Array<int> dofs;
+    for (int c = 0; c < comps.Size(); c++)
+      for (int i = 0; i < ned; i++) {
+	comps[c]->GetEdgeDofNrs (i, dofs);
+	int & d = edof[c*ned+i];
+	d = dofs.Size() ? offsets[c] + dofs[0] : -1;
+	if (d < 0) continue;
+	auto pnums = ma->GetEdgePNums(i);
+	if (!freedofs->Test(dofmaster[d]))
+	  for (int j = 0; j < 2; j++)
+	    fixed.Set (c*nv + vmaster[pnums[j]]);
+	if (dofmaster[d] != d || vmaster[pnums[0]] == vmaster[pnums[1]])
+	  d = -1;
+      }
+
+    TableCreator<int> cdofs(comps.Size() * nv);
+    TableCreator<double> csign(comps.Size() * nv);
+    for ( ; !cdofs.Done(); cdofs++, csign++)
+      for (int c = 0; c < comps.Size(); c++)
+	for (int i = 0; i < ned; i++) {
+	  int d = edof[c*ned+i];
+	  if (d < 0) continue;
+	  auto pnums = ma->GetEdgePNums(i);
+	  int a = vmaster[pnums[0]], b = vmaster[pnums[1]];
+	  if (a > b) swap (a, b);
+	  if (!fixed.Test(c*nv+a)) {
+	    cdofs.Add (c*nv+a, d);
+	    csign.Add (c*nv+a, -1.0);
+	  }
+	  if (!fixed.Test(c*nv+b)) {
+	    cdofs.Add (c*nv+b, d);
+	    csign.Add (c*nv+b, 1.0);
+	  }
+	}
+
+    grad.blocks = make_shared<Table<int>> (cdofs.MoveTable());
+    gsign = csign.MoveTable();
+
+    cout << endl << "EdgePatchSchwarz: " << comps.Size()
+	 << " H(curl) components for gradient corrections" << endl;
+  }
+
+
+  // the 1 x 1 matrix g^T A g of each vertex gradient g
+  template <class SCAL>
+  void EdgePatchSchwarz ::
+  GradientUpdate (shared_ptr<dpg::PatchSolver<SCAL>> & solver,
+		  const Table<int> & dof2block, const Table<int> & dof2pos)  {
+
+    const Table<int> & bl = *grad.blocks;
+    int nblocks = bl.Size();
+
+    Array<int> sizes(nblocks);
+    for (int b = 0; b < nblocks; b++) sizes[b] = bl[b].Size() ? 1 : 0;
+    auto previous = solver;     // of the last Update, e.g. before refinement
+    solver = make_shared<dpg::PatchSolver<SCAL>> (sizes, single, reuse);
+
+    const SparseMatrixTM<SCAL> & mat =
+      dynamic_cast<const SparseMatrixTM<SCAL>&> (*amat);
+    ParallelFor (Range(nblocks), [&] (int b) {
+	if (bl[b].Size() == 0) return;
+	SCAL sum = 0.0;
+	for (int k = 0; k < bl[b].Size(); k++) {
+	  FlatArray<int> ri = mat.GetRowIndices(bl[b][k]);
+	  FlatVector<SCAL> rv = mat.GetRowValues(bl[b][k]);
+	  for (int j = 0; j < ri.Size(); j++)
+	    for (int jb = 0; jb < dof2block[ri[j]].Size(); jb++)
+	      if (dof2block[ri[j]][jb] == b)
+		sum += gsign[b][k] * rv(j) * gsign[b][dof2pos[ri[j]][jb]];
+	}
+	solver->GetMatrix(b)(0,0) = sum;
+      });
+
+    solver->Factor (previous.get());
+    if (previous)
+      cout << endl << "VertexPatchSchwarz: refactored "
+	   << solver->NumBlocks() - solver->NumReused() << " of "
+	   << solver->NumBlocks() << " patches" << endl;
+  }
+
+
+  template <class SCAL>
+  void EdgePatchSchwarz ::
+  GradientMult (const dpg::PatchSolver<SCAL> & solver,
+		const BaseVector & f, BaseVector & u) const  {
+
+    static Timer t("EdgePatchSchwarz::GradientMult");
+    RegionTimer reg(t);
+
+    const Table<int> & bl = *grad.blocks;
+    const SparseMatrixTM<SCAL> & mat =
+      dynamic_cast<const SparseMatrixTM<SCAL>&> (*amat);
+    FlatVector<SCAL> fv = f.FV<SCAL>();
+    FlatVector<SCAL> uv = u.FV<SCAL>();
+    u = 0.0;
+    int nc = grad.colors.Size();
+
+    for (int step = 0; step < 2*nc; step++) {
+
+      FlatArray<int> cblocks = grad.colors[step < nc ? step : 2*nc-1-step];
+      ParallelFor (Range(cblocks.Size()), [&] (int kb) {
+	  int b = cblocks[kb];
+	  if (bl[b].Size() == 0) return;
+
+	  // g^T (f - A u)
+	  VectorMem<1,SCAL> r(1);
+	  r(0) = 0.0;
+	  for (int k = 0; k < bl[b].Size(); k++) {
+	    int row = bl[b][k];
+	    FlatArray<int> ri = mat.GetRowIndices(row);
+	    FlatVector<SCAL> rv = mat.GetRowValues(row);
+	    SCAL sum = fv(row);
+	    for (int j = 0; j < ri.Size(); j++)
+	      sum -= rv(j) * uv(ri[j]);
+	    r(0) += gsign[b][k] * sum;
+	  }
+
+	  solver.Solve (b, r);
+	  for (int k = 0; k < bl[b].Size(); k++)
+	    uv(bl[b][k]) += gsign[b][k] * r(0);
+	});
+    }
+  }
+
+
   static RegisterPreconditioner<VertexPatchSchwarz> 
   initschwarz ("vertexschwarz");
 
+  static RegisterPreconditioner<EdgePatchSchwarz> 
+  initedgeschwarz ("edgeschwarz");
+
 }
 
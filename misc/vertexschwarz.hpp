@@ -0,0 +1,253 @@
+#ifndef FILE_VERTEXSCHWARZ_HPP
+#define FILE_VERTEXSCHWARZ_HPP
+
+/*
+
+  Provides Schwarz subspace correction preconditioners using vertex
+  patches.
+
+  All dofs, after condensation, that are on facets connected to a
+  vertex, define the subspaces. Corrections on these subspaces are
+  multiplicatively combined (a forward and a backward sweep).
+
+  The patches are colored such that patches of one color neither share
+  dofs nor are coupled by the matrix. The sweeps go over the colors in
+  sequence and smooth the patches of a color in parallel. Symmetric
+  (lower triangle) and block matrices fall back to the sequential
+  sweeps of NGSolve's block Jacobi, as does the flag "sequential".
+
+  An optional coarse solve using wirebasket dofs ("addcoarse") is
+  turned off by default. Its sparse direct factor grows super-linearly
+  with the mesh. For a coarse level whose cost grows linearly, on the
+  refinement hierarchy of the mesh, use the multilevel version,
+  mlschwarz (multilevelschwarz.hpp).
+
+  With periodic spaces (h1ho_periodic, hcurlho_periodic, also as
+  components of a compound space), identified vertices share one
+  patch, built from the master dofs only (periodicdofmap.hpp).
+
+  The preconditioner "edgeschwarz" uses edge patches instead (for
+  H(curl) traces), with optional gradient corrections; see below.
+
+  Without an assembled matrix, the patch matrices are summed from the
+  element matrices of a DPGMatrixFree operator, and the corrections
+  are combined additively.
+
+  With chebyshev=k, the additive patch operator B (no sweeps: all
+  patches in parallel) is used in k steps of a Chebyshev iteration,
+  for the spectrum of B A estimated in Update by "lanczossteps" (20)
+  CG steps. Each step is one multiplication with A and one with B.
+
+  The patch matrices are factored once (patchsolver.hpp); with the
+  flag "single" the factors are kept in single precision. With the
+  flag "reuse", for adaptive loops, patches whose matrix did not change
+  keep their factors on a later Update (after a local refinement), so
+  the setup cost grows with the refined region. For this the
+  unfactored patch matrices are kept as well, in full precision (the
+  memory of the patch matrices once more), so it is off by default.
+
+  SetActiveVertices restricts the patches to those of a set of
+  vertices, for the local smoothing of the multilevel version.
+
+*/
+
+
+#include <solve.hpp>
+#include "dpgmatrixfree.hpp"
+#include "patchsolver.hpp"
+#include "pcgsolver.hpp"
+
+
+namespace ngcomp  {
+
+  class VertexPatchSchwarz : public Preconditioner, public dpg::BlockMult  {
+
+  protected:
+
+    shared_ptr<BilinearForm> bfa;
+    shared_ptr<BaseBlockJacobiPrecond> jacobi;
+    shared_ptr<BaseMatrix>  coarseinv;
+    bool                    addcoarse;
+    bool                    sequential = false;
+
+    // the matrix at the last Update (kept if the mesh is refined)
+    shared_ptr<BaseMatrix> amat;
+
+    // matrix-free mode: the operator
+    shared_ptr<dpg::DPGMatrixFree> mf;
+
+    // patches (blocks of dofs), by color, and their factorizations
+    struct Patches {
+      shared_ptr<Table<int>> blocks;
+      Table<int> colors;
+      shared_ptr<dpg::PatchSolver<double>>  rsolver;
+      shared_ptr<dpg::PatchSolver<Complex>> csolver;
+    };
+
+    Patches fine;
+    bool single = false;             // factors kept in single precision
+    bool reuse = false;              // factors of unchanged patches
+    shared_ptr<BitArray> activevertices;   // patches to smooth (all if null)
+    int chebyshev = 0;               // degree of the Chebyshev iteration
+    int lanczossteps = 20;
+    double lmin = 0, lmax = 0;       // bounds of the spectrum of B A
+
+  public:
+
+    VertexPatchSchwarz (const PDE & pde, const Flags & flags,
+			const string & aname);
+    VertexPatchSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
+                        const string aname = "mgprecond");
+    VertexPatchSchwarz (shared_ptr<dpg::DPGMatrixFree> amf,
+			const Flags & aflags,
+			const string aname = "vertexschwarz");
+
+    virtual ~VertexPatchSchwarz ();
+
+    // restrict the patches to those of the set vertices (local
+    // smoothing, multilevelschwarz.hpp); takes effect at the next Update
+    void SetActiveVertices (shared_ptr<BitArray> av)  { activevertices = av; }
+
+    virtual void Update();
+
+    // the patches (blocks of dofs) of the last Update
+    shared_ptr<Table<int>> GetBlocks () const { return fine.blocks; }
+
+    // the interval for the Chebyshev iteration (chebyshev > 0)
+    double SpectrumMin () const { return lmin; }
+    double SpectrumMax () const { return lmax; }
+
+    // patches whose factors the last Update took from the one before
+    size_t NumReused () const {
+      if (fine.rsolver) return fine.rsolver->NumReused();
+      if (fine.csolver) return fine.csolver->NumReused();
+      return 0;
+    }
+
+    virtual int VHeight() const { return GetAMatrix().VHeight(); }
+
+    virtual int VWidth() const { return GetAMatrix().VWidth(); }
+
+    virtual void Mult (const BaseVector & f, BaseVector & u) const  {
+
+      // jacobi -> Mult (f, u);
+
+      if (jacobi) {
+	u = 0.0;
+	jacobi -> GSSmooth (u, f);
+	jacobi -> GSSmoothBack (u, f);
+      }
+      else if (chebyshev)
+	ChebyshevMult (f, u);
+      else
+	PatchMult (fine, f, u, 1);  // colored sweeps, or additive if matrix-free
+
+      AddCorrections (f, u);
+    }
+
+    // the same for several vectors, reading the matrix rows and patch
+    // factors once for all (used by dpg::BlockPCG)
+    virtual void MultBlock (FlatArray<shared_ptr<BaseVector>> f,
+			    FlatArray<shared_ptr<BaseVector>> u) const;
+
+    virtual const BaseMatrix & GetAMatrix() const   {
+
+      if (mf) return *mf;
+      if (amat) return *amat;
+      return bfa -> GetMatrix();
+    }
+
+  protected:
+
+    virtual shared_ptr<Table<int>> CreateBlocks (shared_ptr<BitArray> freedofs);
+
+    bool PeriodicMaps (Array<int> & dofmaster, Array<int> & vmaster) const;
+
+    void SetupPatches (Patches & p, bool color);
+
+    void ColorBlocks (Patches & p, const MatrixGraph & graph,
+		      const Table<int> & dof2block);
+
+    template <class SCAL>
+    void PatchUpdate (Patches & p, shared_ptr<dpg::PatchSolver<SCAL>> & solver,
+		      const Table<int> & dof2block, const Table<int> & dof2pos);
+
+    // steps forward and backward sweeps from u = 0, or with additive
+    // (or matrix-free), the sum of the patch corrections
+    void PatchMult (const Patches & p, const BaseVector & f, BaseVector & u,
+		    int steps, bool additive = false) const;
+
+    template <class SCAL>
+    void T_PatchMult (const Patches & p, const dpg::PatchSolver<SCAL> & solver,
+		      const BaseVector & f, BaseVector & u, int steps,
+		      bool additive) const;
+
+    void ChebyshevMult (const BaseVector & f, BaseVector & u) const;
+
+    // u += coarse level (and other additive) corrections
+    virtual void AddCorrections (const BaseVector & f, BaseVector & u) const;
+
+    template <class SCAL>
+    void T_PatchMultBlock (const Patches & p,
+			   const dpg::PatchSolver<SCAL> & solver,
+			   FlatArray<shared_ptr<BaseVector>> f,
+			   FlatArray<shared_ptr<BaseVector>> u) const;
+
+    void EstimateSpectrum ();
+    template <class SCAL> void T_EstimateSpectrum ();
+  };
+
+
+  /*
+    Edge patches, for H(curl) traces: the subspace of an edge has the
+    (condensed) dofs on the edge, on its faces (3D) and on its two
+    vertices. Otherwise as above (colors, flags), except that there is
+    no matrix-free mode.
+
+    With the flag "gradients", the corrections on the edge patches are
+    complemented (additively) by corrections in the span of the
+    gradient of each vertex hat function, in every lowest-order H(curl)
+    component of the space (Hiptmair's hybrid smoother): these are
+    one-dimensional subspaces, on the lowest-order edge dofs around a
+    vertex, smoothed by a colored forward and backward sweep.
+  */
+
+  class EdgePatchSchwarz : public VertexPatchSchwarz  {
+
+    bool gradients = false;
+
+    Patches grad;                  // blocks: lowest-order dofs at a vertex
+    Table<double> gsign;           // ... and the vertex gradient on them
+
+  public:
+
+    EdgePatchSchwarz (const PDE & pde, const Flags & flags,
+		      const string & aname);
+    EdgePatchSchwarz (shared_ptr<BilinearForm> abfa, const Flags & aflags,
+		      const string aname = "edgeschwarz");
+
+    virtual void Update();
+
+  protected:
+
+    virtual shared_ptr<Table<int>> CreateBlocks (shared_ptr<BitArray> freedofs);
+
+    virtual void AddCorrections (const BaseVector & f, BaseVector & u) const;
+
+  private:
+
+    void GradientBlocks (shared_ptr<BitArray> freedofs);
+
+    template <class SCAL>
+    void GradientUpdate (shared_ptr<dpg::PatchSolver<SCAL>> & solver,
+			 const Table<int> & dof2block,
+			 const Table<int> & dof2pos);
+
+    template <class SCAL>
+    void GradientMult (const dpg::PatchSolver<SCAL> & solver,
+		       const BaseVector & f, BaseVector & u) const;
+  };
+
+}
+
+#endif
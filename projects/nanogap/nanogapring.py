@@ -3,9 +3,9 @@ from netgen.csg import *
 from ctypes import CDLL
 from cmath import pi, sqrt
 
-import sys
+import sys, os, gzip, shutil, tempfile
 sys.path.append('../pyutils')
-from pcg import pcg
+from refine import refine
 
     
 def ringgeom(w, nlayers,
@@ -224,10 +224,53 @@ def genmesh(w, nlayers, ncyl, savemeshfile='',
 
 
 
+def wavenumbers(freq):
+    """ Return the (scaled) wavenumbers of the materials at frequency freq """
+
+    omega= 2 * pi * freq
+    mu0  = pi * 4e-7             # kg * m * s^(-2) * A^(-2)
+    ep0  = 8.854e-12             # A^2 * s^4 * kg^(-1) * m^(-3) 
+    mu0s = mu0 * 1e6             # scaled mu0 in micrometers 
+    ep0s = ep0 * 1e-18           # scaled ep0 in micrometers 
+    omp =  1.37e16               # s^(-1), used in Druid model
+    gam =  40.7e12               # s^(-1)
+    k0 = omega * sqrt(ep0s*mu0s) # final scaled wavenumber used for air
+    return \
+    {'air'   : k0,     'airtop': k0,     'airbot': k0,
+     'alox'  : k0 * sqrt(2.34),
+     'gold'  : k0 * sqrt( 1-omp*omp/(omega*omega+gam*gam) +
+                          1j*gam/(omega*(omega*omega+gam*gam)) ),
+     'glass' : k0 * sqrt(1.95)  }
+
+
+def dpgform(dpg, S, k, bdry, kbdry):
+    """ The DPG form on S = [S0,S1,S2] (error representation, E, M) for
+    the wavenumbers k of the materials, with the indicator bdry of the
+    top and bottom air boundaries and kbdry = k0 * bdry. """
+
+    a = BilinearForm(S, symmetric=False, flags={"eliminate_internal" : True})
+    a+= dpg.DPGBundle([("curlcurlpg", 2,1, 1),       # (curl E, curl v)
+                       ("eyeeyeedge", 2,1, -k*k),    # -(k*k E, v)
+                       ("trctrcxn",   3,1, 1j)])     # i<<M, v x n>>
+    a+= BFI("xnbdry", coef=[2,3,kbdry])       # <k E, W x n>
+    a.components[1]+= BFI("robinedge",        # -<k*kbar E x n, F x n>
+                          coef=-kbdry * Conj(kbdry))                        
+    a.components[2]+= BFI("robinedge",
+                          coef=-bdry)         # -<M x n, W x n>
+    a.components[0]+= BFI("massedge",         
+                          coef=1.0)           # (e, v)
+    a.components[0]+= BFI("curlcurledge",     # (curl e, curl v)
+                          coef=1.0)        
+    return a
+
+
 def solve(meshfile,
           p=1,
           freq=0.625e12,
           localprec=False,
+          edgeprec=False,
+          matrixfree=False,
+          single=False,
           cgiterations=10000,
           dpglib='../../libDPG.so',          
           X=50, Y=50, Z=200 ):
@@ -237,12 +280,27 @@ def solve(meshfile,
     p :    polynomial degree 
     freq:  incident wave frequency 
     localprec: If true, use local preconditioner, else use direct solve
+    edgeprec: If true, use the edge patch Schwarz preconditioner, with
+              vertex gradient corrections
+    matrixfree: If true, do not assemble: apply the condensed matrix
+                element by element, with a vertex patch preconditioner
+    single: With matrixfree, keep element and patch matrices in single
+            precision, and refine iteratively in double precision
     
+    Snapshots of the iterates are written (gzip compressed, in the
+    background) to solpcg<iteration>.sol.gz at every tenth of
+    cgiterations, and with single to solref<step>.sol.gz after each
+    refinement step; loadsol reads such files.
     """
     
+    if single and not matrixfree:
+        raise ValueError('single=True needs matrixfree=True')
+
     # load DPG C++ lib  & load (or make) mesh 
     
     libDPG = CDLL(dpglib)
+    sys.path.append(os.path.dirname(os.path.abspath(dpglib)))
+    import libDPG as dpg         # python interface of the same library
 
     mesh = Mesh(meshfile)
     
@@ -251,20 +309,8 @@ def solve(meshfile,
 
     # material properties 
 
-    omega= 2 * pi * freq
-    mu0  = pi * 4e-7             # kg * m * s^(-2) * A^(-2)
-    ep0  = 8.854e-12             # A^2 * s^4 * kg^(-1) * m^(-3) 
-    mu0s = mu0 * 1e6             # scaled mu0 in micrometers 
-    ep0s = ep0 * 1e-18           # scaled ep0 in micrometers 
-    omp =  1.37e16               # s^(-1), used in Druid model
-    gam =  40.7e12               # s^(-1)
-    k0 = omega * sqrt(ep0s*mu0s) # final scaled wavenumber used for air
-    materialk = \
-    {'air'   : k0,     'airtop': k0,     'airbot': k0,
-     'alox'  : k0 * sqrt(2.34),
-     'gold'  : k0 * sqrt( 1-omp*omp/(omega*omega+gam*gam) +
-                          1j*gam/(omega*(omega*omega+gam*gam)) ),
-     'glass' : k0 * sqrt(1.95)  }
+    materialk = wavenumbers(freq)
+    k0 = materialk['air']         # final scaled wavenumber used for air
     
     klist = [ materialk[mat] for mat in mesh.GetMaterials() ]
     k = CoefficientFunction( klist )
@@ -312,50 +358,68 @@ def solve(meshfile,
     b+= SymbolicLFI(f * v)
     b.Assemble()
 
-    a = BilinearForm(S, symmetric=False, flags={"eliminate_internal" : True})
-    a+= BFI("curlcurlpg", coef=[2,1,1])       # (curl E, curl v)
-    a+= BFI("eyeeyeedge", coef=[2,1,-k*k])    # -(k*k E, v)
-    a+= BFI("trctrcxn",   coef=[3,1,1j] )     # i<<M, v x n>>
-    a+= BFI("xnbdry", coef=[2,3,kbdry])       # <k E, W x n>
-    a.components[1]+= BFI("robinedge",        # -<k*kbar E x n, F x n>
-                          coef=-kbdry * Conj(kbdry))                        
-    a.components[2]+= BFI("robinedge",
-                          coef=-bdry)         # -<M x n, W x n>
-    a.components[0]+= BFI("massedge",         
-                          coef=1.0)           # (e, v)
-    a.components[0]+= BFI("curlcurledge",     # (curl e, curl v)
-                          coef=1.0)        
+    a = dpgform(dpg, S, k, bdry, kbdry)
 
     # assemble
     
     eEM = GridFunction(S, 'Scattered')
     
-    if localprec:
-        c = Preconditioner(a, type="local")
+    if matrixfree:
+        with TaskManager():
+            A = dpg.DPGMatrixFree(a, heapsize=int(5e8))
+            if single:
+                As = dpg.DPGMatrixFree(a, cache=True, single=True,
+                                       heapsize=int(5e8))
+                C = dpg.VertexSchwarz(As, single=True)
+            else:
+                C = dpg.VertexSchwarz(A)
     else:
-        c = Preconditioner(a, type="direct")
+        if edgeprec:
+            c = Preconditioner(a, type="edgeschwarz",
+                               flags={"gradients" : True})
+        elif localprec:
+            c = Preconditioner(a, type="local")
+        else:
+            c = Preconditioner(a, type="direct")
 
-    with TaskManager():    
-        a.Assemble(heapsize=int(5e8))
+        with TaskManager():    
+            a.Assemble(heapsize=int(5e8))
+        A, C = a.mat, c.mat
 
     iterates_to_save = [i*cgiterations//10 for i in range(1,11)]
+    writer = dpg.AsyncWriter()   # compresses and writes in the background
     def save_pcg_iterate(x, iter):
         if iter in iterates_to_save:
-            solfilename='solpcg%d'%iter+'.sol'
-            eEM.Save(solfilename)
+            solfilename='solpcg%d'%iter+'.sol.gz'
+            writer.Save(eEM, solfilename)
+    def save_refinement_step(x, step):   # single: the outer iterates
+        writer.Save(eEM, 'solref%d'%step+'.sol.gz')
     
-    b.vec.data += a.harmonic_extension_trans * b.vec
+    if matrixfree:
+        A.ExtendTrans(b.vec)
+    else:
+        b.vec.data += a.harmonic_extension_trans * b.vec
     eEM.vec[:] = 0.0
 
     # solve
     
     with TaskManager():    
-        eEM.vec.data = pcg(a.mat, c.mat, b.vec, x=eEM.vec,
-                           maxits=cgiterations,
-                           saveitfn=save_pcg_iterate)
-        
-        eEM.vec.data += a.harmonic_extension * eEM.vec
-        eEM.vec.data += a.inner_solve * b.vec
+        if matrixfree and single:
+            eEM.vec.data = refine(A, As, C, b.vec, x=eEM.vec,
+                                  innerits=cgiterations,
+                                  saveitfn=save_refinement_step)
+        else:
+            eEM.vec.data = dpg.pcg(A, C, b.vec, x=eEM.vec,
+                                   maxits=cgiterations,
+                                   saveitfn=save_pcg_iterate)
+        writer.Wait()
+
+        if matrixfree:
+            A.Extend(eEM.vec)
+            A.InnerSolve(b.vec, eEM.vec)
+        else:
+            eEM.vec.data += a.harmonic_extension * eEM.vec
+            eEM.vec.data += a.inner_solve * b.vec
         
     Esct = eEM.components[1]
     Draw(Esct)
@@ -366,6 +430,83 @@ def solve(meshfile,
 
     return Etot
 
+
+def sweep(meshfile, freqs,
+          p=1,
+          inverse='umfpack',
+          dpglib='../../libDPG.so',
+          X=50, Y=50, Z=200 ):
+    """
+    Solve for each frequency in freqs, yielding (freq, Etot). 
+
+    The error representation (the order p+2 component S0) is eliminated
+    element by element for each frequency (libDPG.DPGCondensation, with
+    a Cholesky factor of the element Gram matrices only), so the cost of
+    forming the system grows linearly with the mesh, and only the
+    condensed system on the interface dofs of [S1,S2] is factored with
+    the given inverse.
+    """
+
+    libDPG = CDLL(dpglib)
+    sys.path.append(os.path.dirname(os.path.abspath(dpglib)))
+    import libDPG as dpg         # python interface of the same library
+
+    mesh = Mesh(meshfile)
+    mesh.Curve(max(3,p))
+
+    mats = mesh.GetMaterials()
+    bcs = mesh.GetBoundaries()
+    bdry = CoefficientFunction( [1 if bc in ('airabove','airbelow') else 0
+                                 for bc in bcs] )
+
+    S0 = FESpace("hcurlho", mesh, order=p+2, complex=True,
+                 flags={"discontinuous":True})
+    S1 = FESpace("hcurlho_periodic", mesh, order=p, complex=True,
+                 flags={'xends':[-X/2,X/2], 'yends':[-Y/2,Y/2]})
+    S2 = FESpace("hcurlho_periodic", mesh, order=p+1, complex=True,
+                 flags={"orderinner": 0,
+                        'xends':[-X/2,X/2], 'yends':[-Y/2,Y/2]})
+    S = FESpace( [S0,S1,S2], flags={"complex":True})
+    Sx = FESpace( [S1,S2], flags={"complex":True})   # trial components
+    e,E,M = S.TrialFunction()
+    v,F,W = S.TestFunction()
+
+    Einc = GridFunction(S1, 'Incident')
+    EM = GridFunction(Sx, 'Scattered')
+    
+    for freq in freqs:
+
+        materialk = wavenumbers(freq)
+        k0 = materialk['air']
+        k = CoefficientFunction( [ materialk[mat] for mat in mats ] )
+        einc = CoefficientFunction( (exp(1j * k0 * z), 0,0) )
+
+        a = dpgform(dpg, S, k, bdry, k0 * bdry)
+        b = LinearForm(S)
+        b+= SymbolicLFI((k*k - k0*k0) * einc * v)
+
+        cond = dpg.DPGCondensation(a, 0, b)
+        ac = BilinearForm(Sx, symmetric=False,
+                          flags={"eliminate_internal" : True})
+        ac+= cond.BFI()
+        ac+= cond.BFI(BND)
+        bc = LinearForm(Sx)
+        bc+= cond.LFI()
+
+        with TaskManager():
+            Einc.Set(einc)
+            ac.Assemble(heapsize=int(5e8))
+            bc.Assemble()
+            bc.vec.data += ac.harmonic_extension_trans * bc.vec
+            inv = ac.mat.Inverse(Sx.FreeDofs(True), inverse=inverse)
+            EM.vec.data = inv * bc.vec
+            EM.vec.data += ac.harmonic_extension * EM.vec
+            EM.vec.data += ac.inner_solve * bc.vec
+
+        Etot = GridFunction(S1, 'Total')
+        Etot.vec.data = Einc.vec + EM.components[0].vec
+        yield freq, Etot
+
 def loadsol(solfileEtot, meshfile, p,
             dpglib='../../libDPG.so',
             X=50, Y=50, Z=200):
@@ -386,7 +527,16 @@ def loadsol(solfileEtot, meshfile, p,
 
 
     Etot = GridFunction(S1, 'Total')
-    Etot.Load(solfileEtot)
+    if solfileEtot.endswith('.gz'):      # e.g. written by AsyncWriter
+        with gzip.open(solfileEtot, 'rb') as src, \
+             tempfile.NamedTemporaryFile(suffix='.sol', delete=False) as dst:
+            shutil.copyfileobj(src, dst)
+        try:
+            Etot.Load(dst.name)
+        finally:
+            os.remove(dst.name)
+    else:
+        Etot.Load(solfileEtot)
     Draw(Etot)
     
     return Etot
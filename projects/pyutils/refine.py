@@ -0,0 +1,45 @@
+from ngsolve.la import InnerProduct
+from math import sqrt
+from pcg import pcg
+
+def refine(A, As, B, b, x=None, tol=1.e-10, maxsteps=10,
+           innertol=1.e-8, innerits=100, saveitfn=None):
+
+    """Iterative refinement (defect correction) for A x = b.
+
+    The corrections are computed by pcg with the single precision
+    operator As (e.g. DPGMatrixFree(a, cache=True, single=True)) and
+    preconditioner B, and the residuals with the double precision
+    operator A (e.g. DPGMatrixFree(a)). Each step reduces the error by
+    about the accuracy of the inner solve, so the final accuracy is
+    that of A, stopping when |r| < tol |b|. The inner pcg stops when
+    <r, B r> is reduced by the factor innertol (pcg's test is on the
+    absolute value of <r, B r>). If given, saveitfn(x, step) is called
+    after each refinement step.
+    """
+
+    if x == None:
+        x = b.CreateVector()
+        x[:] = 0.0
+    r = b.CreateVector()
+    d = b.CreateVector()
+    w = b.CreateVector()
+    nb = sqrt(abs(InnerProduct(b,b)))
+
+    for step in range(maxsteps):
+
+        r.data = b - A * x
+        nr = sqrt(abs(InnerProduct(r,r)))
+        print('Refinement%4d'%step, ': |r|/|b| =%12.5g'%(nr/nb))
+        if nr <= tol * nb:
+            break
+
+        w.data = B * r
+        rBr = abs(InnerProduct(r, w))
+        d[:] = 0.0
+        pcg(As, B, r, x=d, tol=innertol*rBr, maxits=innerits)
+        x.data += d
+        if saveitfn:
+            saveitfn(x, step+1)
+
+    return x
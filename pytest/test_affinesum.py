@@ -0,0 +1,52 @@
+""" libDPG.AffineSum: the combination of matrices assembled once
+against the matrix of the combined form, for complex factors and a
+term with a smaller (boundary only) pattern. """
+
+from ngsolve import *
+from netgen.geom2d import unit_square
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def test_affinesum():
+
+    ngsglobals.msg_level = 1
+    mesh = Mesh(unit_square.GenerateMesh(maxh=0.3))
+    X = H1(mesh, order=2, complex=True)
+    u = X.TrialFunction()
+    v = X.TestFunction()
+
+    terms = [grad(u) * grad(v), u * v]
+    forms = []
+    for t in terms:
+        a = BilinearForm(X)
+        a += SymbolicBFI(t)
+        forms.append(a)
+    ab = BilinearForm(X)
+    ab += SymbolicBFI(u * v, BND)
+    forms.append(ab)
+    for a in forms:
+        a.Assemble()
+
+    A = libDPG.AffineSum([a.mat for a in forms])
+    for c in [[1, -4, 2j], [1, 3+1j, -1]]:
+        A.Set(c)
+        a = BilinearForm(X)
+        a += SymbolicBFI(c[0] * terms[0] + c[1] * terms[1])
+        a += SymbolicBFI(c[2] * u * v, BND)
+        a.Assemble()
+
+        w = a.mat.CreateColVector()
+        w.SetRandom()
+        w0 = w.CreateVector()
+        w1 = w.CreateVector()
+        w0.data = a.mat * w
+        w1.data = A.mat * w
+        w1.data -= w0
+        assert w1.Norm() <= 1.e-10 * w0.Norm()
+
+
+if __name__ == "__main__":
+    test_affinesum()
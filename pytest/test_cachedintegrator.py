@@ -0,0 +1,137 @@
+""" Matrices assembled with libDPG.Cached (translations=True) against
+the uncached integrators, on a structured periodic mesh where many
+elements are translated copies, with periodic H(curl) spaces; and the
+coefficients in the key (Parameter values, no caching of GridFunction
+coefficients). """
+
+from ngsolve import *
+from netgen.meshing import Mesh as NGMesh, MeshPoint, Element3D, Element2D
+from netgen.meshing import FaceDescriptor, Pnt
+from netgen.csg import unit_cube
+from itertools import permutations
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def periodiccube(n=3):
+    """ the unit cube, n^3 cells of 6 tetrahedra each, periodic in x, y """
+
+    ngmesh = NGMesh(dim=3)
+    pnums = {}
+    for i in range(n+1):
+        for j in range(n+1):
+            for k in range(n+1):
+                pnums[i,j,k] = ngmesh.Add(MeshPoint(Pnt(i/n, j/n, k/n)))
+
+    ngmesh.SetMaterial(1, "cube")
+    for i in range(n):
+        for j in range(n):
+            for k in range(n):
+                for perm in permutations(range(3)):   # along the diagonal
+                    c = [i, j, k]
+                    verts = [pnums[tuple(c)]]
+                    for d in perm:
+                        c[d] += 1
+                        verts.append(pnums[tuple(c)])
+                    ngmesh.Add(Element3D(1, verts))
+
+    ngmesh.Add(FaceDescriptor(surfnr=1, domin=1, bc=1))
+    def square(p00, p10, p11, p01):
+        ngmesh.Add(Element2D(1, [pnums[p00], pnums[p10], pnums[p11]]))
+        ngmesh.Add(Element2D(1, [pnums[p00], pnums[p11], pnums[p01]]))
+    for a in range(n):
+        for b in range(n):
+            for s in [0, n]:
+                square((s,a,b), (s,a+1,b), (s,a+1,b+1), (s,a,b+1))
+                square((a,s,b), (a+1,s,b), (a+1,s,b+1), (a,s,b+1))
+                square((a,b,s), (a+1,b,s), (a+1,b+1,s), (a,b+1,s))
+
+    for a in range(n+1):
+        for b in range(n+1):
+            ngmesh.AddPointIdentification(pnums[0,a,b], pnums[n,a,b], 1, 2)
+            ngmesh.AddPointIdentification(pnums[a,0,b], pnums[a,n,b], 2, 2)
+    return Mesh(ngmesh)
+
+
+def assemble(S, cached):
+
+    def wrap(bfi):
+        return libDPG.Cached(bfi, translations=True) if cached else bfi
+
+    k = 2 + z                  # not constant: exact keys on some elements
+    a = BilinearForm(S, symmetric=False)
+    a += wrap(BFI("curlcurlpg", coef=[2,1,1]))
+    a += wrap(BFI("eyeeyeedge", coef=[2,1,-4]))
+    a += wrap(BFI("eyeeyeedge", coef=[2,1,-k*k]))
+    a += wrap(BFI("trctrcxn",   coef=[3,1,1j]))
+    a.Assemble()
+    return a
+
+
+def test_cachedintegrator():
+
+    ngsglobals.msg_level = 1
+    mesh = periodiccube()
+    p = 2
+    S0 = FESpace("hcurlho", mesh, order=p+2, complex=True,
+                 discontinuous=True)
+    S1 = FESpace("hcurlho_periodic", mesh, order=p, complex=True,
+                 xends=[0,1], yends=[0,1])
+    S2 = FESpace("hcurlho_periodic", mesh, order=p+1, complex=True,
+                 orderinner=0, xends=[0,1], yends=[0,1])
+    S = FESpace([S0,S1,S2], complex=True)
+
+    a0 = assemble(S, False)
+    a1 = assemble(S, True)
+
+    v = a0.mat.CreateColVector()
+    w0 = v.CreateVector()
+    w1 = v.CreateVector()
+    for trial in range(3):
+        v.SetRandom()
+        w0.data = a0.mat * v
+        w1.data = a1.mat * v
+        w1.data -= w0
+        assert w1.Norm() <= 1.e-10 * w0.Norm()
+
+
+def test_coefficients():
+
+    ngsglobals.msg_level = 1
+    mesh = Mesh(unit_cube.GenerateMesh(maxh=0.5))
+    X = H1(mesh, order=2)
+    u = X.TrialFunction()
+    v = X.TestFunction()
+
+    par = Parameter(1.0)
+    bfi = libDPG.Cached(SymbolicBFI(par * grad(u) * grad(v) + u * v))
+    a = BilinearForm(X)
+    a += bfi
+    b = BilinearForm(X)
+    b += SymbolicBFI(par * grad(u) * grad(v) + u * v)
+
+    for val in [1.0, 3.0]:           # same mesh, new parameter value
+        par.Set(val)
+        a.Assemble()
+        b.Assemble()
+        w = a.mat.CreateColVector()
+        w.SetRandom()
+        wa = w.CreateVector()
+        wb = w.CreateVector()
+        wa.data = a.mat * w
+        wb.data = b.mat * w
+        wa.data -= wb
+        assert wa.Norm() <= 1.e-10 * wb.Norm()
+    assert bfi.cacheable
+
+    g = GridFunction(H1(mesh, order=1))
+    g.Set(1 + x)
+    gbfi = libDPG.Cached(SymbolicBFI(g * u * v))
+    assert not gbfi.cacheable
+
+
+if __name__ == "__main__":
+    test_cachedintegrator()
+    test_coefficients()
@@ -0,0 +1,114 @@
+""" The Chebyshev iteration of the vertex patch Schwarz preconditioner
+(flag "chebyshev"), assembled (type "vertexschwarz") and matrix-free
+(libDPG.VertexSchwarz): the estimated interval [lmin, lmax] brackets
+the spectrum of B A (B the additive patch operator, computed densely
+on a small problem), and CG converges without the preconditioner
+becoming indefinite. """
+
+from ngsolve import *
+from netgen.geom2d import unit_square
+import numpy as np
+import sys
+
+sys.path.append("..")
+import libDPG
+
+k = 3        # Chebyshev degree
+
+
+def setup():
+
+    mesh = Mesh(unit_square.GenerateMesh(maxh=0.3))
+    p = 1
+    Xo = H1(mesh, order=p+1, dirichlet=[1,2,3,4], complex=True)
+    Xf = HDiv(mesh, order=p, complex=True, orderinner=1)
+    Y  = L2(mesh, order=p+2, complex=True)
+    XY = FESpace([Xo,Xf,Y], complex=True)
+
+    u,q,e = XY.TrialFunction()
+    w,r,d = XY.TestFunction()
+    n = specialcf.normal(mesh.dim)
+
+    a = BilinearForm(XY, symmetric=False, eliminate_internal=True)
+    a += SymbolicBFI(grad(u) * grad(d) + grad(e) * grad(w))
+    a += SymbolicBFI(q*n*d, element_boundary=True)
+    a += SymbolicBFI(e*r*n, element_boundary=True)
+    a += SymbolicBFI(grad(e) * grad(d) + e*d)
+    f = LinearForm(XY)
+    f += SymbolicLFI(CoefficientFunction(1+x*y) * d)
+    return XY, a, f
+
+
+def dense(op, vec, dofs):
+    """ the matrix of op on the dofs """
+    m = np.zeros((len(dofs), len(dofs)), dtype=complex)
+    v = vec.CreateVector()
+    w = vec.CreateVector()
+    for j, dj in enumerate(dofs):
+        v[:] = 0
+        v[dj] = 1
+        w.data = op * v
+        for i, di in enumerate(dofs):
+            m[i,j] = w[di]
+    return m
+
+
+def spectrum(XY, a):
+    """ the extreme eigenvalues of B A """
+    A = libDPG.DPGMatrixFree(a)
+    B = libDPG.VertexSchwarz(A)          # additive
+    free = XY.FreeDofs(True)
+    dofs = [i for i in range(XY.ndof) if free[i]]
+    vec = A.CreateColVector()
+    lam = np.linalg.eigvals(dense(B, vec, dofs) @ dense(A, vec, dofs))
+    assert max(abs(lam.imag)) <= 1.e-8 * max(abs(lam))
+    return min(lam.real), max(lam.real)
+
+
+def check(pre, A, f, lo, hi, capfd):
+
+    info = libDPG.PatchInfo(pre)
+    print("spectrum of B A", [lo, hi], "estimate",
+          [info["lmin"], info["lmax"]])
+    assert 0 < info["lmin"] <= lo
+    assert hi <= info["lmax"]
+
+    capfd.readouterr()
+    its = []
+    libDPG.pcg(A, pre, f.vec, tol=1.e-20, maxits=500, printrates=False,
+               saveitfn=lambda x, it: its.append(it))
+    out, err = capfd.readouterr()
+    assert "indefinite" not in out + err
+    assert len(its) < 500
+
+
+def test_chebyshev(capfd):
+
+    ngsglobals.msg_level = 1
+    XY, a, f = setup()
+    c = Preconditioner(a, type="vertexschwarz",
+                       flags={"chebyshev": k, "lanczossteps": 100})
+    a.Assemble()
+    f.Assemble()
+    f.vec.data += a.harmonic_extension_trans * f.vec
+
+    lo, hi = spectrum(XY, a)
+    check(c.mat, a.mat, f, lo, hi, capfd)
+
+
+def test_chebyshevmatrixfree(capfd):
+
+    ngsglobals.msg_level = 1
+    XY, a, f = setup()
+    f.Assemble()
+    A = libDPG.DPGMatrixFree(a)
+    A.ExtendTrans(f.vec)
+
+    lo, hi = spectrum(XY, a)
+    C = libDPG.VertexSchwarz(A, chebyshev=k, lanczossteps=100)
+    check(C, A, f, lo, hi, capfd)
+
+
+if __name__ == "__main__":
+    import pytest
+    pytest.main([__file__])
@@ -0,0 +1,94 @@
+""" DPG for Laplacian with the error representation eliminated
+element by element (libDPG.DPGCondensation), compared against the
+usual solve on the full compound space. """
+
+from ngsolve import *
+from netgen.geom2d import unit_square
+import sys
+
+sys.path.append("..")
+import libDPG            # also registers the integrators, like CDLL
+
+
+def setup(p=2, h=0.25):
+
+    mesh = Mesh(unit_square.GenerateMesh(maxh=h))
+    X = H1(mesh, order=p+1, dirichlet=[1,2,3,4])
+    Q = HDiv(mesh, order=p, orderinner=0)
+    Y = L2(mesh, order=p+2)
+    XY = FESpace([X,Q,Y])
+
+    u,q,e = XY.TrialFunction()
+    w,r,d = XY.TestFunction()
+    n = specialcf.normal(mesh.dim)
+
+    a = BilinearForm(XY, symmetric=True, eliminate_internal=True)
+    a+= SymbolicBFI(grad(u) * grad(d))
+    a+= SymbolicBFI(grad(e) * grad(w))
+    a+= SymbolicBFI(q*n*d, element_boundary=True)
+    a+= SymbolicBFI(e*r*n, element_boundary=True)
+    a.components[2] += Laplace(1.0)
+    a.components[2] += Mass(1.0)
+
+    f = LinearForm(XY)
+    f.components[2] += Source(32*(y*(1-y)+x*(1-x)))
+
+    return mesh, X, Q, XY, a, f
+
+
+def solve_full(XY, a, f):
+
+    uqe = GridFunction(XY)
+    c = Preconditioner(a, type="direct")
+    a.Assemble()
+    f.Assemble()
+    BVP(bf=a, lf=f, gf=uqe, pre=c).Do()
+    return uqe
+
+
+def solve_condensed(X, Q, a, f, cache=True):
+
+    Xq = FESpace([X,Q])
+    cond = libDPG.DPGCondensation(a, 2, f, cache=cache)
+
+    ac = BilinearForm(Xq, symmetric=True, eliminate_internal=True)
+    ac += cond.BFI()
+    fc = LinearForm(Xq)
+    fc += cond.LFI()
+
+    uq = GridFunction(Xq)
+    c = Preconditioner(ac, type="direct")
+    ac.Assemble()
+    fc.Assemble()
+    BVP(bf=ac, lf=fc, gf=uq, pre=c).Do()
+    return uq, cond.Estimate(uq)
+
+
+def check(p, h, cache):
+
+    mesh, X, Q, XY, a, f = setup(p, h)
+    uqe = solve_full(XY, a, f)
+    uq, elerr = solve_condensed(X, Q, a, f, cache)
+
+    # same trial solution and same estimator as with the full space
+    du = uqe.components[0] - uq.components[0]
+    assert sqrt(Integrate(du*du, mesh)) < 1.e-10
+
+    e = uqe.components[2]
+    fullerr = Integrate(e*e + grad(e)*grad(e), mesh, VOL, element_wise=True)
+    assert len(elerr) == mesh.ne
+    for k in range(mesh.ne):
+        assert abs(elerr[k] - fullerr[k]) <= 1.e-8 * (1 + abs(fullerr[k]))
+
+
+def test_dpgcondensation():
+
+    ngsglobals.msg_level = 1
+    for cache in [True, False]:
+        check(2, 0.25, cache)
+    # test spaces larger than the block size of the dense factorizations
+    check(6, 0.5, True)
+
+
+if __name__ == "__main__":
+    test_dpgcondensation()
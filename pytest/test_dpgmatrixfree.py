@@ -0,0 +1,76 @@
+""" The matrix-free condensed DPG operator (libDPG.DPGMatrixFree)
+against the matrices of the assembled form with eliminate_internal:
+Mult, Extend, ExtendTrans and InnerSolve. """
+
+from ngsolve import *
+import sys
+
+sys.path.append("..")
+import libDPG
+from test_dpgcondensation import setup
+
+
+def external(XY):
+    """ the non-LOCAL dofs, where the condensed matrix lives """
+    return [i for i in range(XY.ndof)
+            if XY.CouplingType(i) != COUPLING_TYPE.LOCAL_DOF]
+
+
+def close(v, w, dofs=None):
+    d = v.CreateVector()
+    d.data = v - w
+    if dofs is None:
+        return d.Norm() <= 1.e-10 * (1 + w.Norm())
+    return max([abs(d[i]) for i in dofs]) <= 1.e-10 * (1 + w.Norm())
+
+
+def check(a, XY, A):
+
+    ext = external(XY)
+    v = a.mat.CreateColVector()
+    w0 = v.CreateVector()
+    w1 = v.CreateVector()
+
+    # condensed matrix, on the external dofs
+    v.SetRandom()
+    for i in range(XY.ndof):
+        if XY.CouplingType(i) == COUPLING_TYPE.LOCAL_DOF:
+            v[i] = 0
+    w0.data = a.mat * v
+    w1.data = A * v
+    assert close(w1, w0, ext)
+
+    # u += harmonic_extension * u
+    v.SetRandom()
+    w0.data = v
+    w0.data += a.harmonic_extension * v
+    w1.data = v
+    A.Extend(w1)
+    assert close(w1, w0)
+
+    # f += harmonic_extension_trans * f
+    w0.data = v
+    w0.data += a.harmonic_extension_trans * v
+    w1.data = v
+    A.ExtendTrans(w1)
+    assert close(w1, w0)
+
+    # u += inner_solve * f
+    w0[:] = 0.0
+    w0.data += a.inner_solve * v
+    w1[:] = 0.0
+    A.InnerSolve(v, w1)
+    assert close(w1, w0)
+
+
+def test_dpgmatrixfree():
+
+    ngsglobals.msg_level = 1
+    mesh, X, Q, XY, a, f = setup()
+    a.Assemble()
+    for cache in [False, True]:
+        check(a, XY, libDPG.DPGMatrixFree(a, cache=cache))
+
+
+if __name__ == "__main__":
+    test_dpgmatrixfree()
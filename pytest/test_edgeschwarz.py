@@ -0,0 +1,107 @@
+""" The edge patch Schwarz preconditioner (type "edgeschwarz"): the sign
+convention of its vertex gradient corrections, and fewer CG iterations
+than the local (Jacobi) preconditioner on a DPG Maxwell problem. """
+
+from ngsolve import *
+from ngsolve.la import InnerProduct
+from netgen.csg import unit_cube
+from math import sqrt
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def test_gradientsigns():
+    """ The gradient of the hat function of a vertex is, on the lowest
+    order edge dofs around it, +1 where the vertex is the higher
+    numbered end of the edge and -1 where it is the lower one (as in
+    EdgePatchSchwarz::GradientBlocks). """
+
+    ngsglobals.msg_level = 1
+    mesh = Mesh(unit_cube.GenerateMesh(maxh=0.4))
+    X = HCurl(mesh, order=2)
+    u = X.TrialFunction()
+    v = X.TestFunction()
+    a = BilinearForm(X)
+    a += SymbolicBFI(curl(u) * curl(v) + u * v)
+    a.Assemble()
+
+    # a vertex with the most edges (inside the cube)
+    nedges = [0] * mesh.nv
+    for e in mesh.edges:
+        for vn in e.vertices:
+            nedges[vn.nr] += 1
+    vert = nedges.index(max(nedges))
+
+    g = GridFunction(X)
+    g.vec[:] = 0
+    for e in mesh.edges:
+        ends = sorted(vn.nr for vn in e.vertices)
+        if vert in ends:
+            d = X.GetDofNrs(NodeId(EDGE, e.nr))[0]
+            g.vec[d] = 1.0 if vert == ends[1] else -1.0
+
+    hat = GridFunction(H1(mesh, order=1))
+    hat.vec[:] = 0
+    hat.vec[vert] = 1.0
+    gh = GridFunction(X)
+    gh.Set(grad(hat))
+
+    Ag = g.vec.CreateVector()
+    Agh = g.vec.CreateVector()
+    Ag.data = a.mat * g.vec
+    Agh.data = a.mat * gh.vec
+    Agh.data -= Ag
+    assert sqrt(InnerProduct(Agh, Agh)) < 1.e-8 * sqrt(InnerProduct(Ag, Ag))
+
+
+def iterations(prectype, flags={}):
+
+    mesh = Mesh(unit_cube.GenerateMesh(maxh=0.4))
+    p = 2
+    Xo = HCurl(mesh, order=p+1, dirichlet=[1,2,3,4,5,6], complex=True)
+    Xh = HCurl(mesh, order=p, complex=True, orderinner=1)
+    Y = HCurl(mesh, order=p+2, complex=True, discontinuous=True)
+    XY = FESpace([Xo,Xh,Y], complex=True)
+
+    E,M,e = XY.TrialFunction()
+    G,W,d = XY.TestFunction()
+    n = specialcf.normal(mesh.dim)
+    def cross(G,N):
+        return CoefficientFunction( ( G[1]*N[2] - G[2]*N[1],
+                                      G[2]*N[0] - G[0]*N[2],
+                                      G[0]*N[1] - G[1]*N[0] ) )
+
+    a = BilinearForm(XY, symmetric=False, eliminate_internal=True)
+    a += SymbolicBFI(curl(E) * curl(d) - E*d)
+    a += SymbolicBFI(curl(e) * curl(G) - e*G)
+    a += SymbolicBFI(M * cross(d,n), element_boundary=True)
+    a += SymbolicBFI(cross(e,n) * W, element_boundary=True)
+    a += SymbolicBFI(curl(e) * curl(d) + e*d)
+    f = LinearForm(XY)
+    f += SymbolicLFI(CoefficientFunction((1,x,y*z)) * d)
+
+    c = Preconditioner(a, type=prectype, flags=flags)
+    with TaskManager():
+        a.Assemble()
+        f.Assemble()
+    f.vec.data += a.harmonic_extension_trans * f.vec
+
+    its = []
+    libDPG.pcg(a.mat, c.mat, f.vec, tol=1.e-20, maxits=2000,
+               printrates=False, saveitfn=lambda x, it: its.append(it))
+    return len(its)
+
+
+def test_edgeschwarz():
+    ngsglobals.msg_level = 1
+    nlocal = iterations("local")
+    nedge = iterations("edgeschwarz", {"gradients" : True})
+    print("CG iterations: local", nlocal, "edgeschwarz", nedge)
+    assert nedge < nlocal
+
+
+if __name__ == "__main__":
+    test_gradientsigns()
+    test_edgeschwarz()
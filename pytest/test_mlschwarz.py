@@ -0,0 +1,70 @@
+""" The multilevel Schwarz preconditioner (type "mlschwarz") on the
+meshes of the adaptive loop of laplaceadaptive: the CG iteration
+counts stay bounded over the refinements, with local smoothing on the
+coarser levels. """
+
+from ngsolve import *
+from netgen.geom2d import SplineGeometry
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def test_mlschwarz():
+    ngsglobals.msg_level = 1
+
+    geom = SplineGeometry("../pde/square.in2d")
+    mesh = Mesh(geom.GenerateMesh(maxh=0.5))
+    f = CoefficientFunction((1+1j) * exp(-100.0*(x*x+y*y)))
+
+    p = 3
+    Xo = H1(mesh, order=p+1, dirichlet=[1], complex=True)
+    Xf = HDiv(mesh, order=p, complex=True, orderinner=1)
+    Y  = L2(mesh, order=p+2, complex=True)
+    XY = FESpace([Xo,Xf,Y], complex=True)
+
+    u,q,e = XY.TrialFunction()
+    w,r,d = XY.TestFunction()
+    n = specialcf.normal(mesh.dim)
+
+    a = BilinearForm(XY, symmetric=False, eliminate_internal=True)
+    a += SymbolicBFI(grad(u) * grad(d) + grad(e) * grad(w))
+    a += SymbolicBFI(q*n*d, element_boundary=True)
+    a += SymbolicBFI(e*r*n, element_boundary=True)
+    a.components[2] += Mass(1.0)
+    a.components[2] += Laplace(1.0)
+    b = LinearForm(XY)
+    b += SymbolicLFI(f*d)
+
+    c = Preconditioner(a, type="mlschwarz")
+
+    counts = []
+    for step in range(6):
+        XY.Update()
+        with TaskManager():
+            a.Assemble()
+            b.Assemble()
+        b.vec.data += a.harmonic_extension_trans * b.vec
+
+        its = []
+        libDPG.pcg(a.mat, c.mat, b.vec, tol=1.e-20, maxits=500,
+                   printrates=False, saveitfn=lambda x, it: its.append(it))
+        counts.append(len(its))
+
+        # refine towards the corner at the origin, where f peaks
+        pts = [v.point for v in mesh.vertices]
+        radius = 0.5 * 0.6**step
+        for el in mesh.Elements():
+            near = min(pts[v.nr][0]**2 + pts[v.nr][1]**2
+                       for v in el.vertices) < radius**2
+            mesh.SetRefinementFlag(el, near)
+        mesh.Refine()
+
+    print("CG iterations by level:", counts)
+    assert max(counts) < 500
+    assert max(counts[1:]) <= 2 * counts[1]
+
+
+if __name__ == "__main__":
+    test_mlschwarz()
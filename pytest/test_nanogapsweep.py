@@ -0,0 +1,51 @@
+""" sweep() of projects/nanogap/nanogapring.py, which condenses the
+error representation element by element (libDPG.DPGCondensation),
+against solve() at one frequency, on a small periodic mesh with a gold
+layer (complex wavenumber). """
+
+from ngsolve import *
+from netgen.csg import *
+import sys
+
+sys.path.append("../projects/pyutils")
+sys.path.append("../projects/nanogap")
+from nanogapring import solve, sweep
+
+
+def layersmesh(filename, X=1, Y=1):
+
+    xneg = Plane(Pnt(-X/2,0,0), Vec(-1,0,0)).bc("x-")
+    xpos = Plane(Pnt( X/2,0,0), Vec( 1,0,0)).bc("x+")
+    yneg = Plane(Pnt(0,-Y/2,0), Vec(0,-1,0)).bc("y-")
+    ypos = Plane(Pnt(0, Y/2,0), Vec(0, 1,0)).bc("y+")
+    bot  = Plane(Pnt(0,0,-0.5), Vec(0,0,-1)).bc("airbelow")
+    top  = Plane(Pnt(0,0, 0.5), Vec(0,0, 1)).bc("airabove")
+    mid  = Plane(Pnt(0,0, 0), Vec(0,0,1))
+    encl = xneg * xpos * yneg * ypos
+
+    geo = CSGeometry()
+    geo.Add((encl * bot * mid).mat("gold"))
+    geo.Add((encl * top - mid).mat("airtop"))
+    geo.PeriodicSurfaces(xneg, xpos)
+    geo.PeriodicSurfaces(yneg, ypos)
+    geo.GenerateMesh(maxh=0.5).Save(filename)
+
+
+def test_nanogapsweep():
+
+    ngsglobals.msg_level = 1
+    meshfile = "nanogapsweep.vol"
+    layersmesh(meshfile)
+    freq = 0.625e12
+
+    Es = solve(meshfile, p=1, freq=freq, dpglib="../libDPG.so", X=1, Y=1)
+    for f, Ew in sweep(meshfile, [freq], p=1, dpglib="../libDPG.so",
+                       X=1, Y=1):
+        # the same mesh file and space: the same dof numbering
+        d = Ew.vec.CreateVector()
+        d.data = Ew.vec - Es.vec
+        assert d.Norm() <= 1.e-6 * Es.vec.Norm()
+
+
+if __name__ == "__main__":
+    test_nanogapsweep()
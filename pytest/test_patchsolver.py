@@ -0,0 +1,56 @@
+""" The dense patch factorizations of VertexPatchSchwarz
+(libDPG.PatchSolve): Cholesky for Hermitian positive definite blocks,
+LU otherwise (also after a failed Cholesky on an indefinite Hermitian
+block), in double and single precision, against numpy's solver. """
+
+import numpy as np
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def blocks(cplx, rng):
+
+    def rand(n):
+        a = rng.standard_normal((n, n))
+        if cplx:
+            a = a + 1j * rng.standard_normal((n, n))
+        return a
+
+    mats = []
+    for n in [1, 3, 3, 7, 12]:           # several blocks of one size
+        b = rand(n)
+        mats.append(b @ b.conj().T + n * np.eye(n))      # HPD
+        mats.append(b + 2 * n * np.eye(n))               # not Hermitian
+        h = b + b.conj().T
+        d = np.diag([(-1)**i * 3 * n for i in range(n)])
+        mats.append(h + d)                               # indefinite
+    return mats
+
+
+def check(cplx, single):
+
+    rng = np.random.RandomState(1)
+    mats = blocks(cplx, rng)
+    rhs = [rng.standard_normal(len(a)) + (1j*rng.standard_normal(len(a))
+                                         if cplx else 0) for a in mats]
+
+    xs = libDPG.PatchSolve([a.tolist() for a in mats],
+                           [f.tolist() for f in rhs],
+                           complex=cplx, single=single)
+
+    tol = 1.e-4 if single else 1.e-10
+    for a, f, x in zip(mats, rhs, xs):
+        x0 = np.linalg.solve(a, f)
+        assert np.linalg.norm(np.array(x) - x0) <= tol * np.linalg.norm(x0)
+
+
+def test_patchsolver():
+    for cplx in [False, True]:
+        for single in [False, True]:
+            check(cplx, single)
+
+
+if __name__ == "__main__":
+    test_patchsolver()
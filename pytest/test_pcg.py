@@ -0,0 +1,100 @@
+""" The C++ PCG of libDPG (libDPG.pcg, libDPG.pipelinedpcg) against a
+direct solve and against pcg() of projects/pyutils, and libDPG.blockpcg
+against pcg. """
+
+from ngsolve import *
+from ngsolve.la import InnerProduct
+from netgen.geom2d import unit_square
+from math import sqrt
+import sys
+
+sys.path.append("..")
+sys.path.append("../projects/pyutils")
+import libDPG
+from pcg import pcg
+
+
+def setup(cplx):
+
+    mesh = Mesh(unit_square.GenerateMesh(maxh=0.1))
+    X = H1(mesh, order=3, dirichlet=[1,2,3,4], complex=cplx)
+    u = X.TrialFunction()
+    v = X.TestFunction()
+
+    a = BilinearForm(X)
+    a += SymbolicBFI(grad(u) * grad(v) + u * v)
+    f = LinearForm(X)
+    f += SymbolicLFI(32*(y*(1-y)+x*(1-x)) * v)
+    c = Preconditioner(a, type="local")
+    a.Assemble()
+    f.Assemble()
+    return X, a, f, c
+
+
+def check(cplx):
+
+    X, a, f, c = setup(cplx)
+    inv = a.mat.Inverse(X.FreeDofs())
+    u = f.vec.CreateVector()
+    u.data = inv * f.vec
+
+    x = libDPG.pcg(a.mat, c.mat, f.vec, tol=1.e-24, maxits=500,
+                   printrates=False)
+    d = u.CreateVector()
+    d.data = x - u
+    assert sqrt(abs(InnerProduct(d, d))) < 1.e-8 * sqrt(abs(InnerProduct(u, u)))
+
+    # the same iterates as the python version
+    its = []
+    libDPG.pcg(a.mat, c.mat, f.vec, maxits=5, printrates=False,
+               saveitfn=lambda x, it: its.append(it))
+    xp = pcg(a.mat, c.mat, f.vec, maxits=5)
+    x = libDPG.pcg(a.mat, c.mat, f.vec, maxits=5, printrates=False)
+    d.data = x - xp
+    assert its == list(range(5))
+    assert sqrt(abs(InnerProduct(d, d))) < 1.e-10 * sqrt(abs(InnerProduct(xp, xp)))
+
+    # pipelined, with and without residual replacement
+    for replace in [0, 10]:
+        x = libDPG.pipelinedpcg(a.mat, c.mat, f.vec, tol=1.e-24, maxits=500,
+                                replace=replace, printrates=False)
+        d.data = x - u
+        assert sqrt(abs(InnerProduct(d, d))) < 1.e-8 * sqrt(abs(InnerProduct(u, u)))
+
+
+def checkblock(cplx):
+    """ blockpcg for three right hand sides, with the vertex patch
+    preconditioner (VertexPatchSchwarz::MultBlock), against pcg for
+    each """
+
+    X, a, f, c = setup(cplx)
+    c = Preconditioner(a, type="vertexschwarz")
+    a.Assemble()
+
+    bs = []
+    for cf in [1, x, ((1+1j) if cplx else 1) * y*y]:
+        g = LinearForm(X)
+        g += SymbolicLFI(cf * X.TestFunction())
+        g.Assemble()
+        bs.append(g.vec)
+
+    xs = libDPG.blockpcg(a.mat, c.mat, bs, tol=1.e-12, maxits=500,
+                         printrates=False)
+    d = bs[0].CreateVector()
+    for b, xb in zip(bs, xs):
+        xp = libDPG.pcg(a.mat, c.mat, b, tol=1.e-28, maxits=500,
+                        printrates=False)
+        d.data = xb - xp
+        assert sqrt(abs(InnerProduct(d, d))) < 1.e-8 * sqrt(abs(InnerProduct(xp, xp)))
+
+
+def test_pcg():
+    ngsglobals.msg_level = 1
+    check(False)
+    check(True)
+    checkblock(False)
+    checkblock(True)
+
+
+if __name__ == "__main__":
+    test_pcg()
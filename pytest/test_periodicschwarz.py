@@ -0,0 +1,88 @@
+""" The vertex patch Schwarz preconditioner (type "vertexschwarz") with
+periodic H(curl) spaces: identified vertices share one patch made of
+used master dofs only, and PCG needs about as many iterations as with
+the same spaces without the periodic identification. """
+
+from ngsolve import *
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def setup(periodic, p=1):
+
+    mesh = Mesh("../pde/periodiclayers.vol.gz")   # periodic bc 1, z: 2, 3
+    if periodic:
+        kind, flags = "hcurlho_periodic", {"xends": [0,1], "yends": [0,1]}
+    else:
+        kind, flags = "hcurlho", {}
+    S0 = FESpace("hcurlho", mesh, order=p+2, complex=True,
+                 discontinuous=True)
+    S1 = FESpace(kind, mesh, order=p, complex=True, dirichlet=[2,3], **flags)
+    S2 = FESpace(kind, mesh, order=p+1, complex=True, orderinner=0, **flags)
+    S = FESpace([S0,S1,S2], complex=True)
+
+    e,E,M = S.TrialFunction()
+    v,F,W = S.TestFunction()
+    n = specialcf.normal(mesh.dim)
+    def cross(G,N):
+        return CoefficientFunction( ( G[1]*N[2] - G[2]*N[1],
+                                      G[2]*N[0] - G[0]*N[2],
+                                      G[0]*N[1] - G[1]*N[0] ) )
+
+    a = BilinearForm(S, symmetric=False, eliminate_internal=True)
+    a += SymbolicBFI(curl(E) * curl(v) - E*v)
+    a += SymbolicBFI(curl(e) * curl(F) - e*F)
+    a += SymbolicBFI(M * cross(v,n), element_boundary=True)
+    a += SymbolicBFI(cross(e,n) * W, element_boundary=True)
+    a += SymbolicBFI(curl(e) * curl(v) + e*v)
+    f = LinearForm(S)
+    f += SymbolicLFI(CoefficientFunction((1,x,y*z)) * v)
+
+    c = Preconditioner(a, type="vertexschwarz")
+    with TaskManager():
+        a.Assemble()
+        f.Assemble()
+    f.vec.data += a.harmonic_extension_trans * f.vec
+    return mesh, S, a, f, c
+
+
+def iterations(a, f, c):
+
+    its = []
+    libDPG.pcg(a.mat, c.mat, f.vec, tol=1.e-20, maxits=2000,
+               printrates=False, saveitfn=lambda x, it: its.append(it))
+    return len(its)
+
+
+def test_periodicblocks():
+
+    ngsglobals.msg_level = 1
+    mesh, S, a, f, c = setup(True)
+
+    # the dofs elements use: slave dofs are mapped to their masters
+    used = set()
+    for el in mesh.Elements(VOL):
+        used.update(S.GetDofNrs(el))
+
+    blocks = [b for b in libDPG.PatchInfo(c.mat)["blocks"] if len(b)]
+    assert 0 < len(blocks) < mesh.nv      # identified vertices share one
+    for b in blocks:
+        for d in b:
+            assert S.CouplingType(d) != COUPLING_TYPE.UNUSED_DOF
+            assert d in used
+
+
+def test_periodiciterations():
+
+    ngsglobals.msg_level = 1
+    nper = iterations(*setup(True)[2:])
+    nnon = iterations(*setup(False)[2:])
+    print("CG iterations: periodic", nper, "not periodic", nnon)
+    assert nper <= 2 * nnon
+
+
+if __name__ == "__main__":
+    test_periodicblocks()
+    test_periodiciterations()
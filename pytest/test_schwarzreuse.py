@@ -0,0 +1,81 @@
+""" The vertex patch Schwarz preconditioner with the flag "reuse": after
+a local refinement, most patches keep their factors, and the
+preconditioner and the PCG solution are those of a preconditioner set
+up afresh. """
+
+from ngsolve import *
+from netgen.geom2d import unit_square
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def test_schwarzreuse():
+
+    ngsglobals.msg_level = 1
+    mesh = Mesh(unit_square.GenerateMesh(maxh=0.1))
+
+    p = 2
+    Xo = H1(mesh, order=p+1, dirichlet=[1,2,3,4], complex=True)
+    Xf = HDiv(mesh, order=p, complex=True, orderinner=1)
+    Y  = L2(mesh, order=p+2, complex=True)
+    XY = FESpace([Xo,Xf,Y], complex=True)
+
+    u,q,e = XY.TrialFunction()
+    w,r,d = XY.TestFunction()
+    n = specialcf.normal(mesh.dim)
+
+    a = BilinearForm(XY, symmetric=False, eliminate_internal=True)
+    a += SymbolicBFI(grad(u) * grad(d) + grad(e) * grad(w))
+    a += SymbolicBFI(q*n*d, element_boundary=True)
+    a += SymbolicBFI(e*r*n, element_boundary=True)
+    a += SymbolicBFI(grad(e) * grad(d) + e*d)
+    b = LinearForm(XY)
+    b += SymbolicLFI(CoefficientFunction(1+x*y) * d)
+
+    creuse = Preconditioner(a, type="vertexschwarz", flags={"reuse": True})
+    cfresh = Preconditioner(a, type="vertexschwarz")
+
+    for step in range(2):
+        if step:
+            # refine a few elements at the origin
+            pts = [vert.point for vert in mesh.vertices]
+            for el in mesh.Elements():
+                mesh.SetRefinementFlag(el, min(pts[vn.nr][0]**2 +
+                                               pts[vn.nr][1]**2
+                                               for vn in el.vertices) < 0.01)
+            mesh.Refine()
+            XY.Update()
+        with TaskManager():
+            a.Assemble()
+            b.Assemble()
+        b.vec.data += a.harmonic_extension_trans * b.vec
+
+    info = libDPG.PatchInfo(creuse.mat)
+    npatches = len([bl for bl in info["blocks"] if len(bl)])
+    print("reused", info["reused"], "of", npatches, "patches")
+    assert info["reused"] >= 0.8 * npatches
+    assert libDPG.PatchInfo(cfresh.mat)["reused"] == 0
+
+    # the same preconditioner ...
+    v = a.mat.CreateColVector()
+    v.SetRandom()
+    w1 = v.CreateVector()
+    w2 = v.CreateVector()
+    w1.data = creuse.mat * v
+    w2.data = cfresh.mat * v
+    w1.data -= w2
+    assert w1.Norm() <= 1.e-8 * w2.Norm()
+
+    # ... and the same solution
+    x1 = libDPG.pcg(a.mat, creuse.mat, b.vec, tol=1.e-12, maxits=500,
+                    printrates=False)
+    x2 = libDPG.pcg(a.mat, cfresh.mat, b.vec, tol=1.e-12, maxits=500,
+                    printrates=False)
+    x1.data -= x2
+    assert x1.Norm() <= 1.e-8 * x2.Norm()
+
+
+if __name__ == "__main__":
+    test_schwarzreuse()
@@ -0,0 +1,100 @@
+""" Sum factorization on quadrilaterals and hexahedra
+(libDPG.SetSumFactorization) against the generic integration of
+GradGrad, EyeEye, TraceTrace and FluxTrace. """
+
+from ngsolve import *
+from netgen.geom2d import unit_square
+from netgen.meshing import Mesh as NGMesh, MeshPoint, Element3D, Element2D
+from netgen.meshing import FaceDescriptor, Pnt
+from math import sqrt
+import sys
+
+sys.path.append("..")
+import libDPG
+
+
+def hexmesh(n=2):
+    """ n^3 hexahedra on a (non-affinely) distorted unit cube """
+
+    ngmesh = NGMesh(dim=3)
+    pnums = {}
+    for i in range(n+1):
+        for j in range(n+1):
+            for k in range(n+1):
+                x, y, z = i/n, j/n, k/n
+                pnums[i,j,k] = ngmesh.Add(MeshPoint(Pnt(x + 0.1*y*z, y, z + 0.1*x*y)))
+
+    ngmesh.SetMaterial(1, "cube")
+    for i in range(n):
+        for j in range(n):
+            for k in range(n):
+                ngmesh.Add(Element3D(1, [pnums[i,j,k], pnums[i+1,j,k],
+                                         pnums[i+1,j+1,k], pnums[i,j+1,k],
+                                         pnums[i,j,k+1], pnums[i+1,j,k+1],
+                                         pnums[i+1,j+1,k+1], pnums[i,j+1,k+1]]))
+
+    ngmesh.Add(FaceDescriptor(surfnr=1, domin=1, bc=1))
+    for i in range(n):
+        for j in range(n):
+            for face in [[(i,j,0), (i,j+1,0), (i+1,j+1,0), (i+1,j,0)],
+                         [(i,j,n), (i+1,j,n), (i+1,j+1,n), (i,j+1,n)],
+                         [(i,0,j), (i+1,0,j), (i+1,0,j+1), (i,0,j+1)],
+                         [(i,n,j), (i,n,j+1), (i+1,n,j+1), (i+1,n,j)],
+                         [(0,i,j), (0,i,j+1), (0,i+1,j+1), (0,i+1,j)],
+                         [(n,i,j), (n,i+1,j), (n,i+1,j+1), (n,i,j+1)]]:
+                ngmesh.Add(Element2D(1, [pnums[v] for v in face]))
+    return Mesh(ngmesh)
+
+
+def assemble(mesh, p, cplx):
+
+    X = H1(mesh, order=p+1, complex=cplx)
+    Q = HDiv(mesh, order=p, orderinner=0, complex=cplx)
+    Y = L2(mesh, order=p+2, complex=cplx)
+    XY = FESpace([X,Q,Y], flags={"complex":cplx})
+
+    c = (1+x*y) * (1+1j) if cplx else 1+x*y
+    a = BilinearForm(XY, symmetric=False)
+    a += BFI("gradgrad", coef=[1,3,c])
+    a += BFI("flxtrc",   coef=[2,3,c])
+    a += BFI("eyeeye",   coef=[1,3,c])
+    a += BFI("trctrc",   coef=[1,3,c])
+    a += BFI("gradgrad", coef=[3,3,1])
+    a += BFI("eyeeye",   coef=[3,3,1])
+    a.Assemble()
+    return a
+
+
+def compare(mesh, p, cplx):
+
+    libDPG.SetSumFactorization(True)
+    a1 = assemble(mesh, p, cplx)
+    libDPG.SetSumFactorization(False)
+    a0 = assemble(mesh, p, cplx)
+    libDPG.SetSumFactorization(True)
+
+    # the same matrices up to round-off: compare on random vectors
+    v = a0.mat.CreateColVector()
+    w0 = a0.mat.CreateColVector()
+    w1 = a0.mat.CreateColVector()
+    for trial in range(3):
+        v.SetRandom()
+        w0.data = a0.mat * v
+        w1.data = a1.mat * v
+        w1.data -= w0
+        assert w1.Norm() <= 1.e-10 * w0.Norm()
+
+
+def test_sumfactorization():
+
+    ngsglobals.msg_level = 1
+    quads = Mesh(unit_square.GenerateMesh(quad_dominated=True, maxh=0.3))
+    hexes = hexmesh()
+    for p in [1, 2]:
+        for cplx in [False, True]:
+            compare(quads, p, cplx)
+            compare(hexes, p, cplx)
+
+
+if __name__ == "__main__":
+    test_sumfactorization()
@@ -6,6 +6,11 @@
 
 from ngsolve import *
 from netgen.geom2d import SplineGeometry
+import sys
+
+# element matrices of unrefined elements are reused in later steps
+sys.path.append("..")
+import libDPG as dpg
 
 geom = SplineGeometry("../pde/square.in2d")
 mesh = Mesh( geom.GenerateMesh(maxh=0.5))
@@ -26,10 +31,11 @@ w,r,d = XY.TestFunction()
 
 n = specialcf.normal(mesh.dim)
 
-a = BilinearForm(XY,symmetric=True, eliminate_internal=True)
-a+= SymbolicBFI(grad(u) * grad(d) + grad(e) * grad(w))
-a+= SymbolicBFI(q*n*d, element_boundary=True)
-a+= SymbolicBFI(e*r*n, element_boundary=True)
+# nonsymmetric storage: mlschwarz smooths colored patches in parallel
+a = BilinearForm(XY,symmetric=False, eliminate_internal=True)
+a+= dpg.Cached(SymbolicBFI(grad(u) * grad(d) + grad(e) * grad(w)))
+a+= dpg.Cached(SymbolicBFI(q*n*d, element_boundary=True))
+a+= dpg.Cached(SymbolicBFI(e*r*n, element_boundary=True))
 a.components[2] += Mass(1.0)
 a.components[2] += Laplace(1.0)
 
@@ -37,8 +43,9 @@ b = LinearForm(XY)
 b+= SymbolicLFI(f*d)
 
 uqe = GridFunction(XY)
-c = Preconditioner(a, type="direct")
-bvp = BVP(bf=a, lf=b, gf=uqe, pre=c)
+# V-cycle over the meshes of the adaptive loop (or type="direct")
+c = Preconditioner(a, type="mlschwarz")
+bvp = BVP(bf=a, lf=b, gf=uqe, pre=c, maxsteps=500, prec=1.e-10)
 
 
 def SolveBVP():
@@ -0,0 +1,35 @@
+#ifndef FILE_PERIODICDOFMAP_HPP
+#define FILE_PERIODICDOFMAP_HPP
+
+
+/* Dof and vertex identifications of periodic spaces.
+
+   The periodic spaces (h1ho_periodic, hcurlho_periodic) map the dofs
+   of slave vertices, edges and faces to the dofs of their masters (in
+   GetDofNrs of elements). The node-wise GetVertexDofNrs etc. of the
+   base spaces still return the unmapped (UNUSED_DOF) slave dofs.
+   Code that works node by node, like the vertex patches of
+   VertexPatchSchwarz, uses this interface to merge identified nodes:
+
+     MasterDof(i)     the dof identified with dof i (i if none),
+     MasterVertex(v)  the vertex identified with vertex v (v if none).
+
+   Both are the identity until the space is updated.
+ */
+
+
+namespace dpg {
+
+  class PeriodicDofMap {
+
+  public:
+
+    virtual ~PeriodicDofMap () { ; }
+
+    virtual int MasterDof (int dof) const = 0;
+    virtual int MasterVertex (int v) const = 0;
+  };
+
+}
+
+#endif
@@ -6,9 +6,11 @@
 */
 
 #include <comp.hpp>
+#include "periodicdofmap.hpp"
 using namespace ngcomp;
 
-class PeriodicH1Space : public H1HighOrderFESpace  {
+class PeriodicH1Space : public H1HighOrderFESpace,
+                        public dpg::PeriodicDofMap  {
 
 private:
 
@@ -30,6 +32,12 @@ public:
   virtual string GetClassName () const { return "PeriodicH1Space"; }
 
   virtual void Update (LocalHeap & lh);
+
+  // dpg::PeriodicDofMap
+  virtual int MasterDof (int dof) const
+  { return dofmapx.Size() ? dofmapy[dofmapx[dof]] : dof; }
+  virtual int MasterVertex (int v) const
+  { return dofmapx.Size() ? dofmapy[dofmapx[v]] : v; }
  
   virtual void GetDofNrs (int elnr, Array<int> & dnums) const;
   virtual void GetSDofNrs (int elnr, Array<int> & dnums) const;
@@ -3,9 +3,11 @@
 */
 
 #include <comp.hpp>
+#include "periodicdofmap.hpp"
 using namespace ngcomp;
 
-class PeriodicHCurlSpace : public HCurlHighOrderFESpace {
+class PeriodicHCurlSpace : public HCurlHighOrderFESpace,
+                           public dpg::PeriodicDofMap {
 
 private:
 
@@ -61,6 +63,12 @@ public:
 
   virtual void Update (LocalHeap & lh);
 
+  // dpg::PeriodicDofMap
+  virtual int MasterDof (int dof) const
+  { return dofmapx.Size() ? dofmapy[dofmapx[dof]] : dof; }
+  virtual int MasterVertex (int v) const
+  { return vertmapx.Size() ? vertmapy[vertmapx[v]] : v; }
+
   virtual void GetDofNrs (ElementId ei, Array<int> & dnums) const;
 
   virtual FiniteElement & GetFE (ElementId ei, Allocator & alloc) const;